@@ -0,0 +1,54 @@
+#include "stdafx.h"
+#include "AllocationTracker.hpp"
+#include <new>
+#include <stdlib.h>
+
+namespace Veldrid
+{
+#ifdef VD_TRACK_ALLOCATIONS
+static thread_local uint64_t s_threadAllocationCount = 0;
+
+static void* CountedAllocate(size_t size)
+{
+    s_threadAllocationCount += 1;
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+uint64_t GetThreadAllocationCount() { return s_threadAllocationCount; }
+#else
+uint64_t GetThreadAllocationCount() { return 0; }
+#endif
+}
+
+#ifdef VD_TRACK_ALLOCATIONS
+// Over-aligned allocations keep the default operators and aren't counted.
+void* operator new(size_t size) { return Veldrid::CountedAllocate(size); }
+void* operator new[](size_t size) { return Veldrid::CountedAllocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return Veldrid::CountedAllocate(size);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { free(memory); }
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+
+namespace Veldrid
+{
+// Building with VD_TRACK_ALLOCATIONS defined replaces the global operator new and delete to count the heap
+// allocations made on each thread. Only allocations made by this library are seen, since each module on
+// Windows has its own operator new. Without VD_TRACK_ALLOCATIONS the count is always 0.
+uint64_t GetThreadAllocationCount();
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Veldrid
+{
+// Index of the least significant set bit. The value must be non-zero.
+inline uint32_t FindFirstSetBit(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+}
+
+// Index of the most significant set bit. The value must be non-zero.
+inline uint32_t FindLastSetBit(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<uint32_t>(index);
+#else
+    return 63u - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+}
+
+inline uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+}
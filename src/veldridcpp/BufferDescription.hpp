@@ -1,18 +1,21 @@
 #pragma once
 #include "BufferUsage.hpp"
+#include "MemoryIntent.hpp"
 #include <stdint.h>
 
 namespace Veldrid
 {
 struct BufferDescription
 {
-    BufferDescription(uint32_t size, BufferUsage usage)
+    BufferDescription(uint32_t size, BufferUsage usage, MemoryIntent intent = MemoryIntent::Default)
     {
         SizeInBytes = size;
         Usage = usage;
+        Intent = intent;
     }
 
     uint32_t SizeInBytes;
     BufferUsage Usage;
+    MemoryIntent Intent;
 };
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+#include "StagingRing.hpp"
+#include "stdint.h"
+
+namespace Veldrid
+{
+class DeviceBuffer;
+
+// An in-place buffer update, filled in by BeginUpdateBuffer and passed back to EndUpdateBuffer.
+struct BufferUpdate
+{
+    // SizeInBytes of writable memory for the new contents.
+    void* Data;
+    DeviceBuffer* Buffer;
+    uint32_t Offset;
+    uint32_t SizeInBytes;
+    // The upload memory behind Data. Buffer is VK_NULL_HANDLE if Data points into the destination itself.
+    StagingAllocation Staging;
+};
+}
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "ChunkAllocator.hpp"
+#include "BitOperations.hpp"
 #include "VulkanUtil.hpp"
+#include <algorithm>
 
 namespace Veldrid
 {
@@ -17,68 +19,301 @@ ChunkAllocator::ChunkAllocator(VkDevice device, uint32_t memoryTypeIndex, bool p
     memoryAI.memoryTypeIndex = _memoryTypeIndex;
     CheckResult(vkAllocateMemory(_device, &memoryAI, nullptr, &_memory));
 
-    void* mappedPtr = nullptr;
+    _mappedPtr = nullptr;
     if (persistentMapped)
     {
-        CheckResult(vkMapMemory(_device, _memory, 0, _totalMemorySize, 0, &mappedPtr));
+        CheckResult(vkMapMemory(_device, _memory, 0, _totalMemorySize, 0, &_mappedPtr));
     }
 
-    _freeBlocks.emplace_back(_memory, 0, _totalMemorySize, _memoryTypeIndex, mappedPtr);
+    for (uint32_t fl = 0; fl < FirstLevelCount; fl++)
+    {
+        _secondLevelBitmaps[fl] = 0;
+        for (uint32_t sl = 0; sl < SecondLevelCount; sl++)
+        {
+            _freeLists[fl][sl] = NullIndex;
+        }
+    }
+
+    uint32_t initialNode = CreateNode(0, _totalMemorySize);
+    InsertFreeNode(initialNode);
 }
 
-bool ChunkAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block)
+void ChunkAllocator::MapSize(VkDeviceSize size, uint32_t* firstLevel, uint32_t* secondLevel)
+{
+    if (size < SmallBlockSize)
+    {
+        // Small blocks are spread linearly across the second level of the first list.
+        *firstLevel = 0;
+        *secondLevel = static_cast<uint32_t>(size >> GranularityLog2);
+    }
+    else
+    {
+        uint32_t fls = FindLastSetBit(size);
+        *secondLevel = static_cast<uint32_t>(size >> (fls - SecondLevelCountLog2)) ^ SecondLevelCount;
+        *firstLevel = fls - FirstLevelShift + 1;
+    }
+}
+
+void ChunkAllocator::MapSizeRoundUp(VkDeviceSize size, uint32_t* firstLevel, uint32_t* secondLevel)
 {
-    for (int i = 0; i < _freeBlocks.size(); i++)
+    // Round up to the next list boundary so that any block in the resulting list is large enough.
+    if (size >= SmallBlockSize)
     {
-        MemoryBlock freeBlock = _freeBlocks[i];
-        VkDeviceSize alignedBlockSize = freeBlock.Size;
-        if (freeBlock.Offset % alignment != 0)
+        size += (VkDeviceSize(1) << (FindLastSetBit(size) - SecondLevelCountLog2)) - 1;
+    }
+
+    MapSize(size, firstLevel, secondLevel);
+}
+
+uint32_t ChunkAllocator::FindSuitableBlock(VkDeviceSize size)
+{
+    uint32_t fl, sl;
+    MapSizeRoundUp(size, &fl, &sl);
+    if (fl < FirstLevelCount)
+    {
+        uint32_t slMap = _secondLevelBitmaps[fl] & (~0u << sl);
+        if (slMap == 0)
         {
-            VkDeviceSize alignmentCorrection = (alignment - freeBlock.Offset % alignment);
-            if (alignedBlockSize <= alignmentCorrection)
+            uint64_t flMap = _firstLevelBitmap & (~uint64_t(0) << (fl + 1));
+            if (flMap != 0)
             {
-                continue;
+                fl = FindFirstSetBit(flMap);
+                slMap = _secondLevelBitmaps[fl];
             }
-            alignedBlockSize -= alignmentCorrection;
         }
 
-        if (alignedBlockSize >= size) // Valid match -- split it and return.
+        if (slMap != 0)
         {
-            _freeBlocks.erase(_freeBlocks.begin() + i);
+            sl = FindFirstSetBit(slMap);
+            return _freeLists[fl][sl];
+        }
+    }
 
-            freeBlock.Size = alignedBlockSize;
-            if ((freeBlock.Offset % alignment) != 0)
-            {
-                freeBlock.Offset += alignment - (freeBlock.Offset % alignment);
-            }
+    // Nothing in the rounded-up lists. The head of the exact list may still fit
+    // (e.g. the chunk is almost full and the only candidate shares the request's list).
+    MapSize(size, &fl, &sl);
+    uint32_t head = _freeLists[fl][sl];
+    if (head != NullIndex && _nodes[head].Size >= size)
+    {
+        return head;
+    }
 
-            *block = freeBlock;
+    return NullIndex;
+}
 
-            if (alignedBlockSize != size)
+uint32_t ChunkAllocator::CreateNode(VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t index;
+    if (_unusedNodes.size() > 0)
+    {
+        index = _unusedNodes.back();
+        _unusedNodes.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+    }
+
+    BlockNode& node = _nodes[index];
+    node.Offset = offset;
+    node.Size = size;
+    node.PrevPhysical = NullIndex;
+    node.NextPhysical = NullIndex;
+    node.PrevFree = NullIndex;
+    node.NextFree = NullIndex;
+    node.IsFree = false;
+    return index;
+}
+
+void ChunkAllocator::ReleaseNode(uint32_t index)
+{
+    _unusedNodes.push_back(index);
+}
+
+void ChunkAllocator::InsertFreeNode(uint32_t index)
+{
+    uint32_t fl, sl;
+    MapSize(_nodes[index].Size, &fl, &sl);
+
+    uint32_t head = _freeLists[fl][sl];
+    _nodes[index].PrevFree = NullIndex;
+    _nodes[index].NextFree = head;
+    _nodes[index].IsFree = true;
+    if (head != NullIndex)
+    {
+        _nodes[head].PrevFree = index;
+    }
+
+    _freeLists[fl][sl] = index;
+    _firstLevelBitmap |= uint64_t(1) << fl;
+    _secondLevelBitmaps[fl] |= 1u << sl;
+}
+
+void ChunkAllocator::RemoveFreeNode(uint32_t index)
+{
+    uint32_t fl, sl;
+    MapSize(_nodes[index].Size, &fl, &sl);
+
+    uint32_t prev = _nodes[index].PrevFree;
+    uint32_t next = _nodes[index].NextFree;
+    if (prev != NullIndex)
+    {
+        _nodes[prev].NextFree = next;
+    }
+    if (next != NullIndex)
+    {
+        _nodes[next].PrevFree = prev;
+    }
+
+    if (_freeLists[fl][sl] == index)
+    {
+        _freeLists[fl][sl] = next;
+        if (next == NullIndex)
+        {
+            _secondLevelBitmaps[fl] &= ~(1u << sl);
+            if (_secondLevelBitmaps[fl] == 0)
             {
-                _freeBlocks.emplace_back(
-                    freeBlock.DeviceMemory,
-                    freeBlock.Offset + size,
-                    freeBlock.Size - size,
-                    _memoryTypeIndex,
-                    freeBlock.BaseMappedPointer);
-                *block = freeBlock;
-                block->Size = size;
+                _firstLevelBitmap &= ~(uint64_t(1) << fl);
             }
-
-            _totalAllocatedBytes += alignedBlockSize;
-            return true;
         }
     }
 
-    block = nullptr;
-    return false;
+    _nodes[index].IsFree = false;
+}
+
+uint32_t ChunkAllocator::SplitNode(uint32_t index, VkDeviceSize size)
+{
+    // Note: CreateNode may grow _nodes, so no references are held across it.
+    uint32_t remainder = CreateNode(_nodes[index].Offset + size, _nodes[index].Size - size);
+    uint32_t next = _nodes[index].NextPhysical;
+    _nodes[remainder].PrevPhysical = index;
+    _nodes[remainder].NextPhysical = next;
+    if (next != NullIndex)
+    {
+        _nodes[next].PrevPhysical = remainder;
+    }
+
+    _nodes[index].NextPhysical = remainder;
+    _nodes[index].Size = size;
+    return remainder;
+}
+
+void ChunkAllocator::MergeWithNext(uint32_t index)
+{
+    uint32_t next = _nodes[index].NextPhysical;
+    uint32_t nextNext = _nodes[next].NextPhysical;
+    _nodes[index].Size += _nodes[next].Size;
+    _nodes[index].NextPhysical = nextNext;
+    if (nextNext != NullIndex)
+    {
+        _nodes[nextNext].PrevPhysical = index;
+    }
+
+    ReleaseNode(next);
+}
+
+bool ChunkAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block)
+{
+    VkDeviceSize alignedSize = AlignUp(std::max<VkDeviceSize>(size, 1), Granularity);
+    VkDeviceSize searchSize = alignment > Granularity
+        ? alignedSize + alignment - Granularity
+        : alignedSize;
+
+    uint32_t index = FindSuitableBlock(searchSize);
+    if (index == NullIndex)
+    {
+        return false;
+    }
+
+    RemoveFreeNode(index);
+
+    // Free blocks are always coalesced, so neither physical neighbour of "index" is free here.
+    VkDeviceSize padding = AlignUp(_nodes[index].Offset, alignment) - _nodes[index].Offset;
+    if (padding != 0)
+    {
+        uint32_t alignedIndex = SplitNode(index, padding);
+        InsertFreeNode(index);
+        index = alignedIndex;
+    }
+
+    if (_nodes[index].Size > alignedSize)
+    {
+        uint32_t remainder = SplitNode(index, alignedSize);
+        InsertFreeNode(remainder);
+    }
+
+    _totalAllocatedBytes += _nodes[index].Size;
+
+    *block = MemoryBlock(_memory, _nodes[index].Offset, size, _memoryTypeIndex, _mappedPtr);
+    block->BlockIndex = index;
+    return true;
 }
 
 void ChunkAllocator::Free(MemoryBlock block)
 {
-    _freeBlocks.push_back(block);
+    uint32_t index = block.BlockIndex;
+    VdAssert(!_nodes[index].IsFree && _nodes[index].Offset == block.Offset, "Invalid MemoryBlock freed.");
+    _totalAllocatedBytes -= _nodes[index].Size;
+
+    uint32_t next = _nodes[index].NextPhysical;
+    if (next != NullIndex && _nodes[next].IsFree)
+    {
+        RemoveFreeNode(next);
+        MergeWithNext(index);
+    }
+
+    uint32_t prev = _nodes[index].PrevPhysical;
+    if (prev != NullIndex && _nodes[prev].IsFree)
+    {
+        RemoveFreeNode(prev);
+        MergeWithNext(prev);
+        index = prev;
+    }
+
+    InsertFreeNode(index);
 }
 
 void ChunkAllocator::Dispose() { vkFreeMemory(_device, _memory, nullptr); }
+
+// The node at offset 0 is never released (it has no previous block to merge into), so the
+// physical block list always starts at node 0.
+void ChunkAllocator::AddStatistics(MemoryTypeStatistics* stats) const
+{
+    stats->ChunkCount += 1;
+    stats->ChunkBytes += _totalMemorySize;
+    stats->ChunkAllocatedBytes += _totalAllocatedBytes;
+    for (uint32_t index = 0; index != NullIndex; index = _nodes[index].NextPhysical)
+    {
+        const BlockNode& node = _nodes[index];
+        if (node.IsFree)
+        {
+            stats->FreeBlockCount += 1;
+            stats->LargestFreeBlock = std::max(stats->LargestFreeBlock, node.Size);
+        }
+        else
+        {
+            stats->ChunkAllocationCount += 1;
+        }
+    }
+}
+
+void ChunkAllocator::WriteJson(std::ostream& json) const
+{
+    json << "{\"size\":" << _totalMemorySize
+        << ",\"allocatedBytes\":" << _totalAllocatedBytes
+        << ",\"blocks\":[";
+    for (uint32_t index = 0; index != NullIndex; index = _nodes[index].NextPhysical)
+    {
+        const BlockNode& node = _nodes[index];
+        if (index != 0)
+        {
+            json << ",";
+        }
+        json << "{\"offset\":" << node.Offset
+            << ",\"size\":" << node.Size
+            << ",\"free\":" << (node.IsFree ? "true" : "false") << "}";
+    }
+    json << "]}";
+}
 }
\ No newline at end of file
@@ -2,27 +2,74 @@
 #include <stdint.h>
 #include "vulkan.h"
 #include <vector>
+#include <ostream>
 #include "MemoryBlock.hpp"
+#include "MemoryStatistics.hpp"
 namespace Veldrid
 {
+// Sub-allocates a single VkDeviceMemory chunk using a two-level segregated-fit (TLSF) free list.
+// Allocate and Free are O(1); freed blocks are merged with their free physical neighbours.
 class ChunkAllocator
 {
 private:
     static const VkDeviceSize PersistentMappedChunkSize = 1024 * 1024 * 64;
     static const VkDeviceSize UnmappedChunkSize = 1024 * 1024 * 256;
+
+    // Every block offset and size is a multiple of the granularity.
+    static const uint32_t GranularityLog2 = 4;
+    static const VkDeviceSize Granularity = 1 << GranularityLog2;
+    static const uint32_t SecondLevelCountLog2 = 5;
+    static const uint32_t SecondLevelCount = 1 << SecondLevelCountLog2;
+    static const uint32_t FirstLevelShift = SecondLevelCountLog2 + GranularityLog2;
+    static const VkDeviceSize SmallBlockSize = 1 << FirstLevelShift;
+    static const uint32_t FirstLevelCount = 64 - FirstLevelShift + 1;
+    static const uint32_t NullIndex = UINT32_MAX;
+
+    struct BlockNode
+    {
+        VkDeviceSize Offset;
+        VkDeviceSize Size;
+        uint32_t PrevPhysical;
+        uint32_t NextPhysical;
+        uint32_t PrevFree;
+        uint32_t NextFree;
+        bool IsFree;
+    };
+
     VkDevice _device;
     uint32_t _memoryTypeIndex;
     bool _persistentMapped;
-    std::vector<MemoryBlock> _freeBlocks;
     VkDeviceMemory _memory;
+    void* _mappedPtr;
     VkDeviceSize _totalMemorySize;
     VkDeviceSize _totalAllocatedBytes = 0;
 
+    std::vector<BlockNode> _nodes;
+    std::vector<uint32_t> _unusedNodes;
+    uint64_t _firstLevelBitmap = 0;
+    uint32_t _secondLevelBitmaps[FirstLevelCount];
+    uint32_t _freeLists[FirstLevelCount][SecondLevelCount];
+
+    static void MapSize(VkDeviceSize size, uint32_t* firstLevel, uint32_t* secondLevel);
+    static void MapSizeRoundUp(VkDeviceSize size, uint32_t* firstLevel, uint32_t* secondLevel);
+    uint32_t FindSuitableBlock(VkDeviceSize size);
+    uint32_t CreateNode(VkDeviceSize offset, VkDeviceSize size);
+    void ReleaseNode(uint32_t index);
+    void InsertFreeNode(uint32_t index);
+    void RemoveFreeNode(uint32_t index);
+    uint32_t SplitNode(uint32_t index, VkDeviceSize size);
+    void MergeWithNext(uint32_t index);
+
 public:
     ChunkAllocator(VkDevice device, uint32_t memoryTypeIndex, bool persistentMapped);
     VkDeviceMemory Memory() { return  _memory; }
+    VkDeviceSize Size() const { return _totalMemorySize; }
+    VkDeviceSize AllocatedBytes() const { return _totalAllocatedBytes; }
+    bool IsEmpty() const { return _totalAllocatedBytes == 0; }
     bool Allocate(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block);
     void Free(MemoryBlock block);
     void Dispose();
+    void AddStatistics(MemoryTypeStatistics* stats) const;
+    void WriteJson(std::ostream& json) const;
 };
-}
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "MemoryManager.hpp"
 #include "ChunkAllocatorSet.hpp"
+#include <algorithm>
 
 namespace Veldrid
 {
@@ -13,26 +14,205 @@ ChunkAllocatorSet::ChunkAllocatorSet(VkDevice device, uint32_t memoryTypeIndex,
 
 bool ChunkAllocatorSet::Allocate(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock * block)
 {
-    for (ChunkAllocator& allocator : _allocators)
+    // Empty chunks are only used once every other chunk is full, so that they get a chance to be trimmed.
+    // Defragmentation sources come last, so that they can drain.
+    for (uint32_t pass = 0; pass < 3; pass++)
     {
-        if (allocator.Allocate(size, alignment, block))
+        for (uint32_t i = 0; i < _allocators.size(); i++)
         {
+            if (_allocators[i] != nullptr
+                && GetAllocationPass(i) == pass
+                && _allocators[i]->Allocate(size, alignment, block))
+            {
+                block->ChunkIndex = i;
+                _emptySinceFrames[i] = NotEmpty;
+                return true;
+            }
+        }
+    }
+
+    uint32_t index = 0;
+    while (index < _allocators.size() && _allocators[index] != nullptr)
+    {
+        index += 1;
+    }
+    if (index == _allocators.size())
+    {
+        _allocators.push_back(nullptr);
+        _emptySinceFrames.push_back(NotEmpty);
+        _isDefragmentationSource.push_back(false);
+    }
+
+    ChunkAllocator* newAllocator = new ChunkAllocator(_device, _memoryTypeIndex, _persistentMapped);
+    _allocators[index] = newAllocator;
+    _emptySinceFrames[index] = _frame;
+    if (!newAllocator->Allocate(size, alignment, block))
+    {
+        return false;
+    }
+
+    block->ChunkIndex = index;
+    _emptySinceFrames[index] = NotEmpty;
+    return true;
+}
+
+uint32_t ChunkAllocatorSet::GetAllocationPass(uint32_t index) const
+{
+    if (_isDefragmentationSource[index])
+    {
+        return 2;
+    }
+
+    return _emptySinceFrames[index] != NotEmpty ? 1 : 0;
+}
+
+bool ChunkAllocatorSet::AllocateRelocation(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block)
+{
+    for (uint32_t i = 0; i < _allocators.size(); i++)
+    {
+        if (_allocators[i] != nullptr
+            && GetAllocationPass(i) == 0
+            && _allocators[i]->Allocate(size, alignment, block))
+        {
+            block->ChunkIndex = i;
             return true;
         }
     }
 
-    ChunkAllocator& newAllocator = _allocators.emplace_back(_device, _memoryTypeIndex, _persistentMapped);
-    return newAllocator.Allocate(size, alignment, block);
+    return false;
 }
 
 void ChunkAllocatorSet::Free(MemoryBlock block)
 {
-    for (ChunkAllocator& chunk : _allocators)
+    VdAssert(block.ChunkIndex < _allocators.size()
+        && _allocators[block.ChunkIndex] != nullptr
+        && _allocators[block.ChunkIndex]->Memory() == block.DeviceMemory);
+    ChunkAllocator* chunk = _allocators[block.ChunkIndex];
+    chunk->Free(block);
+    if (chunk->IsEmpty())
+    {
+        if (_isDefragmentationSource[block.ChunkIndex])
+        {
+            ReleaseChunk(block.ChunkIndex);
+        }
+        else
+        {
+            _emptySinceFrames[block.ChunkIndex] = _frame;
+        }
+    }
+}
+
+void ChunkAllocatorSet::SelectDefragmentationSources()
+{
+    std::vector<uint32_t> chunks;
+    VkDeviceSize freeBytes = 0;
+    for (uint32_t i = 0; i < _allocators.size(); i++)
+    {
+        _isDefragmentationSource[i] = false;
+        if (_allocators[i] != nullptr && !_allocators[i]->IsEmpty())
+        {
+            chunks.push_back(i);
+            freeBytes += _allocators[i]->Size() - _allocators[i]->AllocatedBytes();
+        }
+    }
+
+    std::sort(chunks.begin(), chunks.end(), [this](uint32_t a, uint32_t b)
+    {
+        return _allocators[a]->AllocatedBytes() < _allocators[b]->AllocatedBytes();
+    });
+
+    // Free space is not contiguous, so some moves may still fail; those blocks simply stay where they are.
+    VkDeviceSize sourceBytes = 0;
+    for (uint32_t i = 0; i + 1 < chunks.size(); i++)
     {
-        if (chunk.Memory() == block.DeviceMemory)
+        ChunkAllocator* chunk = _allocators[chunks[i]];
+        freeBytes -= chunk->Size() - chunk->AllocatedBytes();
+        if (sourceBytes + chunk->AllocatedBytes() > freeBytes)
         {
-            chunk.Free(block);
+            break;
         }
+
+        sourceBytes += chunk->AllocatedBytes();
+        _isDefragmentationSource[chunks[i]] = true;
     }
 }
-}
\ No newline at end of file
+
+void ChunkAllocatorSet::Trim(uint64_t frame, uint32_t frameDelay, VkDeviceSize maxEmptyBytes)
+{
+    _frame = frame;
+
+    VkDeviceSize emptyBytes = 0;
+    for (uint32_t i = 0; i < _allocators.size(); i++)
+    {
+        if (_allocators[i] == nullptr || _emptySinceFrames[i] == NotEmpty)
+        {
+            continue;
+        }
+
+        if (frame - _emptySinceFrames[i] >= frameDelay)
+        {
+            ReleaseChunk(i);
+        }
+        else
+        {
+            emptyBytes += _allocators[i]->Size();
+        }
+    }
+
+    while (emptyBytes > maxEmptyBytes)
+    {
+        uint32_t oldest = UINT32_MAX;
+        for (uint32_t i = 0; i < _allocators.size(); i++)
+        {
+            if (_allocators[i] != nullptr
+                && _emptySinceFrames[i] != NotEmpty
+                && (oldest == UINT32_MAX || _emptySinceFrames[i] < _emptySinceFrames[oldest]))
+            {
+                oldest = i;
+            }
+        }
+
+        emptyBytes -= _allocators[oldest]->Size();
+        ReleaseChunk(oldest);
+    }
+}
+
+void ChunkAllocatorSet::ReleaseChunk(uint32_t index)
+{
+    _allocators[index]->Dispose();
+    delete _allocators[index];
+    _allocators[index] = nullptr;
+    _emptySinceFrames[index] = NotEmpty;
+    _isDefragmentationSource[index] = false;
+}
+
+void ChunkAllocatorSet::AddStatistics(MemoryTypeStatistics* stats) const
+{
+    for (const ChunkAllocator* chunk : _allocators)
+    {
+        if (chunk != nullptr)
+        {
+            chunk->AddStatistics(stats);
+        }
+    }
+}
+
+void ChunkAllocatorSet::WriteJson(std::ostream& json) const
+{
+    bool first = true;
+    for (const ChunkAllocator* chunk : _allocators)
+    {
+        if (chunk == nullptr)
+        {
+            continue;
+        }
+
+        if (!first)
+        {
+            json << ",";
+        }
+        first = false;
+        chunk->WriteJson(json);
+    }
+}
+}
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include "vulkan.h"
 #include <vector>
+#include <ostream>
 #include "ChunkAllocator.hpp"
 
 namespace Veldrid
@@ -9,23 +10,51 @@ namespace Veldrid
 class ChunkAllocatorSet
 {
 private:
+    static constexpr uint64_t NotEmpty = UINT64_MAX;
+
     VkDevice _device;
     uint32_t _memoryTypeIndex;
     bool _persistentMapped;
-    std::vector<ChunkAllocator> _allocators;
+    // Released chunks leave a null slot so that MemoryBlock::ChunkIndex stays valid.
+    std::vector<ChunkAllocator*> _allocators;
+    // Frame at which each chunk last became empty, or NotEmpty.
+    std::vector<uint64_t> _emptySinceFrames;
+    // Chunks being emptied by defragmentation; see SelectDefragmentationSources.
+    std::vector<bool> _isDefragmentationSource;
+    uint64_t _frame = 0;
+
+    void ReleaseChunk(uint32_t index);
+    uint32_t GetAllocationPass(uint32_t index) const;
 
 public:
     ChunkAllocatorSet(VkDevice device, uint32_t memoryTypeIndex, bool persistentMapped);
     bool Allocate(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block);
     void Free(MemoryBlock block);
+    // Marks the sparsest chunks whose contents fit into the free space of the remaining ones.
+    // New allocations only use a source chunk when nothing else fits, and a source chunk is released
+    // as soon as it becomes empty.
+    void SelectDefragmentationSources();
+    bool IsDefragmentationSource(const MemoryBlock& block) const { return _isDefragmentationSource[block.ChunkIndex]; }
+    // Allocates the new home of a block being moved out of a source chunk. Only non-empty chunks that are
+    // not sources are used; returns false rather than creating a chunk.
+    bool AllocateRelocation(VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* block);
+    // Releases chunks that have been empty for at least frameDelay frames, then releases the
+    // longest-empty chunks until no more than maxEmptyBytes of empty chunks remain.
+    void Trim(uint64_t frame, uint32_t frameDelay, VkDeviceSize maxEmptyBytes);
+    void AddStatistics(MemoryTypeStatistics* stats) const;
+    void WriteJson(std::ostream& json) const;
     void Dispose()
     {
-        for (ChunkAllocator& allocator : _allocators)
+        for (ChunkAllocator* allocator : _allocators)
         {
-            allocator.Dispose();
+            if (allocator != nullptr)
+            {
+                allocator->Dispose();
+                delete allocator;
+            }
         }
 
         delete this;
     }
 };
-}
\ No newline at end of file
+}
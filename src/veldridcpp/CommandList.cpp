@@ -6,14 +6,119 @@
 #include "Framebuffer.hpp"
 #include "FormatHelpers.hpp"
 #include "Util.hpp"
+#include "BitOperations.hpp"
+#include "AllocationTracker.hpp"
 #include "vulkan.h"
 #include <algorithm>
 
 namespace Veldrid
 {
-CommandList::CommandList(GraphicsDevice* gd)
+static_assert(CommandList::MaxVertexBuffers <= 32 && CommandList::MaxViewports <= 32, "Dirty masks have a bit per index.");
+
+// Records the dirty entries of values that differ from what is bound, one call per run of consecutive
+// indices. Returns the number of calls and adds the entries left out to skipped.
+template<typename T, typename TRecord>
+static uint32_t FlushDynamicState(
+    const T* values,
+    T* boundValues,
+    uint32_t& dirtyMask,
+    uint32_t& boundMask,
+    uint32_t& skipped,
+    TRecord record)
+{
+    uint32_t recorded = 0;
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    while (dirtyMask != 0)
+    {
+        uint32_t index = FindFirstSetBit(dirtyMask);
+        dirtyMask &= dirtyMask - 1;
+
+        uint32_t bit = 1u << index;
+        if ((boundMask & bit) != 0 && BlittableEqual(boundValues[index], values[index]))
+        {
+            skipped += 1;
+            continue;
+        }
+        boundValues[index] = values[index];
+        boundMask |= bit;
+
+        if (runLength != 0 && runStart + runLength == index)
+        {
+            runLength += 1;
+            continue;
+        }
+        if (runLength != 0)
+        {
+            record(runStart, runLength);
+            recorded += 1;
+        }
+        runStart = index;
+        runLength = 1;
+    }
+    if (runLength != 0)
+    {
+        record(runStart, runLength);
+        recorded += 1;
+    }
+
+    return recorded;
+}
+// Packets written in deferred recording mode, one per recorded call, holding its arguments.
+enum class CommandList::StreamCommand : uint32_t
+{
+    // Buffer contents, referred to by UpdateBuffer packets.
+    Data,
+    UpdateBuffer,
+    CopyBuffer,
+    CopyTexture,
+    CopyBufferToTexture,
+    SetFramebuffer,
+    SetViewport,
+    SetScissorRect,
+    ClearColorTarget,
+    ClearDepthStencil,
+    SetPipeline,
+    SetVertexBuffer,
+    SetIndexBuffer,
+    SetGraphicsResourceSet,
+    Draw,
+    DrawIndexed,
+};
+
+struct UpdateBufferCommand { DeviceBuffer* Buffer; uint32_t Offset; uint32_t Size; void* Data; };
+struct CopyBufferCommand { DeviceBuffer* Source; uint32_t SourceOffset; DeviceBuffer* Destination; uint32_t DestinationOffset; uint32_t Size; };
+struct CopyTextureCommand
+{
+    Texture* Source;
+    uint32_t SrcX, SrcY, SrcZ, SrcMipLevel, SrcBaseArrayLayer;
+    Texture* Destination;
+    uint32_t DstX, DstY, DstZ, DstMipLevel, DstBaseArrayLayer;
+    uint32_t Width, Height, Depth, LayerCount;
+};
+struct CopyBufferToTextureCommand { DeviceBuffer* Source; uint32_t SourceOffset; Texture* Destination; uint32_t MipLevel; uint32_t ArrayLayer; };
+struct SetFramebufferCommand { Framebuffer* Target; };
+struct SetViewportCommand { uint32_t Index; VkViewport Viewport; };
+struct SetScissorRectCommand { uint32_t Index; uint32_t X; uint32_t Y; uint32_t Width; uint32_t Height; };
+struct ClearColorTargetCommand { uint32_t Index; RgbaFloat ClearColor; };
+struct ClearDepthStencilCommand { float Depth; uint8_t Stencil; };
+struct SetPipelineCommand { Pipeline* Target; };
+struct SetVertexBufferCommand { uint32_t Index; DeviceBuffer* Buffer; };
+struct SetIndexBufferCommand { DeviceBuffer* Buffer; IndexFormat Format; };
+struct SetGraphicsResourceSetCommand { uint32_t Slot; ResourceSet* Set; };
+struct DrawCommand { uint32_t VertexCount; uint32_t InstanceCount; uint32_t VertexStart; uint32_t InstanceStart; };
+struct DrawIndexedCommand { uint32_t IndexCount; uint32_t InstanceCount; uint32_t IndexStart; int32_t VertexOffset; uint32_t InstanceStart; };
+
+CommandList::CommandList(GraphicsDevice* gd, bool isSecondary)
 {
     _gd = gd;
+    _isSecondary = isSecondary;
+
+    VkPhysicalDeviceProperties properties = gd->GetPhysicalDeviceProperties();
+    _vertexBufferLimit = std::min(MaxVertexBuffers, properties.limits.maxVertexInputBindings);
+    _viewportLimit = std::min(MaxViewports, properties.limits.maxViewports);
+    _resourceSetLimit = std::min(MaxResourceSets, properties.limits.maxBoundDescriptorSets);
+
     VkCommandPoolCreateInfo poolCI = {};
     poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -30,13 +135,14 @@ VkCommandBuffer CommandList::GetNextCommandBuffer()
     {
         auto ret = _availableCommandBuffers.front();
         _availableCommandBuffers.pop_front();
+        _commandBuffersMutex.unlock();
         return ret;
     }
     _commandBuffersMutex.unlock();
 
     VkCommandBufferAllocateInfo cbAI;
     cbAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    cbAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cbAI.level = _isSecondary ? VK_COMMAND_BUFFER_LEVEL_SECONDARY : VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     cbAI.commandBufferCount = 1;
     cbAI.commandPool = _pool;
     cbAI.pNext = nullptr;
@@ -48,10 +154,25 @@ VkCommandBuffer CommandList::GetNextCommandBuffer()
 
 VdResult CommandList::Begin()
 {
-    if (_commandBufferBegun)
+    if (_commandBufferBegun || _isSecondary)
     {
         return VdResult::InvalidOperation;
     }
+    if (_deferredRecording)
+    {
+        _stream.Reset();
+        _streamComplete = false;
+        _recordingToStream = true;
+        _commandBufferBegun = true;
+        return VdResult::Success;
+    }
+
+    BeginCommandBuffer();
+    return VdResult::Success;
+}
+
+void CommandList::BeginCommandBuffer()
+{
     if (_commandBufferEnded)
     {
         _commandBufferEnded = false;
@@ -66,20 +187,311 @@ VdResult CommandList::Begin()
     CheckResult(vkBeginCommandBuffer(_cb, &beginInfo));
     _commandBufferBegun = true;
 
-    ClearCachedState();
     _currentFramebuffer = nullptr;
-    _currentGraphicsPipeline = nullptr;
-    _currentGraphicsResourceSets.clear();
-    _scissorRects.clear();
+    ResetRecordingState();
+
+    _recordingSecondaries = false;
+    // The abandoned recording was never submitted, so the secondaries it executed are done with already.
+    std::vector<std::pair<CommandList*, VkCommandBuffer>> abandonedSecondaries;
+    abandonedSecondaries.swap(_executedSecondaries);
+    ReleaseSecondaries(abandonedSecondaries);
+}
+
+VdResult CommandList::SetDeferredRecording(bool enabled)
+{
+    if (_commandBufferBegun || _isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    _deferredRecording = enabled;
+    _streamComplete = false;
+    _stream.Reset();
+
+    return VdResult::Success;
+}
+
+VdResult CommandList::Replay()
+{
+    if (!_streamComplete || _commandBufferBegun)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    return TranslateStream();
+}
+
+// Records the stream into a new command buffer through the same calls an immediate CommandList makes, so
+// redundant state is filtered as usual. Stops at the first call that fails, returning its result.
+VdResult CommandList::TranslateStream()
+{
+    BeginCommandBuffer();
+
+    VdResult result = VdResult::Success;
+    CommandStream::Reader reader(_stream);
+    uint32_t type;
+    const void* payload;
+    while (result == VdResult::Success && reader.Next(&type, &payload))
+    {
+        result = TranslateCommand(static_cast<StreamCommand>(type), payload);
+    }
+
+    EndCommandBuffer();
+    return result;
+}
+
+VdResult CommandList::TranslateCommand(StreamCommand type, const void* payload)
+{
+    switch (type)
+    {
+    case StreamCommand::Data:
+        return VdResult::Success;
+    case StreamCommand::UpdateBuffer:
+    {
+        const UpdateBufferCommand* command = static_cast<const UpdateBufferCommand*>(payload);
+        return UpdateBuffer(command->Buffer, command->Offset, command->Data, command->Size);
+    }
+    case StreamCommand::CopyBuffer:
+    {
+        const CopyBufferCommand* command = static_cast<const CopyBufferCommand*>(payload);
+        return CopyBuffer(command->Source, command->SourceOffset, command->Destination, command->DestinationOffset, command->Size);
+    }
+    case StreamCommand::CopyTexture:
+    {
+        const CopyTextureCommand* command = static_cast<const CopyTextureCommand*>(payload);
+        return CopyTexture(
+            command->Source,
+            command->SrcX, command->SrcY, command->SrcZ,
+            command->SrcMipLevel, command->SrcBaseArrayLayer,
+            command->Destination,
+            command->DstX, command->DstY, command->DstZ,
+            command->DstMipLevel, command->DstBaseArrayLayer,
+            command->Width, command->Height, command->Depth,
+            command->LayerCount);
+    }
+    case StreamCommand::CopyBufferToTexture:
+    {
+        const CopyBufferToTextureCommand* command = static_cast<const CopyBufferToTextureCommand*>(payload);
+        return CopyBufferToTexture(command->Source, command->SourceOffset, command->Destination, command->MipLevel, command->ArrayLayer);
+    }
+    case StreamCommand::SetFramebuffer:
+        return SetFramebuffer(static_cast<const SetFramebufferCommand*>(payload)->Target);
+    case StreamCommand::SetViewport:
+    {
+        SetViewportCommand command = *static_cast<const SetViewportCommand*>(payload);
+        return SetViewport(command.Index, &command.Viewport);
+    }
+    case StreamCommand::SetScissorRect:
+    {
+        const SetScissorRectCommand* command = static_cast<const SetScissorRectCommand*>(payload);
+        return SetScissorRect(command->Index, command->X, command->Y, command->Width, command->Height);
+    }
+    case StreamCommand::ClearColorTarget:
+    {
+        const ClearColorTargetCommand* command = static_cast<const ClearColorTargetCommand*>(payload);
+        return ClearColorTarget(command->Index, command->ClearColor);
+    }
+    case StreamCommand::ClearDepthStencil:
+    {
+        const ClearDepthStencilCommand* command = static_cast<const ClearDepthStencilCommand*>(payload);
+        return ClearDepthStencil(command->Depth, command->Stencil);
+    }
+    case StreamCommand::SetPipeline:
+        return SetPipeline(static_cast<const SetPipelineCommand*>(payload)->Target);
+    case StreamCommand::SetVertexBuffer:
+    {
+        const SetVertexBufferCommand* command = static_cast<const SetVertexBufferCommand*>(payload);
+        return SetVertexBuffer(command->Index, command->Buffer);
+    }
+    case StreamCommand::SetIndexBuffer:
+    {
+        const SetIndexBufferCommand* command = static_cast<const SetIndexBufferCommand*>(payload);
+        return SetIndexBuffer(command->Buffer, command->Format);
+    }
+    case StreamCommand::SetGraphicsResourceSet:
+    {
+        const SetGraphicsResourceSetCommand* command = static_cast<const SetGraphicsResourceSetCommand*>(payload);
+        return SetGraphicsResourceSet(command->Slot, command->Set);
+    }
+    case StreamCommand::Draw:
+    {
+        const DrawCommand* command = static_cast<const DrawCommand*>(payload);
+        return Draw(command->VertexCount, command->InstanceCount, command->VertexStart, command->InstanceStart);
+    }
+    case StreamCommand::DrawIndexed:
+    {
+        const DrawIndexedCommand* command = static_cast<const DrawIndexedCommand*>(payload);
+        return DrawIndexed(command->IndexCount, command->InstanceCount, command->IndexStart, command->VertexOffset, command->InstanceStart);
+    }
+    default:
+        VdFail("Unknown stream command.");
+        return VdResult::InvalidOperation;
+    }
+}
+
+VdResult CommandList::BeginSecondary(CommandList* parent)
+{
+    if (!_isSecondary || _commandBufferBegun || !parent->_recordingSecondaries)
+    {
+        return VdResult::InvalidOperation;
+    }
+    if (_commandBufferEnded)
+    {
+        _commandBufferEnded = false;
+        _cb = GetNextCommandBuffer();
+    }
+
+    FramebufferBase* fb = parent->_currentFramebuffer;
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = parent->_activeRenderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = fb->GetCurrentFramebuffer();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    CheckResult(vkBeginCommandBuffer(_cb, &beginInfo));
+    _commandBufferBegun = true;
+    _inheritedRenderPass = inheritanceInfo.renderPass;
+    _inheritedFramebuffer = inheritanceInfo.framebuffer;
+
+    _currentFramebuffer = fb;
+    _currentFramebufferEverActive = true;
+    _newFramebuffer = false;
+    _activeRenderPass = parent->_activeRenderPass;
+    ResetRecordingState();
+
+    uint32_t colorCount = fb->GetColorAttachmentCount();
+    EnsureMinimumSize(_clearValues, colorCount + 1);
+    _validColorClearValues.clear();
+    EnsureMinimumSize(_validColorClearValues, colorCount);
+
+    // Dynamic state isn't inherited from the primary command buffer.
+    VkViewport viewport = {};
+    viewport.width = static_cast<float>(fb->Width());
+    viewport.height = static_cast<float>(fb->Height());
+    viewport.maxDepth = 1.0f;
+    SetViewport(0, &viewport);
+    SetFullScissorRects();
+
+    return VdResult::Success;
+}
+
+VdResult CommandList::BeginSecondaryRecording()
+{
+    if (_isSecondary || _recordingToStream || !_commandBufferBegun || _currentFramebuffer == nullptr || _recordingSecondaries)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    EnsureNoRenderPass();
+    BeginCurrentRenderPass(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    _recordingSecondaries = true;
+
+    return VdResult::Success;
+}
+
+VdResult CommandList::ExecuteSecondaryCommandLists(uint32_t count, CommandList* const* secondaries)
+{
+    if (!_recordingSecondaries)
+    {
+        return VdResult::InvalidOperation;
+    }
+    VkFramebuffer framebuffer = _currentFramebuffer->GetCurrentFramebuffer();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        CommandList* secondary = secondaries[i];
+        if (!secondary->_isSecondary || !secondary->_commandBufferEnded
+            || secondary->_inheritedRenderPass != _activeRenderPass
+            || secondary->_inheritedFramebuffer != framebuffer)
+        {
+            return VdResult::InvalidOperation;
+        }
+    }
+
+    std::vector<VkCommandBuffer> commandBuffers(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        CommandList* secondary = secondaries[i];
+        commandBuffers[i] = secondary->_cb;
+        _usedBufferVersions.insert(
+            _usedBufferVersions.end(),
+            secondary->_usedBufferVersions.begin(),
+            secondary->_usedBufferVersions.end());
+        // The parent's submission now ends their pending uses.
+        secondary->_usedBufferVersions.clear();
+        _executedSecondaries.push_back(std::make_pair(secondary, secondary->_cb));
+        secondary->CommandBufferSubmitted();
+    }
+    if (count > 0)
+    {
+        vkCmdExecuteCommands(_cb, count, commandBuffers.data());
+    }
+
+    // A subpass begun for secondary command buffers can't record anything else, so later commands on this
+    // CommandList start a new render pass.
+    EndCurrentRenderPass();
+    _recordingSecondaries = false;
 
+    // Executing secondary command buffers leaves the bound state undefined.
     _currentComputePipeline = nullptr;
-    _currentComputeResourceSets.clear();
+    InvalidateBoundState();
 
     return VdResult::Success;
 }
 
-void CommandList::ClearCachedState()
+void CommandList::ResetRecordingState()
 {
+    _currentGraphicsPipeline = nullptr;
+    _currentGraphicsResourceSets.fill(nullptr);
+    _graphicsResourceSetsChanged.fill(false);
+    _graphicsResourceSetCount = 0;
+    _newGraphicsResourceSets = 0;
+    _currentComputePipeline = nullptr;
+    _currentComputeResourceSets.fill(nullptr);
+    _computeResourceSetsChanged.fill(false);
+
+    ReleaseBufferVersions();
+    _currentVertexBuffers.fill(nullptr);
+    _vertexBufferCount = 0;
+    _currentIndexBuffer = nullptr;
+    _bufferDiscardCount = _gd->GetBufferDiscardCount();
+
+    _viewportMask = 0;
+    _scissorRectMask = 0;
+    _fullScissorRectsSet = false;
+
+    _statistics = {};
+    _allocationCountAtBegin = GetThreadAllocationCount();
+    InvalidateBoundState();
+}
+
+// Forgets what the command buffer has bound, so that the next draw binds everything currently set.
+void CommandList::InvalidateBoundState()
+{
+    _boundGraphicsPipeline = nullptr;
+    _graphicsPipelineDirty = _currentGraphicsPipeline != nullptr;
+    _boundGraphicsDescriptorSets.fill(VK_NULL_HANDLE);
+    MarkGraphicsResourceSetsChanged(0);
+
+    _boundVertexBuffers.fill(VK_NULL_HANDLE);
+    _dirtyVertexBufferMask = 0;
+    for (uint32_t i = 0; i < _vertexBufferCount; i++)
+    {
+        if (_currentVertexBuffers[i] != nullptr)
+        {
+            _dirtyVertexBufferMask |= 1u << i;
+        }
+    }
+    _boundIndexBuffer = VK_NULL_HANDLE;
+    _indexBufferDirty = _currentIndexBuffer != nullptr;
+
+    _boundViewportMask = 0;
+    _dirtyViewportMask = _viewportMask;
+    _boundScissorRectMask = 0;
+    _dirtyScissorRectMask = _scissorRectMask;
 }
 
 VdResult CommandList::End()
@@ -88,27 +500,60 @@ VdResult CommandList::End()
     {
         return VdResult::InvalidOperation;
     }
+    if (_recordingToStream)
+    {
+        _recordingToStream = false;
+        _commandBufferBegun = false;
+        _streamComplete = true;
+        return TranslateStream();
+    }
 
+    EndCommandBuffer();
+    return VdResult::Success;
+}
+
+void CommandList::EndCommandBuffer()
+{
     _commandBufferBegun = false;
     _commandBufferEnded = true;
 
-    if (!_currentFramebufferEverActive && _currentFramebuffer != nullptr)
+    if (_isSecondary)
     {
-        BeginCurrentRenderPass();
+        // The render pass belongs to the parent CommandList.
+        _activeRenderPass = VK_NULL_HANDLE;
+        _currentFramebuffer = nullptr;
     }
-    if (_activeRenderPass != VK_NULL_HANDLE)
+    else
     {
-        EndCurrentRenderPass();
-        _currentFramebuffer->TransitionToFinalLayout(_cb);
+        if (!_currentFramebufferEverActive && _currentFramebuffer != nullptr)
+        {
+            BeginCurrentRenderPass();
+        }
+        if (_activeRenderPass != VK_NULL_HANDLE)
+        {
+            EndCurrentRenderPass();
+            _currentFramebuffer->TransitionToFinalLayout(_cb);
+        }
     }
 
     CheckResult(vkEndCommandBuffer(_cb));
+    _statistics.HeapAllocations = static_cast<uint32_t>(GetThreadAllocationCount() - _allocationCountAtBegin);
+    _commandBuffersMutex.lock();
     _submittedCommandBuffers.push_back(_cb);
-
-    return VdResult::Success;
+    if (_usedStagingBuffers.size() > 0)
+    {
+        _submittedStagingBuffers[_cb] = _usedStagingBuffers;
+        _usedStagingBuffers.clear();
+    }
+    if (_executedSecondaries.size() > 0)
+    {
+        _submittedSecondaries[_cb] = _executedSecondaries;
+        _executedSecondaries.clear();
+    }
+    _commandBuffersMutex.unlock();
 }
 
-void CommandList::BeginCurrentRenderPass()
+void CommandList::BeginCurrentRenderPass(VkSubpassContents contents)
 {
     VdAssert(_activeRenderPass == VK_NULL_HANDLE);
     VdAssert(_currentFramebuffer != nullptr);
@@ -140,10 +585,13 @@ void CommandList::BeginCurrentRenderPass()
 
     if (!haveAnyAttachments || !haveAllClearValues)
     {
+        // Queued clears are recorded inline, which a subpass with secondary contents can't hold; they get
+        // a pass of their own.
+        bool clearInSeparatePass = haveAnyClearValues && contents != VK_SUBPASS_CONTENTS_INLINE;
         renderPassBI.renderPass = _newFramebuffer
             ? _currentFramebuffer->GetRenderPassNoClear_Init()
             : _currentFramebuffer->GetRenderPassNoClear_Load();
-        vkCmdBeginRenderPass(_cb, &renderPassBI, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(_cb, &renderPassBI, clearInSeparatePass ? VK_SUBPASS_CONTENTS_INLINE : contents);
         _activeRenderPass = renderPassBI.renderPass;
 
         if (haveAnyClearValues)
@@ -169,6 +617,14 @@ void CommandList::BeginCurrentRenderPass()
                 }
             }
         }
+
+        if (clearInSeparatePass)
+        {
+            EndCurrentRenderPass();
+            renderPassBI.renderPass = _currentFramebuffer->GetRenderPassNoClear_Load();
+            vkCmdBeginRenderPass(_cb, &renderPassBI, contents);
+            _activeRenderPass = renderPassBI.renderPass;
+        }
     }
     else
     {
@@ -181,7 +637,7 @@ void CommandList::BeginCurrentRenderPass()
             _clearValues[_currentFramebuffer->GetColorAttachmentCount()] = _depthClearValue.value();
             _depthClearValue.reset();
         }
-        vkCmdBeginRenderPass(_cb, &renderPassBI, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(_cb, &renderPassBI, contents);
         _activeRenderPass = _currentFramebuffer->GetRenderPassClear();
         ClearVector(_validColorClearValues);
     }
@@ -226,29 +682,231 @@ void CommandList::EnsureNoRenderPass()
     }
 }
 
-void CommandList::PreDrawCommand()
+// Records the state set since the last draw, leaving out whatever the command buffer already has bound.
+void CommandList::PreDrawCommand(bool indexed)
 {
     EnsureRenderPassActive();
+    RebindDiscardedBuffers();
 
+    if (_graphicsPipelineDirty)
+    {
+        FlushGraphicsPipeline();
+    }
     FlushNewResourceSets(
         _newGraphicsResourceSets,
-        _currentGraphicsResourceSets,
-        _graphicsResourceSetsChanged,
+        _currentGraphicsResourceSets.data(),
+        _graphicsResourceSetsChanged.data(),
+        _boundGraphicsDescriptorSets.data(),
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         _currentGraphicsPipeline->PipelineLayout());
     _newGraphicsResourceSets = 0;
 
-    if (!_currentGraphicsPipeline->ScissorTestEnabled)
+    if (_dirtyVertexBufferMask != 0)
+    {
+        FlushVertexBuffers();
+    }
+    if (indexed && _indexBufferDirty)
+    {
+        FlushIndexBuffer();
+    }
+
+    if (!_currentGraphicsPipeline->ScissorTestEnabled && !_fullScissorRectsSet)
     {
         SetFullScissorRects();
     }
+    if (_dirtyViewportMask != 0)
+    {
+        _statistics.ViewportSets += FlushDynamicState(
+            _viewports.data(),
+            _boundViewports.data(),
+            _dirtyViewportMask,
+            _boundViewportMask,
+            _statistics.RedundantStateSkipped,
+            [this](uint32_t first, uint32_t count) { vkCmdSetViewport(_cb, first, count, &_boundViewports[first]); });
+    }
+    if (_dirtyScissorRectMask != 0)
+    {
+        _statistics.ScissorSets += FlushDynamicState(
+            _scissorRects.data(),
+            _boundScissorRects.data(),
+            _dirtyScissorRectMask,
+            _boundScissorRectMask,
+            _statistics.RedundantStateSkipped,
+            [this](uint32_t first, uint32_t count) { vkCmdSetScissor(_cb, first, count, &_boundScissorRects[first]); });
+    }
+}
+
+void CommandList::FlushGraphicsPipeline()
+{
+    _graphicsPipelineDirty = false;
+    if (_boundGraphicsPipeline == _currentGraphicsPipeline)
+    {
+        _statistics.RedundantStateSkipped += 1;
+        return;
+    }
+
+    // Descriptor sets bound for the previous pipeline stay valid for the sets its layout shares with the new
+    // one. Anything set beyond those is bound again, even if it was kept by SetPipeline.
+    uint32_t keptSets = _boundGraphicsPipeline != nullptr
+        ? _currentGraphicsPipeline->GetCompatibleSetCount(*_boundGraphicsPipeline)
+        : 0;
+    for (uint32_t slot = keptSets; slot < _boundGraphicsDescriptorSets.size(); slot++)
+    {
+        _boundGraphicsDescriptorSets[slot] = VK_NULL_HANDLE;
+    }
+    MarkGraphicsResourceSetsChanged(keptSets);
+
+    vkCmdBindPipeline(_cb, VK_PIPELINE_BIND_POINT_GRAPHICS, _currentGraphicsPipeline->DevicePipeline);
+    _statistics.PipelineBinds += 1;
+    _boundGraphicsPipeline = _currentGraphicsPipeline;
+}
+
+void CommandList::MarkGraphicsResourceSetsChanged(uint32_t firstSlot)
+{
+    for (uint32_t slot = firstSlot; slot < _graphicsResourceSetCount; slot++)
+    {
+        if (_currentGraphicsResourceSets[slot] != nullptr && !_graphicsResourceSetsChanged[slot])
+        {
+            _graphicsResourceSetsChanged[slot] = true;
+            _newGraphicsResourceSets += 1;
+        }
+    }
+}
+
+void CommandList::FlushVertexBuffers()
+{
+    static const VkDeviceSize ZeroOffsets[MaxVertexBuffers] = {};
+
+    // Bindings that changed are bound in runs of consecutive slots, one vkCmdBindVertexBuffers per run.
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    while (_dirtyVertexBufferMask != 0)
+    {
+        uint32_t index = FindFirstSetBit(_dirtyVertexBufferMask);
+        _dirtyVertexBufferMask &= _dirtyVertexBufferMask - 1;
+
+        DeviceBuffer* buffer = _currentVertexBuffers[index];
+        if (buffer->GetVkBuffer() == _boundVertexBuffers[index])
+        {
+            _statistics.RedundantStateSkipped += 1;
+            continue;
+        }
+        _boundVertexBuffers[index] = buffer->GetVkBuffer();
+        UseBufferVersion(buffer);
+
+        if (runLength != 0 && runStart + runLength == index)
+        {
+            runLength += 1;
+            continue;
+        }
+        if (runLength != 0)
+        {
+            vkCmdBindVertexBuffers(_cb, runStart, runLength, &_boundVertexBuffers[runStart], ZeroOffsets);
+            _statistics.VertexBufferBinds += 1;
+        }
+        runStart = index;
+        runLength = 1;
+    }
+    if (runLength != 0)
+    {
+        vkCmdBindVertexBuffers(_cb, runStart, runLength, &_boundVertexBuffers[runStart], ZeroOffsets);
+        _statistics.VertexBufferBinds += 1;
+    }
+}
+
+void CommandList::FlushIndexBuffer()
+{
+    _indexBufferDirty = false;
+    VkBuffer vkBuffer = _currentIndexBuffer->GetVkBuffer();
+    VkIndexType indexType = VdToVkIndexFormat(_currentIndexFormat);
+    if (vkBuffer == _boundIndexBuffer && indexType == _boundIndexType)
+    {
+        _statistics.RedundantStateSkipped += 1;
+        return;
+    }
+
+    vkCmdBindIndexBuffer(_cb, vkBuffer, 0, indexType);
+    _statistics.IndexBufferBinds += 1;
+    _boundIndexBuffer = vkBuffer;
+    _boundIndexType = indexType;
+    UseBufferVersion(_currentIndexBuffer);
 }
 
 VdResult CommandList::UpdateBuffer(DeviceBuffer* buffer, uint32_t offset, void* source, uint32_t size)
 {
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    if (_recordingToStream)
+    {
+        void* data = _stream.Append(static_cast<uint32_t>(StreamCommand::Data), size);
+        memcpy(data, source, size);
+        UpdateBufferCommand* command = AppendCommand<UpdateBufferCommand>(StreamCommand::UpdateBuffer);
+        *command = { buffer, offset, size, data };
+        return VdResult::Success;
+    }
+
+    BufferUpdate update;
+    BeginUpdateBuffer(buffer, offset, size, &update);
+    StreamingCopy(update.Data, source, size);
+    return EndUpdateBuffer(&update);
+}
+
+VdResult CommandList::BeginUpdateBuffer(DeviceBuffer* buffer, uint32_t offset, uint32_t size, BufferUpdate* update)
+{
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    if (_recordingToStream)
+    {
+        // The contents are kept in the stream, and uploaded when it is translated.
+        update->Data = _stream.Append(static_cast<uint32_t>(StreamCommand::Data), size);
+        update->Buffer = buffer;
+        update->Offset = offset;
+        update->SizeInBytes = size;
+        update->Staging = {};
+        return VdResult::Success;
+    }
+
     DeviceBuffer* stagingBuffer = GetStagingBuffer(size);
-    _gd->UpdateBuffer(stagingBuffer, 0, source, size);
-    CopyBuffer(stagingBuffer, 0, buffer, offset, size);
+    update->Data = stagingBuffer->GetMemory().BlockMappedPointer();
+    update->Buffer = buffer;
+    update->Offset = offset;
+    update->SizeInBytes = size;
+    update->Staging = {};
+    update->Staging.Buffer = stagingBuffer->GetVkBuffer();
+    update->Staging.MappedPointer = static_cast<uint8_t*>(update->Data);
+    return VdResult::Success;
+}
+
+VdResult CommandList::EndUpdateBuffer(BufferUpdate* update)
+{
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+    if (_recordingToStream)
+    {
+        UpdateBufferCommand* command = AppendCommand<UpdateBufferCommand>(StreamCommand::UpdateBuffer);
+        *command = { update->Buffer, update->Offset, update->SizeInBytes, update->Data };
+        return VdResult::Success;
+    }
+
+    EnsureNoRenderPass();
+
+    VkBufferCopy region;
+    region.srcOffset = update->Staging.Offset;
+    region.dstOffset = update->Offset;
+    region.size = update->SizeInBytes;
+
+    vkCmdCopyBuffer(_cb, update->Staging.Buffer, update->Buffer->GetVkBuffer(), 1, &region);
+    update->Buffer->SetOwnedByGraphicsQueue();
+    UseBufferVersion(update->Buffer);
+
     return VdResult::Success;
 }
 
@@ -259,6 +917,18 @@ VdResult CommandList::CopyBuffer(
     uint32_t destinationOffset,
     uint32_t size)
 {
+    if (_recordingToStream)
+    {
+        CopyBufferCommand* command = AppendCommand<CopyBufferCommand>(StreamCommand::CopyBuffer);
+        *command = { source, sourceOffset, destination, destinationOffset, size };
+        return VdResult::Success;
+    }
+
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
     EnsureNoRenderPass();
 
     VkBufferCopy region;
@@ -267,6 +937,9 @@ VdResult CommandList::CopyBuffer(
     region.size = size;
 
     vkCmdCopyBuffer(_cb, source->GetVkBuffer(), destination->GetVkBuffer(), 1, &region);
+    destination->SetOwnedByGraphicsQueue();
+    UseBufferVersion(source);
+    UseBufferVersion(destination);
 
     return VdResult::Success;
 }
@@ -281,6 +954,21 @@ VdResult CommandList::CopyTexture(
     uint32_t width, uint32_t height, uint32_t depth,
     uint32_t layerCount)
 {
+    if (_recordingToStream)
+    {
+        CopyTextureCommand* command = AppendCommand<CopyTextureCommand>(StreamCommand::CopyTexture);
+        *command = {
+            source, srcX, srcY, srcZ, srcMipLevel, srcBaseArrayLayer,
+            destination, dstX, dstY, dstZ, dstMipLevel, dstBaseArrayLayer,
+            width, height, depth, layerCount };
+        return VdResult::Success;
+    }
+
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
     EnsureNoRenderPass();
     CopyTextureCore_CommandBuffer(
         _cb,
@@ -296,8 +984,86 @@ VdResult CommandList::CopyTexture(
     return VdResult::Success;
 }
 
+VdResult CommandList::CopyBufferToTexture(
+    DeviceBuffer* source,
+    uint32_t sourceOffset,
+    Texture* destination,
+    uint32_t mipLevel,
+    uint32_t arrayLayer)
+{
+    if (_recordingToStream)
+    {
+        CopyBufferToTextureCommand* command = AppendCommand<CopyBufferToTextureCommand>(StreamCommand::CopyBufferToTexture);
+        *command = { source, sourceOffset, destination, mipLevel, arrayLayer };
+        return VdResult::Success;
+    }
+
+    uint32_t layerCount = HasFlag(destination->GetUsage(), TextureUsage::Cubemap)
+        ? destination->GetArrayLayers() * 6
+        : destination->GetArrayLayers();
+    if (_isSecondary || HasFlag(destination->GetUsage(), TextureUsage::Staging)
+        || mipLevel >= destination->GetMipLevels() || arrayLayer >= layerCount)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    // Vulkan requires the buffer offset to be a multiple of 4 and of the texel (or compressed block) size.
+    uint32_t texelSize = IsCompressedFormat(destination->GetFormat())
+        ? GetBlockSizeInBytes(destination->GetFormat())
+        : GetSizeInBytes(destination->GetFormat());
+    if (sourceOffset % 4 != 0 || sourceOffset % texelSize != 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t mipWidth, mipHeight, mipDepth;
+    GetMipDimensions(destination, mipLevel, &mipWidth, &mipHeight, &mipDepth);
+    uint32_t rowPitch = GetRowPitch(mipWidth, destination->GetFormat());
+    uint32_t depthPitch = GetDepthPitch(rowPitch, mipHeight, destination->GetFormat());
+    if (uint64_t(sourceOffset) + uint64_t(depthPitch) * mipDepth > source->GetSizeInBytes())
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    EnsureNoRenderPass();
+    destination->TransitionImageLayout(_cb, mipLevel, 1, arrayLayer, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = sourceOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = arrayLayer;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = mipWidth;
+    region.imageExtent.height = mipHeight;
+    region.imageExtent.depth = mipDepth;
+    vkCmdCopyBufferToImage(
+        _cb,
+        source->GetVkBuffer(),
+        destination->GetOptimalImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &region);
+    destination->SetOwnedByGraphicsQueue();
+    UseBufferVersion(source);
+
+    return VdResult::Success;
+}
+
 VdResult CommandList::SetFramebuffer(Framebuffer* fb)
 {
+    if (_recordingToStream)
+    {
+        SetFramebufferCommand* command = AppendCommand<SetFramebufferCommand>(StreamCommand::SetFramebuffer);
+        *command = { fb };
+        return VdResult::Success;
+    }
+
+    if (_isSecondary)
+    {
+        return VdResult::InvalidOperation;
+    }
+
     _newFramebuffer = true;
     if (_activeRenderPass != VK_NULL_HANDLE)
     {
@@ -317,7 +1083,7 @@ VdResult CommandList::SetFramebuffer(Framebuffer* fb)
 
     _currentFramebuffer = fb;
     _currentFramebufferEverActive = false;
-    EnsureMinimumSize(_scissorRects, std::max(1u, fb->GetColorAttachmentCount()));
+    _fullScissorRectsSet = false;
     uint32_t clearValueCount = fb->GetColorAttachmentCount();
     EnsureMinimumSize(_clearValues, clearValueCount + 1); // Leave an extra space for the depth value (tracked separately).
     _validColorClearValues.clear();
@@ -328,29 +1094,62 @@ VdResult CommandList::SetFramebuffer(Framebuffer* fb)
 
 VdResult CommandList::SetViewport(uint32_t index, VkViewport* viewport)
 {
-    vkCmdSetViewport(_cb, index, 1, viewport);
+    if (_recordingToStream)
+    {
+        SetViewportCommand* command = AppendCommand<SetViewportCommand>(StreamCommand::SetViewport);
+        *command = { index, *viewport };
+        return VdResult::Success;
+    }
+
+    if (index >= _viewportLimit)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    _viewports[index] = *viewport;
+    _viewportMask |= 1u << index;
+    _dirtyViewportMask |= 1u << index;
+
     return VdResult::Success;
 }
 
 VdResult CommandList::SetScissorRect(uint32_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
 {
+    if (_recordingToStream)
+    {
+        SetScissorRectCommand* command = AppendCommand<SetScissorRectCommand>(StreamCommand::SetScissorRect);
+        *command = { index, x, y, width, height };
+        return VdResult::Success;
+    }
+
+    if (index >= _viewportLimit)
+    {
+        return VdResult::InvalidOperation;
+    }
+
     VkRect2D scissor;
     scissor.offset.x = (int32_t)x;
     scissor.offset.y = (int32_t)y;
     scissor.extent.width = width;
     scissor.extent.height = height;
 
-    if (!BlittableEqual(_scissorRects[index], scissor))
-    {
-        _scissorRects[index] = scissor;
-        vkCmdSetScissor(_cb, index, 1, &scissor);
-    }
+    _scissorRects[index] = scissor;
+    _scissorRectMask |= 1u << index;
+    _dirtyScissorRectMask |= 1u << index;
+    _fullScissorRectsSet = false;
 
     return VdResult::Success;
 }
 
 VdResult CommandList::ClearColorTarget(uint32_t index, RgbaFloat clearColor)
 {
+    if (_recordingToStream)
+    {
+        ClearColorTargetCommand* command = AppendCommand<ClearColorTargetCommand>(StreamCommand::ClearColorTarget);
+        *command = { index, clearColor };
+        return VdResult::Success;
+    }
+
     VkClearValue clearValue;
     clearValue.color.float32[0] = clearColor.R;
     clearValue.color.float32[1] = clearColor.G;
@@ -386,6 +1185,13 @@ VdResult CommandList::ClearColorTarget(uint32_t index, RgbaFloat clearColor)
 
 VdResult CommandList::ClearDepthStencil(float depth, uint8_t stencil)
 {
+    if (_recordingToStream)
+    {
+        ClearDepthStencilCommand* command = AppendCommand<ClearDepthStencilCommand>(StreamCommand::ClearDepthStencil);
+        *command = { depth, stencil };
+        return VdResult::Success;
+    }
+
     VkClearValue clearValue;
     clearValue.depthStencil.depth = depth;
     clearValue.depthStencil.stencil = stencil;
@@ -422,19 +1228,44 @@ VdResult CommandList::ClearDepthStencil(float depth, uint8_t stencil)
 
 VdResult CommandList::SetPipeline(Pipeline* pipeline)
 {
-    if (!pipeline->IsComputePipeline && _currentGraphicsPipeline != pipeline)
+    if (_recordingToStream)
     {
-        EnsureMinimumSize(_currentGraphicsResourceSets, pipeline->ResourceSetCount);
-        ClearVector(_currentGraphicsResourceSets);
-        EnsureMinimumSize(_graphicsResourceSetsChanged, pipeline->ResourceSetCount);
-        vkCmdBindPipeline(_cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->DevicePipeline);
-        _currentGraphicsPipeline = pipeline;
+        SetPipelineCommand* command = AppendCommand<SetPipelineCommand>(StreamCommand::SetPipeline);
+        *command = { pipeline };
+        return VdResult::Success;
+    }
+
+    if (pipeline->ResourceSetCount > _resourceSetLimit)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    if (!pipeline->IsComputePipeline)
+    {
+        // Bound at the next draw.
+        _graphicsPipelineDirty = true;
+        if (_currentGraphicsPipeline != pipeline)
+        {
+            // Resource sets stay set for the sets the two layouts share; the rest must be set again.
+            uint32_t keptSets = _currentGraphicsPipeline != nullptr
+                ? pipeline->GetCompatibleSetCount(*_currentGraphicsPipeline)
+                : 0;
+            for (uint32_t slot = keptSets; slot < _graphicsResourceSetCount; slot++)
+            {
+                _currentGraphicsResourceSets[slot] = nullptr;
+                if (_graphicsResourceSetsChanged[slot])
+                {
+                    _graphicsResourceSetsChanged[slot] = false;
+                    _newGraphicsResourceSets -= 1;
+                }
+            }
+            _graphicsResourceSetCount = pipeline->ResourceSetCount;
+            _currentGraphicsPipeline = pipeline;
+        }
     }
     else if (pipeline->IsComputePipeline && _currentComputePipeline != pipeline)
     {
-        EnsureMinimumSize(_currentComputeResourceSets, pipeline->ResourceSetCount);
-        ClearVector(_currentComputeResourceSets);
-        EnsureMinimumSize(_computeResourceSetsChanged, pipeline->ResourceSetCount);
+        _currentComputeResourceSets.fill(nullptr);
         vkCmdBindPipeline(_cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->DevicePipeline);
         _currentComputePipeline = pipeline;
     }
@@ -444,22 +1275,118 @@ VdResult CommandList::SetPipeline(Pipeline* pipeline)
 
 VdResult CommandList::SetVertexBuffer(uint32_t index, DeviceBuffer* buffer)
 {
-    VkDeviceSize offset = 0;
-    VkBuffer vkBuffer = buffer->GetVkBuffer();
-    vkCmdBindVertexBuffers(_cb, index, 1, &vkBuffer, &offset);
+    if (_recordingToStream)
+    {
+        SetVertexBufferCommand* command = AppendCommand<SetVertexBufferCommand>(StreamCommand::SetVertexBuffer);
+        *command = { index, buffer };
+        return VdResult::Success;
+    }
+
+    if (index >= _vertexBufferLimit)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    _currentVertexBuffers[index] = buffer;
+    _vertexBufferCount = std::max(_vertexBufferCount, index + 1);
+    _dirtyVertexBufferMask |= 1u << index;
 
     return VdResult::Success;
 }
 
 VdResult CommandList::SetIndexBuffer(DeviceBuffer* buffer, IndexFormat format)
 {
-    vkCmdBindIndexBuffer(_cb, buffer->GetVkBuffer(), 0, VdToVkIndexFormat(format));
+    if (_recordingToStream)
+    {
+        SetIndexBufferCommand* command = AppendCommand<SetIndexBufferCommand>(StreamCommand::SetIndexBuffer);
+        *command = { buffer, format };
+        return VdResult::Success;
+    }
+
+    _currentIndexBuffer = buffer;
+    _currentIndexFormat = format;
+    _indexBufferDirty = true;
 
     return VdResult::Success;
 }
 
+void CommandList::UseBufferVersion(DeviceBuffer* buffer)
+{
+    if (buffer->IsUseTracked())
+    {
+        uint32_t version = buffer->GetVersion();
+        buffer->MarkVersionPending(version);
+        _usedBufferVersions.push_back(std::make_pair(buffer, version));
+    }
+}
+
+void CommandList::MarkBufferVersionsUsed(uint64_t serial)
+{
+    for (auto& bufferVersion : _usedBufferVersions)
+    {
+        bufferVersion.first->MarkVersionUsed(bufferVersion.second, serial);
+    }
+    _usedBufferVersions.clear();
+}
+
+// For recordings that won't be submitted, so that Discard no longer counts their versions as in use.
+void CommandList::ReleaseBufferVersions()
+{
+    for (auto& bufferVersion : _usedBufferVersions)
+    {
+        bufferVersion.first->ReleaseVersion(bufferVersion.second);
+    }
+    _usedBufferVersions.clear();
+}
+
+// A Dynamic buffer that moved to a new version since it was bound is bound again at the next draw, so that
+// each draw reads the contents current when it was recorded.
+void CommandList::RebindDiscardedBuffers()
+{
+    uint64_t discardCount = _gd->GetBufferDiscardCount();
+    if (discardCount == _bufferDiscardCount)
+    {
+        return;
+    }
+    _bufferDiscardCount = discardCount;
+
+    for (uint32_t i = 0; i < _vertexBufferCount; i++)
+    {
+        DeviceBuffer* buffer = _currentVertexBuffers[i];
+        if (buffer != nullptr && buffer->GetVkBuffer() != _boundVertexBuffers[i])
+        {
+            _dirtyVertexBufferMask |= 1u << i;
+        }
+    }
+    if (_currentIndexBuffer != nullptr && _currentIndexBuffer->GetVkBuffer() != _boundIndexBuffer)
+    {
+        _indexBufferDirty = true;
+    }
+    for (uint32_t slot = 0; slot < _graphicsResourceSetCount; slot++)
+    {
+        ResourceSet* rs = _currentGraphicsResourceSets[slot];
+        if (rs != nullptr && rs->HasDynamicBuffers() && !_graphicsResourceSetsChanged[slot])
+        {
+            _graphicsResourceSetsChanged[slot] = true;
+            _newGraphicsResourceSets += 1;
+        }
+    }
+}
+
 VdResult CommandList::SetGraphicsResourceSet(uint32_t slot, ResourceSet* rs)
 {
+    if (_recordingToStream)
+    {
+        SetGraphicsResourceSetCommand* command = AppendCommand<SetGraphicsResourceSetCommand>(StreamCommand::SetGraphicsResourceSet);
+        *command = { slot, rs };
+        return VdResult::Success;
+    }
+
+    if (slot >= _graphicsResourceSetCount)
+    {
+        return VdResult::InvalidOperation;
+    }
+
     if (_currentGraphicsResourceSets[slot] != rs)
     {
         _currentGraphicsResourceSets[slot] = rs;
@@ -472,8 +1399,16 @@ VdResult CommandList::SetGraphicsResourceSet(uint32_t slot, ResourceSet* rs)
 
 VdResult CommandList::Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t vertexStart, uint32_t instanceStart)
 {
-    PreDrawCommand();
+    if (_recordingToStream)
+    {
+        DrawCommand* command = AppendCommand<DrawCommand>(StreamCommand::Draw);
+        *command = { vertexCount, instanceCount, vertexStart, instanceStart };
+        return VdResult::Success;
+    }
+
+    PreDrawCommand(false);
     vkCmdDraw(_cb, vertexCount, instanceCount, vertexStart, instanceStart);
+    _statistics.Draws += 1;
 
     return VdResult::Success;
 }
@@ -485,8 +1420,16 @@ VdResult CommandList::DrawIndexed(
     int32_t vertexOffset,
     uint32_t instanceStart)
 {
-    PreDrawCommand();
+    if (_recordingToStream)
+    {
+        DrawIndexedCommand* command = AppendCommand<DrawIndexedCommand>(StreamCommand::DrawIndexed);
+        *command = { indexCount, instanceCount, indexStart, vertexOffset, instanceStart };
+        return VdResult::Success;
+    }
+
+    PreDrawCommand(true);
     vkCmdDrawIndexed(_cb, indexCount, instanceCount, indexStart, vertexOffset, instanceStart);
+    _statistics.Draws += 1;
 
     return VdResult::Success;
 }
@@ -499,11 +1442,13 @@ void CommandList::SetFullScissorRects()
     {
         SetScissorRect(index, 0, 0, _currentFramebuffer->Width(), _currentFramebuffer->Height());
     }
+    _fullScissorRectsSet = true;
 }
 
 void CommandList::CommandBufferCompleted(VkCommandBuffer completedCB)
 {
     _submittedCommandBufferCount -= 1;
+    std::vector<std::pair<CommandList*, VkCommandBuffer>> completedSecondaries;
 
     _commandBuffersMutex.lock();
     for (uint32_t i = 0; i < _submittedCommandBuffers.size(); i++)
@@ -516,7 +1461,36 @@ void CommandList::CommandBufferCompleted(VkCommandBuffer completedCB)
             i -= 1;
         }
     }
+
+    auto stagingI = _submittedStagingBuffers.find(completedCB);
+    if (stagingI != _submittedStagingBuffers.end())
+    {
+        for (DeviceBuffer* stagingBuffer : stagingI->second)
+        {
+            _availableStagingBuffers.push_back(stagingBuffer);
+        }
+        _submittedStagingBuffers.erase(stagingI);
+    }
+
+    auto secondariesI = _submittedSecondaries.find(completedCB);
+    if (secondariesI != _submittedSecondaries.end())
+    {
+        completedSecondaries = secondariesI->second;
+        _submittedSecondaries.erase(secondariesI);
+    }
     _commandBuffersMutex.unlock();
+
+    // Secondary command buffers complete with the primary that executed them.
+    ReleaseSecondaries(completedSecondaries);
+}
+
+void CommandList::ReleaseSecondaries(const std::vector<std::pair<CommandList*, VkCommandBuffer>>& secondaries)
+{
+    for (auto& secondary : secondaries)
+    {
+        secondary.first->CommandBufferCompleted(secondary.second);
+        _gd->DestroyIfDisposed(secondary.first);
+    }
 }
 
 void CommandList::CopyTextureCore_CommandBuffer(
@@ -741,6 +1715,8 @@ void CommandList::CopyTextureCore_CommandBuffer(
 }
 DeviceBuffer* CommandList::GetStagingBuffer(uint32_t size)
 {
+    // Staging buffers come back from CommandBufferCompleted, on the thread that checks fences.
+    _commandBuffersMutex.lock();
     for (uint32_t i = 0; i < _availableStagingBuffers.size(); i++)
     {
         DeviceBuffer* buffer = _availableStagingBuffers[i];
@@ -748,9 +1724,11 @@ DeviceBuffer* CommandList::GetStagingBuffer(uint32_t size)
         {
             _availableStagingBuffers.erase(_availableStagingBuffers.begin() + i);
             _usedStagingBuffers.push_back(buffer);
+            _commandBuffersMutex.unlock();
             return buffer;
         }
     }
+    _commandBuffersMutex.unlock();
 
     DeviceBuffer* newBuffer = _gd->GetResourceFactory()->CreateBuffer(BufferDescription(size, BufferUsage::Staging));
     _usedStagingBuffers.push_back(newBuffer);
@@ -759,8 +1737,9 @@ DeviceBuffer* CommandList::GetStagingBuffer(uint32_t size)
 
 void CommandList::FlushNewResourceSets(
     uint32_t newResourceSetsCount,
-    std::vector<ResourceSet*>& resourceSets,
-    std::vector<bool>& resourceSetsChanged,
+    ResourceSet* const* resourceSets,
+    bool* resourceSetsChanged,
+    VkDescriptorSet* boundDescriptorSets,
     VkPipelineBindPoint bindPoint,
     VkPipelineLayout pipelineLayout)
 {
@@ -770,14 +1749,27 @@ void CommandList::FlushNewResourceSets(
         uint32_t currentSlot = 0;
         uint32_t currentBatchIndex = 0;
         uint32_t currentBatchFirstSet = 0;
-        std::vector<VkDescriptorSet> descriptorSets(newResourceSetsCount);
+        std::array<VkDescriptorSet, MaxResourceSets> descriptorSets;
         while (totalChanged < newResourceSetsCount)
         {
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
             if (resourceSetsChanged[currentSlot])
             {
                 resourceSetsChanged[currentSlot] = false;
-                descriptorSets[currentBatchIndex] = resourceSets[currentSlot]->DescriptorSet();
                 totalChanged += 1;
+                descriptorSet = resourceSets[currentSlot]->GetDescriptorSet(&_usedBufferVersions);
+                if (descriptorSet == boundDescriptorSets[currentSlot])
+                {
+                    // Already bound with a compatible layout.
+                    descriptorSet = VK_NULL_HANDLE;
+                    _statistics.RedundantStateSkipped += 1;
+                }
+            }
+
+            if (descriptorSet != VK_NULL_HANDLE)
+            {
+                boundDescriptorSets[currentSlot] = descriptorSet;
+                descriptorSets[currentBatchIndex] = descriptorSet;
                 currentBatchIndex += 1;
                 currentSlot += 1;
             }
@@ -795,6 +1787,7 @@ void CommandList::FlushNewResourceSets(
                         descriptorSets.data(),
                         0,
                         nullptr);
+                    _statistics.DescriptorSetBinds += 1;
                     currentBatchIndex = 0;
                 }
 
@@ -815,19 +1808,30 @@ void CommandList::FlushNewResourceSets(
                 descriptorSets.data(),
                 0,
                 nullptr);
+            _statistics.DescriptorSetBinds += 1;
         }
     }
 }
 
 VdResult CommandList::Dispose()
 {
+    ReleaseBufferVersions();
     _gd->EnqueueDisposedCommandBuffer(this);
     return VdResult::Success;
 }
 
 VD_EXPORT VdResult VdCommandList_Begin(CommandList* cl) { return cl->Begin(); }
 VD_EXPORT VdResult VdCommandList_End(CommandList* cl) { return cl->End(); }
+VD_EXPORT VdResult VdCommandList_BeginSecondary(CommandList* cl, CommandList* parent) { return cl->BeginSecondary(parent); }
+VD_EXPORT VdResult VdCommandList_BeginSecondaryRecording(CommandList* cl) { return cl->BeginSecondaryRecording(); }
+VD_EXPORT VdResult VdCommandList_ExecuteSecondaryCommandLists(CommandList* cl, uint32_t count, CommandList* const* secondaries)
+{
+    return cl->ExecuteSecondaryCommandLists(count, secondaries);
+}
 VD_EXPORT VdResult VdCommandList_Dispose(CommandList* cl) { return cl->Dispose(); }
+VD_EXPORT VdResult VdCommandList_SetDeferredRecording(CommandList* cl, bool enabled) { return cl->SetDeferredRecording(enabled); }
+VD_EXPORT VdResult VdCommandList_Replay(CommandList* cl) { return cl->Replay(); }
+VD_EXPORT void VdCommandList_GetStatistics(CommandList* cl, CommandListStatistics* statistics) { cl->GetStatistics(statistics); }
 VD_EXPORT VdResult VdCommandList_UpdateBuffer(
     CommandList* cl,
     DeviceBuffer* buffer,
@@ -838,6 +1842,21 @@ VD_EXPORT VdResult VdCommandList_UpdateBuffer(
     return cl->UpdateBuffer(buffer, offset, source, size);
 }
 
+VD_EXPORT VdResult VdCommandList_BeginUpdateBuffer(
+    CommandList* cl,
+    DeviceBuffer* buffer,
+    uint32_t offset,
+    uint32_t size,
+    BufferUpdate* update)
+{
+    return cl->BeginUpdateBuffer(buffer, offset, size, update);
+}
+
+VD_EXPORT VdResult VdCommandList_EndUpdateBuffer(CommandList* cl, BufferUpdate* update)
+{
+    return cl->EndUpdateBuffer(update);
+}
+
 VD_EXPORT VdResult VdCommandList_CopyBuffer(
     CommandList* cl,
     DeviceBuffer* source,
@@ -871,6 +1890,17 @@ VD_EXPORT VdResult VdCommandList_CopyTexture(
         layerCount);
 }
 
+VD_EXPORT VdResult VdCommandList_CopyBufferToTexture(
+    CommandList* cl,
+    DeviceBuffer* source,
+    uint32_t sourceOffset,
+    Texture* destination,
+    uint32_t mipLevel,
+    uint32_t arrayLayer)
+{
+    return cl->CopyBufferToTexture(source, sourceOffset, destination, mipLevel, arrayLayer);
+}
+
 VD_EXPORT VdResult VdCommandList_SetFramebuffer(
     CommandList* cl,
     Framebuffer* fb)
@@ -5,20 +5,46 @@
 #include "Framebuffer.hpp"
 #include "RgbaFloat.hpp"
 #include "ResourceSet.hpp"
+#include "CommandListStatistics.hpp"
+#include "CommandStream.hpp"
 #include <mutex>
 #include <deque>
+#include <array>
 #include <optional>
+#include <unordered_map>
 
 namespace Veldrid
 {
 class CommandList
 {
 public:
-    CommandList(GraphicsDevice* gd);
+    // Secondary CommandLists record draws for a render pass begun by another CommandList, so that several
+    // threads can record into the same pass. Each has its own command pool, so each thread needs its own.
+    CommandList(GraphicsDevice* gd, bool isSecondary = false);
     VdResult Begin();
     VdResult End();
+    // Parallel recording: the parent calls BeginSecondaryRecording, which begins a render pass on its current
+    // framebuffer. Secondary CommandLists then call BeginSecondary(parent), which inherits that framebuffer and
+    // pass and starts with a full viewport and scissor, record their draws on any thread, and End. The parent
+    // then calls ExecuteSecondaryCommandLists, which runs them in the given order and ends the pass. Secondary
+    // CommandLists can't copy, update buffers or change framebuffer, and are never submitted themselves.
+    VdResult BeginSecondary(CommandList* parent);
+    VdResult BeginSecondaryRecording();
+    VdResult ExecuteSecondaryCommandLists(uint32_t count, CommandList* const* secondaries);
+    bool IsSecondary() const { return _isSecondary; }
+    // Deferred recording: between Begin and End, calls only append their arguments to a compact in-memory
+    // stream, and End records the stream into a command buffer. Recording stays cheap on the calling thread,
+    // and End can be called from another one. The stream is kept after End, and Replay records it into a new
+    // command buffer, ready to submit again, without the calls being made again. Every object the calls
+    // refer to must outlive the stream. Calls are only validated when the stream is recorded, so End and
+    // Replay return the first failure. Can't be changed while recording, or used by secondary CommandLists.
+    VdResult SetDeferredRecording(bool enabled);
+    VdResult Replay();
     VdResult Dispose();
     VdResult UpdateBuffer(DeviceBuffer* buffer, uint32_t offset, void* source, uint32_t size);
+    // The caller writes the new contents into update->Data; EndUpdateBuffer records the copy.
+    VdResult BeginUpdateBuffer(DeviceBuffer* buffer, uint32_t offset, uint32_t size, BufferUpdate* update);
+    VdResult EndUpdateBuffer(BufferUpdate* update);
     VdResult CopyBuffer(DeviceBuffer* source, uint32_t sourceOffset, DeviceBuffer* destination, uint32_t destinationOffset, uint32_t size);
     VdResult CopyTexture(
         Texture* source,
@@ -31,13 +57,23 @@ public:
         uint32_t dstBaseArrayLayer,
         uint32_t width, uint32_t height, uint32_t depth,
         uint32_t layerCount);
+    // Copies one tightly packed subresource, laid out as in GraphicsDevice::TextureUploadRegion, from
+    // source into a non-staging texture. Suited to buffers from GraphicsDevice::ImportHostBuffer.
+    VdResult CopyBufferToTexture(DeviceBuffer* source, uint32_t sourceOffset, Texture* destination, uint32_t mipLevel, uint32_t arrayLayer);
     VdResult SetFramebuffer(Framebuffer* fb);
 
+    // State is recorded at the next draw, and only where it differs from what is already bound. Binding
+    // state is held in fixed-size arrays, so vertex buffer, viewport and scissor indices and resource set
+    // counts must be below both these and the device's limits.
+    static constexpr uint32_t MaxVertexBuffers = 32;
+    static constexpr uint32_t MaxViewports = 32;
+    static constexpr uint32_t MaxResourceSets = 32;
     VdResult SetViewport(uint32_t index, VkViewport* viewport);
     VdResult SetScissorRect(uint32_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
     VdResult ClearColorTarget(uint32_t index, RgbaFloat clearColor);
     VdResult ClearDepthStencil(float depth, uint8_t stencil);
 
+    // Graphics resource sets stay set for the leading sets the new pipeline shares ResourceLayouts with.
     VdResult SetPipeline(Pipeline* pipeline);
     VdResult SetVertexBuffer(uint32_t index, DeviceBuffer* buffer);
     VdResult SetIndexBuffer(DeviceBuffer* buffer, IndexFormat format);
@@ -54,6 +90,9 @@ public:
     void CommandBufferSubmitted() { _submittedCommandBufferCount += 1; }
     void CommandBufferCompleted(VkCommandBuffer cb);
     uint32_t GetSubmissionCount() const { return _submittedCommandBufferCount; }
+    void GetStatistics(CommandListStatistics* statistics) const { *statistics = _statistics; }
+    // Records the submission serial on every Dynamic buffer version the current command buffer uses.
+    void MarkBufferVersionsUsed(uint64_t serial);
 
     VkCommandBuffer GetVkCommandBuffer() { return _cb; }
 
@@ -71,7 +110,18 @@ public:
         uint32_t layerCount);
 
 private:
+    enum class StreamCommand : uint32_t;
+
     GraphicsDevice * _gd;
+    bool _isSecondary;
+
+    // Deferred recording state. _recordingToStream is set between Begin and End, and _streamComplete once
+    // the stream can be replayed.
+    bool _deferredRecording = false;
+    bool _recordingToStream = false;
+    bool _streamComplete = false;
+    CommandStream _stream;
+
     VkCommandPool _pool;
     VkCommandBuffer _cb;
     std::recursive_mutex _commandBuffersMutex;
@@ -86,36 +136,101 @@ private:
     bool _currentFramebufferEverActive;
     FramebufferBase* _currentFramebuffer;
     Pipeline* _currentGraphicsPipeline;
-    std::vector<ResourceSet*> _currentGraphicsResourceSets;
-    std::vector<bool> _graphicsResourceSetsChanged;
+    std::array<ResourceSet*, MaxResourceSets> _currentGraphicsResourceSets;
+    std::array<bool, MaxResourceSets> _graphicsResourceSetsChanged;
+    uint32_t _graphicsResourceSetCount;
     uint32_t _newGraphicsResourceSets;
 
-    std::vector<VkRect2D> _scissorRects;
+    // What the command buffer has bound, as opposed to the state set above. Dirty flags and masks mark
+    // the state set since the last draw; masks have a bit per index.
+    bool _graphicsPipelineDirty = false;
+    Pipeline* _boundGraphicsPipeline = nullptr;
+    std::array<VkDescriptorSet, MaxResourceSets> _boundGraphicsDescriptorSets;
+    uint32_t _dirtyVertexBufferMask = 0;
+    bool _indexBufferDirty = false;
+    VkIndexType _boundIndexType;
+    std::array<VkViewport, MaxViewports> _viewports;
+    std::array<VkViewport, MaxViewports> _boundViewports;
+    uint32_t _viewportMask = 0;
+    uint32_t _dirtyViewportMask = 0;
+    uint32_t _boundViewportMask = 0;
+    std::array<VkRect2D, MaxViewports> _boundScissorRects;
+    uint32_t _scissorRectMask = 0;
+    uint32_t _dirtyScissorRectMask = 0;
+    uint32_t _boundScissorRectMask = 0;
+    bool _fullScissorRectsSet = false;
+    CommandListStatistics _statistics = {};
+    uint64_t _allocationCountAtBegin = 0;
+
+    // Limits of the device, clamped to the capacities above.
+    uint32_t _vertexBufferLimit;
+    uint32_t _viewportLimit;
+    uint32_t _resourceSetLimit;
+
+    std::array<VkRect2D, MaxViewports> _scissorRects;
     std::vector<VkClearValue> _clearValues;
     std::optional<VkClearValue> _depthClearValue;
     std::vector<bool> _validColorClearValues;
 
     Pipeline* _currentComputePipeline;
-    std::vector<ResourceSet*> _currentComputeResourceSets;
-    std::vector<bool> _computeResourceSetsChanged;
+    std::array<ResourceSet*, MaxResourceSets> _currentComputeResourceSets;
+    std::array<bool, MaxResourceSets> _computeResourceSetsChanged;
 
     VkRenderPass _activeRenderPass;
 
+    // Whether the active render pass was begun for secondary command buffers, and the secondary command
+    // buffers executed by the current recording and by ended ones, released once the latter complete.
+    bool _recordingSecondaries = false;
+    std::vector<std::pair<CommandList*, VkCommandBuffer>> _executedSecondaries;
+    std::unordered_map<VkCommandBuffer, std::vector<std::pair<CommandList*, VkCommandBuffer>>> _submittedSecondaries;
+    // For a secondary CommandList, the render pass and framebuffer its recording was begun against.
+    VkRenderPass _inheritedRenderPass = VK_NULL_HANDLE;
+    VkFramebuffer _inheritedFramebuffer = VK_NULL_HANDLE;
+
+    // Versions of use-tracked buffers (see DeviceBuffer::IsUseTracked) used by the current recording, each
+    // held pending until it is submitted, and the buffers bound for draws, so that RebindDiscardedBuffers can tell which ones moved to a new version.
+    std::vector<std::pair<DeviceBuffer*, uint32_t>> _usedBufferVersions;
+    std::array<DeviceBuffer*, MaxVertexBuffers> _currentVertexBuffers;
+    std::array<VkBuffer, MaxVertexBuffers> _boundVertexBuffers;
+    uint32_t _vertexBufferCount = 0;
+    DeviceBuffer* _currentIndexBuffer = nullptr;
+    VkBuffer _boundIndexBuffer = VK_NULL_HANDLE;
+    IndexFormat _currentIndexFormat;
+    uint64_t _bufferDiscardCount = 0;
+
     std::vector<DeviceBuffer*> _availableStagingBuffers;
     std::vector<DeviceBuffer*> _usedStagingBuffers;
+    // Staging buffers read by an ended command buffer, returned to _availableStagingBuffers once it completes.
+    std::unordered_map<VkCommandBuffer, std::vector<DeviceBuffer*>> _submittedStagingBuffers;
 
     VkCommandBuffer GetNextCommandBuffer();
-    void ClearCachedState();
-    void BeginCurrentRenderPass();
+    void BeginCommandBuffer();
+    void EndCommandBuffer();
+    VdResult TranslateStream();
+    VdResult TranslateCommand(StreamCommand type, const void* payload);
+    template<typename T>
+    T* AppendCommand(StreamCommand type) { return _stream.Append<T>(static_cast<uint32_t>(type)); }
+    void BeginCurrentRenderPass(VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void EndCurrentRenderPass();
     void EnsureRenderPassActive();
     void EnsureNoRenderPass();
-    void PreDrawCommand();
+    void ResetRecordingState();
+    void ReleaseSecondaries(const std::vector<std::pair<CommandList*, VkCommandBuffer>>& secondaries);
+    void InvalidateBoundState();
+    void PreDrawCommand(bool indexed);
+    void FlushGraphicsPipeline();
+    void MarkGraphicsResourceSetsChanged(uint32_t firstSlot);
+    void FlushVertexBuffers();
+    void FlushIndexBuffer();
+    void UseBufferVersion(DeviceBuffer* buffer);
+    void ReleaseBufferVersions();
+    void RebindDiscardedBuffers();
     DeviceBuffer* GetStagingBuffer(uint32_t size);
     void FlushNewResourceSets(
         uint32_t newResourceSetsCount,
-        std::vector<ResourceSet*>& resourceSets,
-        std::vector<bool>& resourceSetsChanged,
+        ResourceSet* const* resourceSets,
+        bool* resourceSetsChanged,
+        VkDescriptorSet* boundDescriptorSets,
         VkPipelineBindPoint bindPoint,
         VkPipelineLayout pipelineLayout);
 };
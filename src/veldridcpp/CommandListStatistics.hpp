@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+
+namespace Veldrid
+{
+// Commands recorded by a CommandList since its last Begin. State set through the CommandList is only
+// recorded at the next draw, and only where it differs from what the command buffer already has bound;
+// RedundantStateSkipped counts the binds and dynamic state left out that way.
+struct CommandListStatistics
+{
+    uint32_t PipelineBinds;
+    uint32_t VertexBufferBinds;
+    uint32_t IndexBufferBinds;
+    uint32_t DescriptorSetBinds;
+    uint32_t ViewportSets;
+    uint32_t ScissorSets;
+    uint32_t Draws;
+    uint32_t RedundantStateSkipped;
+    // Heap allocations made on the recording thread between Begin and End, counted at End. Always 0 unless
+    // built with VD_TRACK_ALLOCATIONS; after warm-up, recording draws should not allocate.
+    uint32_t HeapAllocations;
+};
+}
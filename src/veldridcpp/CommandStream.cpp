@@ -0,0 +1,91 @@
+#include "stdafx.h"
+#include "CommandStream.hpp"
+#include "BitOperations.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+namespace Veldrid
+{
+struct PacketHeader
+{
+    uint32_t Type;
+    // Payload size, padded to keep the next header aligned.
+    uint32_t Size;
+};
+
+CommandStream::~CommandStream()
+{
+    for (Block& block : _blocks)
+    {
+        free(block.Data);
+    }
+}
+
+void CommandStream::Reset()
+{
+    for (size_t i = 0; i < _usedBlockCount; i++)
+    {
+        _blocks[i].Used = 0;
+    }
+    _usedBlockCount = 0;
+}
+
+void* CommandStream::Append(uint32_t type, uint32_t size)
+{
+    uint32_t paddedSize = static_cast<uint32_t>(AlignUp(size, sizeof(uint64_t)));
+    size_t packetSize = sizeof(PacketHeader) + paddedSize;
+
+    if (_usedBlockCount == 0 || _blocks[_usedBlockCount - 1].Capacity - _blocks[_usedBlockCount - 1].Used < packetSize)
+    {
+        // Packets larger than a block get a block of their own, which is kept for later packets.
+        size_t capacity = std::max(BlockSize, packetSize);
+        if (_usedBlockCount == _blocks.size())
+        {
+            _blocks.push_back({ nullptr, 0, 0 });
+        }
+        Block& next = _blocks[_usedBlockCount];
+        if (next.Capacity < capacity)
+        {
+            free(next.Data);
+            next.Data = static_cast<uint8_t*>(malloc(capacity));
+            if (next.Data == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            next.Capacity = capacity;
+        }
+        next.Used = 0;
+        _usedBlockCount += 1;
+    }
+
+    Block& block = _blocks[_usedBlockCount - 1];
+    PacketHeader* header = reinterpret_cast<PacketHeader*>(block.Data + block.Used);
+    header->Type = type;
+    header->Size = paddedSize;
+    block.Used += packetSize;
+
+    return header + 1;
+}
+
+bool CommandStream::Reader::Next(uint32_t* type, const void** payload)
+{
+    while (_blockIndex < _stream._usedBlockCount)
+    {
+        const Block& block = _stream._blocks[_blockIndex];
+        if (_offset < block.Used)
+        {
+            const PacketHeader* header = reinterpret_cast<const PacketHeader*>(block.Data + _offset);
+            *type = header->Type;
+            *payload = header + 1;
+            _offset += sizeof(PacketHeader) + header->Size;
+            return true;
+        }
+
+        _blockIndex += 1;
+        _offset = 0;
+    }
+
+    return false;
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace Veldrid
+{
+// An append-only stream of packets, each a type and a trivially copyable payload. Packets are written into
+// large blocks that are kept across Reset, so a stream of a steady size stops allocating after warm-up, and
+// payloads never move once written.
+class CommandStream
+{
+public:
+    CommandStream() { }
+    ~CommandStream();
+    CommandStream(const CommandStream&) = delete;
+    CommandStream& operator=(const CommandStream&) = delete;
+
+    // Discards every packet, keeping the blocks.
+    void Reset();
+    // Returns size bytes of payload for a new packet, aligned to 8 bytes.
+    void* Append(uint32_t type, uint32_t size);
+    template<typename T>
+    T* Append(uint32_t type) { return static_cast<T*>(Append(type, sizeof(T))); }
+
+    class Reader
+    {
+    public:
+        Reader(const CommandStream& stream) : _stream(stream) { }
+        // Moves to the next packet. Returns false at the end of the stream.
+        bool Next(uint32_t* type, const void** payload);
+
+    private:
+        const CommandStream& _stream;
+        size_t _blockIndex = 0;
+        size_t _offset = 0;
+    };
+
+private:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    struct Block
+    {
+        uint8_t* Data;
+        size_t Capacity;
+        size_t Used;
+    };
+
+    std::vector<Block> _blocks;
+    // One past the last block holding packets.
+    size_t _usedBlockCount = 0;
+};
+}
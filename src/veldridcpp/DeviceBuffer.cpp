@@ -3,17 +3,19 @@
 #include "BufferUsage.hpp"
 #include "GraphicsDevice.hpp"
 #include "VulkanUtil.hpp"
+#include "StreamingCopy.hpp"
 #include "vulkan.h"
 #include <stdint.h>
+#include <algorithm>
 
 namespace Veldrid
 {
 DeviceBuffer::DeviceBuffer(GraphicsDevice* const device, const BufferDescription& description)
     : _gd(device)
 {
-    VkDevice vkDevice = _gd->GetVkDevice();
     _size = description.SizeInBytes;
     _usage = description.Usage;
+    _intent = description.Intent;
     VkBufferUsageFlags vkUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     if ((_usage & BufferUsage::VertexBuffer) == BufferUsage::VertexBuffer)
     {
@@ -37,37 +39,295 @@ DeviceBuffer::DeviceBuffer(GraphicsDevice* const device, const BufferDescription
         vkUsage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
     }
 
+    _vkUsage = vkUsage;
+    // Buffers the GPU writes to are used on the graphics queue from the start.
+    _isOwnedByGraphicsQueue = (_usage & BufferUsage::StructuredBufferReadWrite) == BufferUsage::StructuredBufferReadWrite;
+    _isMappable = (_usage & BufferUsage::Staging) == BufferUsage::Staging
+        || (_usage & BufferUsage::Dynamic) == BufferUsage::Dynamic
+        || (_intent != MemoryIntent::Default && _intent != MemoryIntent::GpuOnly);
+
+    BufferVersion version = CreateVersion();
+    _vkBuffer = version.Buffer;
+    _memory = version.Memory;
+    _deviceLocalMappedSize = version.DeviceLocalMappedSize;
+    if ((_usage & BufferUsage::Dynamic) == BufferUsage::Dynamic)
+    {
+        _versions.push_back(version);
+    }
+
+    _gd->RegisterResource(this);
+}
+
+DeviceBuffer::DeviceBuffer(
+    GraphicsDevice* const device,
+    VkBuffer buffer,
+    VkDeviceMemory importedMemory,
+    uint32_t sizeInBytes,
+    void* hostPointer,
+    HostMemoryReleasedCallback onHostMemoryReleased,
+    void* userData)
+    : _gd(device)
+{
+    _vkBuffer = buffer;
+    _size = sizeInBytes;
+    _usage = BufferUsage::Staging;
+    _intent = MemoryIntent::Upload;
+    _vkUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    _isMappable = false;
+    // Only ever read by CommandList copies; never a target of transfer queue uploads.
+    _isOwnedByGraphicsQueue = true;
+    _memory = MemoryBlock(importedMemory, 0, sizeInBytes, 0, nullptr);
+    _importedMemory = importedMemory;
+    _hostPointer = hostPointer;
+    _onHostMemoryReleased = onHostMemoryReleased;
+    _hostMemoryUserData = userData;
+    // Not registered: DefragmentMemory must not move it.
+}
+
+DeviceBuffer::BufferVersion DeviceBuffer::CreateVersion()
+{
+    BufferVersion version = {};
     auto bufferCI = VkBufferCreateInfo();
     bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCI.size = description.SizeInBytes;
-    bufferCI.usage = vkUsage;
-    CheckResult(vkCreateBuffer(vkDevice, &bufferCI, nullptr, &_vkBuffer));
+    bufferCI.size = _size;
+    bufferCI.usage = _vkUsage;
+    CheckResult(vkCreateBuffer(_gd->GetVkDevice(), &bufferCI, nullptr, &version.Buffer));
 
     VkMemoryRequirements memReqs;
-    vkGetBufferMemoryRequirements(vkDevice, _vkBuffer, &memReqs);
+    bool prefersDedicated;
+    _gd->GetBufferMemoryRequirements(version.Buffer, &memReqs, &prefersDedicated);
 
-    bool hostVisible = (_usage & BufferUsage::Dynamic) == BufferUsage::Dynamic
-        || (_usage & BufferUsage::Staging) == BufferUsage::Staging;
+    bool isStaging = (_usage & BufferUsage::Staging) == BufferUsage::Staging;
+    bool hostVisible = _isMappable;
 
-    VkMemoryPropertyFlags memoryPropertyFlags =
-        hostVisible
-        ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    // Everything but staging and readback memory is read mostly by the GPU, so it belongs in device-local
+    // memory; if that can be mapped as well, CPU writes skip the staging copy.
+    VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VkMemoryPropertyFlags preferredFlags = 0;
+    if (!isStaging && _intent != MemoryIntent::Readback && _intent != MemoryIntent::GpuOnly)
+    {
+        VkMemoryRequirements paddedReqs = memReqs;
+        _gd->PadToNonCoherentAtom(&paddedReqs);
+        if (_gd->ReserveDeviceLocalMappedMemory(paddedReqs.memoryTypeBits, paddedReqs.size))
+        {
+            memReqs = paddedReqs;
+            version.DeviceLocalMappedSize = paddedReqs.size;
+            memoryPropertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            hostVisible = true;
+        }
+    }
+    if (hostVisible && version.DeviceLocalMappedSize == 0)
+    {
+        _gd->GetMappedMemoryFlags(_intent, &memoryPropertyFlags, &preferredFlags);
+        _gd->PadToNonCoherentAtom(&memReqs);
+    }
 
-    MemoryBlock memoryToken = _gd->GetMemoryManager().Allocate(
+    version.Memory = _gd->GetMemoryManager().Allocate(
         _gd->GetPhysicalDeviceMemProperties(),
         memReqs.memoryTypeBits,
         memoryPropertyFlags,
+        preferredFlags,
         hostVisible,
         memReqs.size,
-        memReqs.alignment);
-    _memory = memoryToken;
-    CheckResult(vkBindBufferMemory(_gd->GetVkDevice(), _vkBuffer, _memory.DeviceMemory, _memory.Offset));
+        memReqs.alignment,
+        prefersDedicated,
+        VK_NULL_HANDLE,
+        version.Buffer);
+    CheckResult(vkBindBufferMemory(_gd->GetVkDevice(), version.Buffer, version.Memory.DeviceMemory, version.Memory.Offset));
+    return version;
+}
+
+void DeviceBuffer::DestroyVersion(const BufferVersion& version)
+{
+    vkDestroyBuffer(_gd->GetVkDevice(), version.Buffer, nullptr);
+    _gd->GetMemoryManager().Free(version.Memory);
+    if (version.DeviceLocalMappedSize != 0)
+    {
+        _gd->ReleaseDeviceLocalMappedMemory(version.DeviceLocalMappedSize);
+    }
 }
 
-void DeviceBuffer::Destroy() const
+bool DeviceBuffer::Discard()
 {
-    vkDestroyBuffer(_gd->GetVkDevice(), _vkBuffer, nullptr);
+    _versionsLock.lock();
+    uint64_t completedSerial = _gd->GetCompletedSubmissionSerial();
+    if (_versions[_currentVersion].Use.PendingUseCount == 0 && _versions[_currentVersion].Use.LastUseSerial > completedSerial)
+    {
+        completedSerial = _gd->PollCompletedSubmissionSerial();
+    }
+    if (IsIdle(_versions[_currentVersion].Use, completedSerial))
+    {
+        _versionsLock.unlock();
+        return false;
+    }
+
+    // Go round the ring, so that the version reused is the one that has been idle the longest.
+    uint32_t versionCount = static_cast<uint32_t>(_versions.size());
+    uint32_t newVersion = UINT32_MAX;
+    for (uint32_t i = 1; i < versionCount; i++)
+    {
+        uint32_t candidate = (_currentVersion + i) % versionCount;
+        if (IsIdle(_versions[candidate].Use, completedSerial))
+        {
+            newVersion = candidate;
+            break;
+        }
+    }
+    if (newVersion == UINT32_MAX && versionCount < MaxVersionCount)
+    {
+        _versions.push_back(CreateVersion());
+        newVersion = versionCount;
+    }
+    // Only submitted work can be waited for.
+    for (uint32_t i = 1; i < versionCount && newVersion == UINT32_MAX; i++)
+    {
+        uint32_t candidate = (_currentVersion + i) % versionCount;
+        if (_versions[candidate].Use.PendingUseCount == 0)
+        {
+            newVersion = candidate;
+            _gd->WaitForSubmissionSerial(_versions[newVersion].Use.LastUseSerial);
+        }
+    }
+    if (newVersion == UINT32_MAX)
+    {
+        _versions.push_back(CreateVersion());
+        newVersion = versionCount;
+    }
+
+    _currentVersion = newVersion;
+    _vkBuffer = _versions[newVersion].Buffer;
+    _memory = _versions[newVersion].Memory;
+    _deviceLocalMappedSize = _versions[newVersion].DeviceLocalMappedSize;
+    _versionsLock.unlock();
+    _gd->BufferDiscarded();
+    return true;
+}
+
+void DeviceBuffer::DiscardRange(uint32_t offset, uint32_t size)
+{
+    MemoryBlock previous = _memory;
+    if (Discard() && (offset != 0 || size != _size))
+    {
+        // The rest of the buffer keeps its contents. This reads mapped memory, which is slow if it is
+        // write-combined; updating Dynamic buffers as a whole avoids it.
+        _gd->InvalidateMappedMemory(previous);
+        uint8_t* source = previous.BlockMappedPointer();
+        uint8_t* destination = _memory.BlockMappedPointer();
+        StreamingCopy(destination, source, offset);
+        StreamingCopy(destination + offset + size, source + offset + size, _size - offset - size);
+        _gd->FlushMappedMemory(_memory);
+    }
+}
+
+void DeviceBuffer::MarkVersionPending(uint32_t version)
+{
+    _versionsLock.lock();
+    GetUseState(version).PendingUseCount += 1;
+    _versionsLock.unlock();
+}
+
+void DeviceBuffer::MarkVersionUsed(uint32_t version, uint64_t serial)
+{
+    _versionsLock.lock();
+    UseState& use = GetUseState(version);
+    VdAssert(use.PendingUseCount > 0);
+    use.PendingUseCount -= 1;
+    use.LastUseSerial = std::max(use.LastUseSerial, serial);
+    _versionsLock.unlock();
+}
+
+void DeviceBuffer::ReleaseVersion(uint32_t version)
+{
+    _versionsLock.lock();
+    UseState& use = GetUseState(version);
+    VdAssert(use.PendingUseCount > 0);
+    use.PendingUseCount -= 1;
+    _versionsLock.unlock();
+}
+
+bool DeviceBuffer::LockIfIdle()
+{
+    VdAssert(!IsVersioned());
+    _versionsLock.lock();
+    uint64_t completedSerial = _gd->GetCompletedSubmissionSerial();
+    if (_use.PendingUseCount == 0 && _use.LastUseSerial > completedSerial)
+    {
+        completedSerial = _gd->PollCompletedSubmissionSerial();
+    }
+    if (!IsIdle(_use, completedSerial))
+    {
+        _versionsLock.unlock();
+        return false;
+    }
+
+    return true;
+}
+
+void DeviceBuffer::UnlockIdle()
+{
+    _versionsLock.unlock();
+}
+
+bool DeviceBuffer::Relocate(VkCommandBuffer cb, VkBuffer* oldBuffer, MemoryBlock* oldMemory)
+{
+    auto bufferCI = VkBufferCreateInfo();
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.size = _size;
+    bufferCI.usage = _vkUsage;
+    VkBuffer newBuffer;
+    CheckResult(vkCreateBuffer(_gd->GetVkDevice(), &bufferCI, nullptr, &newBuffer));
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(_gd->GetVkDevice(), newBuffer, &memReqs);
+    MemoryBlock newMemory;
+    if (!_gd->GetMemoryManager().AllocateRelocation(_memory, memReqs.size, memReqs.alignment, &newMemory))
+    {
+        vkDestroyBuffer(_gd->GetVkDevice(), newBuffer, nullptr);
+        return false;
+    }
+
+    CheckResult(vkBindBufferMemory(_gd->GetVkDevice(), newBuffer, newMemory.DeviceMemory, newMemory.Offset));
+
+    VkBufferCopy copyRegion;
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = 0;
+    copyRegion.size = _size;
+    vkCmdCopyBuffer(cb, _vkBuffer, newBuffer, 1, &copyRegion);
+    _isOwnedByGraphicsQueue = true;
+
+    *oldBuffer = _vkBuffer;
+    *oldMemory = _memory;
+    _vkBuffer = newBuffer;
+    _memory = newMemory;
+    return true;
+}
+
+void DeviceBuffer::Destroy()
+{
+    if (IsHostImported())
+    {
+        _gd->RetireHostImport(_vkBuffer, _importedMemory, _hostPointer, _onHostMemoryReleased, _hostMemoryUserData);
+        delete this;
+        return;
+    }
+
+    _gd->UnregisterResource(this);
+    if (_versions.size() > 0)
+    {
+        for (const BufferVersion& version : _versions)
+        {
+            DestroyVersion(version);
+        }
+    }
+    else
+    {
+        BufferVersion version = {};
+        version.Buffer = _vkBuffer;
+        version.Memory = _memory;
+        version.DeviceLocalMappedSize = _deviceLocalMappedSize;
+        DestroyVersion(version);
+    }
     delete this;
 }
 
@@ -3,6 +3,8 @@
 #include "GraphicsDevice.hpp"
 #include "vulkan.h"
 #include <stdint.h>
+#include <mutex>
+#include <vector>
 
 namespace Veldrid
 {
@@ -10,18 +12,107 @@ class DeviceBuffer
 {
 public:
     DeviceBuffer(GraphicsDevice* const device, const BufferDescription& description);
-    void Destroy() const;
+    // Wraps memory imported by GraphicsDevice::ImportHostBuffer. Such buffers are copy sources only.
+    DeviceBuffer(
+        GraphicsDevice* const device,
+        VkBuffer buffer,
+        VkDeviceMemory importedMemory,
+        uint32_t sizeInBytes,
+        void* hostPointer,
+        HostMemoryReleasedCallback onHostMemoryReleased,
+        void* userData);
+    void Destroy();
 
     uint32_t GetSizeInBytes() const { return _size; }
     BufferUsage GetUsage() const { return _usage; }
+    MemoryIntent GetIntent() const { return _intent; }
+    // Dynamic and Staging buffers, and those with a host-access intent, are mapped at the caller's request.
+    bool IsMappable() const { return _isMappable; }
+    // Placed in device-local, host-visible memory by GraphicsDevice's budget; also persistently mapped.
+    bool IsDeviceLocalMapped() const { return _deviceLocalMappedSize != 0; }
+    bool IsHostImported() const { return _importedMemory != VK_NULL_HANDLE; }
     MemoryBlock GetMemory() const { return _memory; }
     VkBuffer GetVkBuffer() const { return _vkBuffer; }
+    // False until the buffer is written on the graphics queue. Until then, GraphicsDevice may upload to it
+    // through the transfer queue and hand ownership over afterwards.
+    bool IsOwnedByGraphicsQueue() const { return _isOwnedByGraphicsQueue; }
+    void SetOwnedByGraphicsQueue() { _isOwnedByGraphicsQueue = true; }
+    // Moves the contents into a new buffer allocated by MemoryManager::AllocateRelocation, recording the
+    // copy into cb. Returns false if there was no room; otherwise the old buffer and memory are returned
+    // and must be kept alive until cb has completed.
+    bool Relocate(VkCommandBuffer cb, VkBuffer* oldBuffer, MemoryBlock* oldMemory);
+
+    // Dynamic buffers are backed by a small ring of versions; GetVkBuffer and GetMemory return the current
+    // one. CommandLists bind whichever version is current when they record, which holds it pending until the
+    // recording is submitted and then marks it used by that submission. Discard switches to a version that no
+    // recorded or submitted work can still read, unless the current one already is, and returns true if it
+    // switched. The new version's contents are undefined.
+    bool IsVersioned() const { return _versions.size() > 0; }
+    uint32_t GetVersion() const { return _currentVersion; }
+    bool Discard();
+    // Like Discard, but keeps the contents outside of the given range.
+    void DiscardRange(uint32_t offset, uint32_t size);
+    // Dynamic buffers track these uses per version. Device-local mapped buffers that aren't Dynamic track
+    // them as a whole, as version 0, so that GraphicsDevice can tell when writing them directly is safe.
+    bool IsUseTracked() const { return IsVersioned() || IsDeviceLocalMapped(); }
+    void MarkVersionPending(uint32_t version);
+    // Ends a pending use, which the given submission takes over.
+    void MarkVersionUsed(uint32_t version, uint64_t serial);
+    // Ends a pending use whose recording was abandoned.
+    void ReleaseVersion(uint32_t version);
+    // For tracked buffers that aren't Dynamic: returns true, leaving the buffer locked, if no recorded or
+    // submitted work uses it. Until UnlockIdle, no recording can start to use it.
+    bool LockIfIdle();
+    void UnlockIdle();
 
 private:
+    // Versions are only added beyond this when every other one is pending in a recording, which can't be
+    // waited for.
+    static const uint32_t MaxVersionCount = 8;
+
+    struct UseState
+    {
+        // Serial of the last submission that reads or writes the buffer.
+        uint64_t LastUseSerial;
+        // Recordings that use the buffer and haven't been submitted yet.
+        uint32_t PendingUseCount;
+    };
+
+    struct BufferVersion
+    {
+        VkBuffer Buffer;
+        MemoryBlock Memory;
+        VkDeviceSize DeviceLocalMappedSize;
+        UseState Use;
+    };
+
     GraphicsDevice * const _gd;
     VkBuffer _vkBuffer;
     uint32_t _size;
     BufferUsage _usage;
+    MemoryIntent _intent;
+    bool _isMappable;
+    VkDeviceSize _deviceLocalMappedSize = 0;
+    // Also guards _use.
+    std::mutex _versionsLock;
+    std::vector<BufferVersion> _versions;
+    // The uses of a buffer that isn't versioned.
+    UseState _use = {};
+    uint32_t _currentVersion = 0;
+    VkDeviceMemory _importedMemory = VK_NULL_HANDLE;
+    void* _hostPointer = nullptr;
+    HostMemoryReleasedCallback _onHostMemoryReleased = nullptr;
+    void* _hostMemoryUserData = nullptr;
+
+    BufferVersion CreateVersion();
+    UseState& GetUseState(uint32_t version) { return _versions.size() > 0 ? _versions[version].Use : _use; }
+    static bool IsIdle(const UseState& use, uint64_t completedSerial)
+    {
+        return use.PendingUseCount == 0 && use.LastUseSerial <= completedSerial;
+    }
+    void DestroyVersion(const BufferVersion& version);
+    VkBufferUsageFlags _vkUsage;
     MemoryBlock _memory;
+    bool _isOwnedByGraphicsQueue;
 };
 }
\ No newline at end of file
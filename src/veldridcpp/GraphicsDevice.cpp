@@ -12,11 +12,19 @@
 #include "MemoryManager.hpp"
 #include "ResourceFactory.hpp"
 #include "Fence.hpp"
+#include "TextureView.hpp"
+#include "ResourceSet.hpp"
+#include "StagingRing.hpp"
+#include "TextureStream.hpp"
+#include "ReadbackPool.hpp"
+#include "ReadbackTicket.hpp"
+#include "TextureFile.hpp"
 #include "FormatHelpers.hpp"
 #include "Util.hpp"
 #include <cassert>
 #include <mutex>
 #include <algorithm>
+#include <sstream>
 
 #ifdef _WINDOWS
 #include "vulkan_win32.h"
@@ -37,16 +45,20 @@ VdResult GraphicsDevice::Init(const GraphicsDeviceOptions& options, const Graphi
     result = CreateLogicalDevice(VK_NULL_HANDLE);
     if (result != VdResult::Success) { return result; }
 
-    _memoryManager.Init(_device, _physicalDevice);
+    _memoryManager.Init(_device, _physicalDevice, _dedicatedAllocationEnabled);
     _factory = new ResourceFactory(this);
 
     _descriptorPoolManager = new DescriptorPoolManager(this);
+    _stagingRing = new StagingRing(this);
+    _readbackPool = new ReadbackPool(this);
 
     return VdResult::Success;
 }
 
 GraphicsDevice::~GraphicsDevice()
 {
+    delete _readbackPool;
+    delete _stagingRing;
     delete _descriptorPoolManager;
     // TODO: Destroy stuff.
 }
@@ -109,6 +121,12 @@ VdResult GraphicsDevice::CreateInstance()
 #error Unsupported Platform
 #endif
 
+    if (availableInstanceExtensions.count(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) != 0)
+    {
+        instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        _physicalDeviceProperties2Enabled = true;
+    }
+
     bool debugReportExtensionAvailable = false;
     if (_debug)
     {
@@ -162,26 +180,56 @@ VdResult GraphicsDevice::CreatePhysicalDevice()
     vkGetPhysicalDeviceProperties(_physicalDevice, &_physicalDeviceProperties);
     vkGetPhysicalDeviceFeatures(_physicalDevice, &_physicalDeviceFeatures);
     vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &_physicalDeviceMemProperties);
+    InitDeviceLocalMappedBudget();
 
     return VdResult::Success;
 }
 
+// UMA devices expose all of their memory as both device-local and host-visible. Discrete GPUs expose a
+// window into VRAM through the PCIe BAR: 256 MB normally, or all of VRAM with resizable BAR.
+void GraphicsDevice::InitDeviceLocalMappedBudget()
+{
+    const VkMemoryPropertyFlags deviceLocalMapped = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    VkDeviceSize largestDeviceLocalHeap = 0;
+    VkDeviceSize mappedHeap = 0;
+    for (uint32_t i = 0; i < _physicalDeviceMemProperties.memoryTypeCount; i++)
+    {
+        const VkMemoryType& type = _physicalDeviceMemProperties.memoryTypes[i];
+        VkDeviceSize heapSize = _physicalDeviceMemProperties.memoryHeaps[type.heapIndex].size;
+        if ((type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0)
+        {
+            largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, heapSize);
+        }
+        if ((type.propertyFlags & deviceLocalMapped) == deviceLocalMapped)
+        {
+            mappedHeap = std::max(mappedHeap, heapSize);
+        }
+    }
+
+    // A small BAR is shared with the driver and other processes, so only claim part of it.
+    _deviceLocalMappedBudget = mappedHeap == largestDeviceLocalHeap ? mappedHeap / 2 : mappedHeap / 4;
+}
+
 VdResult GraphicsDevice::CreateLogicalDevice(VkSurfaceKHR surface)
 {
     GetQueueFamilyIndices(surface);
 
     std::unordered_set<uint32_t> familyIndices = std::unordered_set<uint32_t>{ _graphicsQueueIndex, _presentQueueIndex };
+    if (_transferQueueIndex != UINT32_MAX)
+    {
+        familyIndices.insert(_transferQueueIndex);
+    }
     uint32_t queueCount = static_cast<uint32_t>(familyIndices.size());
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos = std::vector<VkDeviceQueueCreateInfo>(queueCount);
 
+    float priority = 1.f;
     uint32_t i = 0;
     for (uint32_t queueIndex : familyIndices)
     {
         VkDeviceQueueCreateInfo queueCreateInfo = {};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = _graphicsQueueIndex;
+        queueCreateInfo.queueFamilyIndex = queueIndex;
         queueCreateInfo.queueCount = 1;
-        float priority = 1.f;
         queueCreateInfo.pQueuePriorities = &priority;
         queueCreateInfos[i] = queueCreateInfo;
         i += 1;
@@ -195,22 +243,35 @@ VdResult GraphicsDevice::CreateLogicalDevice(VkSurfaceKHR surface)
     deviceFeatures.multiViewport = true;
     deviceFeatures.textureCompressionBC = true;
 
-    bool debugMarkerSupported = false;
-
     uint32_t propertyCount;
     CheckResult(vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &propertyCount, nullptr));
     auto properties = std::vector<VkExtensionProperties>(propertyCount);
     CheckResult(vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &propertyCount, properties.data()));
 
-    for (uint32_t property = 0; property < propertyCount; property++)
+    std::unordered_set<std::string> availableDeviceExtensions;
+    for (auto prop : properties)
     {
-        if (strcmp(properties[property].extensionName, "VK_EXT_debug_marker") == 0)
-        {
-            debugMarkerSupported = true;
-            break;
-        }
+        availableDeviceExtensions.insert(prop.extensionName);
     }
 
+    bool debugMarkerSupported = availableDeviceExtensions.count(VK_EXT_DEBUG_MARKER_EXTENSION_NAME) != 0;
+    bool dedicatedAllocationSupported =
+        availableDeviceExtensions.count(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME) != 0
+        && availableDeviceExtensions.count(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME) != 0;
+#ifdef VK_EXT_memory_budget
+    bool memoryBudgetSupported = _physicalDeviceProperties2Enabled
+        && availableDeviceExtensions.count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) != 0;
+#else
+    bool memoryBudgetSupported = false;
+#endif
+#ifdef VK_EXT_external_memory_host
+    bool externalMemoryHostSupported = _physicalDeviceProperties2Enabled
+        && availableDeviceExtensions.count(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME) != 0
+        && availableDeviceExtensions.count(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) != 0;
+#else
+    bool externalMemoryHostSupported = false;
+#endif
+
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.queueCreateInfoCount = queueCount;
@@ -231,18 +292,72 @@ VdResult GraphicsDevice::CreateLogicalDevice(VkSurfaceKHR surface)
         extensionNames.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
         _debugMarkerEnabled = true;
     }
+    if (dedicatedAllocationSupported)
+    {
+        extensionNames.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
+        extensionNames.push_back(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+    }
+#ifdef VK_EXT_memory_budget
+    if (memoryBudgetSupported)
+    {
+        extensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+#endif
+#ifdef VK_EXT_external_memory_host
+    if (externalMemoryHostSupported)
+    {
+        extensionNames.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+        extensionNames.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+#endif
     deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensionNames.size());
     deviceCreateInfo.ppEnabledExtensionNames = extensionNames.data();
 
     CheckResult(vkCreateDevice(_physicalDevice, &deviceCreateInfo, nullptr, &_device));
 
     vkGetDeviceQueue(_device, _graphicsQueueIndex, 0, &_graphicsQueue);
+    if (_transferQueueIndex != UINT32_MAX)
+    {
+        vkGetDeviceQueue(_device, _transferQueueIndex, 0, &_transferQueue);
+    }
 
     if (debugMarkerSupported)
     {
         _setObjectNamePtr = (PFN_vkDebugMarkerSetObjectNameEXT)vkGetInstanceProcAddr(_instance, "vkDebugMarkerSetObjectNameEXT");
     }
 
+    if (dedicatedAllocationSupported)
+    {
+        _getBufferMemoryRequirements2 = (PFN_vkGetBufferMemoryRequirements2KHR)vkGetDeviceProcAddr(_device, "vkGetBufferMemoryRequirements2KHR");
+        _getImageMemoryRequirements2 = (PFN_vkGetImageMemoryRequirements2KHR)vkGetDeviceProcAddr(_device, "vkGetImageMemoryRequirements2KHR");
+        _dedicatedAllocationEnabled = _getBufferMemoryRequirements2 != nullptr && _getImageMemoryRequirements2 != nullptr;
+    }
+
+    if (memoryBudgetSupported)
+    {
+        _getPhysicalDeviceMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+        _memoryBudgetEnabled = _getPhysicalDeviceMemoryProperties2 != nullptr;
+    }
+
+#ifdef VK_EXT_external_memory_host
+    if (externalMemoryHostSupported)
+    {
+        auto getPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceProperties2KHR");
+        _getMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(_device, "vkGetMemoryHostPointerPropertiesEXT");
+        if (getPhysicalDeviceProperties2 != nullptr && _getMemoryHostPointerProperties != nullptr)
+        {
+            VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+            hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2KHR properties2 = {};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+            properties2.pNext = &hostProperties;
+            getPhysicalDeviceProperties2(_physicalDevice, &properties2);
+            _minImportedHostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+            _externalMemoryHostEnabled = true;
+        }
+    }
+#endif
+
     return VdResult::Success;
 }
 
@@ -255,12 +370,26 @@ void GraphicsDevice::GetQueueFamilyIndices(VkSurfaceKHR surface)
 
     bool foundGraphics = false;
     bool foundPresent = surface == VK_NULL_HANDLE;
+    _transferQueueIndex = UINT32_MAX;
 
     for (uint32_t i = 0; i < qfp.size(); i++)
     {
-        if ((qfp[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0)
+        if (!foundGraphics && (qfp[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0)
         {
             _graphicsQueueIndex = i;
+            foundGraphics = true;
+        }
+
+        // A dedicated transfer family usually maps to a separate copy engine, which can run uploads
+        // alongside rendering.
+        if (_transferQueueIndex == UINT32_MAX
+            && (qfp[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0
+            && (qfp[i].queueFlags & VK_QUEUE_TRANSFER_BIT) != 0
+            && qfp[i].queueCount > 0)
+        {
+            VkExtent3D granularity = qfp[i].minImageTransferGranularity;
+            _transferQueueIndex = i;
+            _transferQueueCopiesImages = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
         }
 
         if (!foundPresent)
@@ -273,11 +402,11 @@ void GraphicsDevice::GetQueueFamilyIndices(VkSurfaceKHR surface)
                 foundPresent = true;
             }
         }
+    }
 
-        if (foundGraphics && foundPresent)
-        {
-            return;
-        }
+    if (surface == VK_NULL_HANDLE)
+    {
+        _presentQueueIndex = _graphicsQueueIndex;
     }
 }
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
@@ -294,6 +423,204 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
     return VK_FALSE;
 }
 
+void GraphicsDevice::GetBufferMemoryRequirements(VkBuffer buffer, VkMemoryRequirements* memReqs, bool* prefersDedicated)
+{
+    if (!_dedicatedAllocationEnabled)
+    {
+        vkGetBufferMemoryRequirements(_device, buffer, memReqs);
+        *prefersDedicated = false;
+        return;
+    }
+
+    VkBufferMemoryRequirementsInfo2KHR requirementsInfo = {};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR;
+    requirementsInfo.buffer = buffer;
+
+    VkMemoryDedicatedRequirementsKHR dedicatedReqs = {};
+    dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+    VkMemoryRequirements2KHR memReqs2 = {};
+    memReqs2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+    memReqs2.pNext = &dedicatedReqs;
+
+    _getBufferMemoryRequirements2(_device, &requirementsInfo, &memReqs2);
+    *memReqs = memReqs2.memoryRequirements;
+    *prefersDedicated = dedicatedReqs.prefersDedicatedAllocation || dedicatedReqs.requiresDedicatedAllocation;
+}
+
+void GraphicsDevice::GetImageMemoryRequirements(VkImage image, VkMemoryRequirements* memReqs, bool* prefersDedicated)
+{
+    if (!_dedicatedAllocationEnabled)
+    {
+        vkGetImageMemoryRequirements(_device, image, memReqs);
+        *prefersDedicated = false;
+        return;
+    }
+
+    VkImageMemoryRequirementsInfo2KHR requirementsInfo = {};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR;
+    requirementsInfo.image = image;
+
+    VkMemoryDedicatedRequirementsKHR dedicatedReqs = {};
+    dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+    VkMemoryRequirements2KHR memReqs2 = {};
+    memReqs2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+    memReqs2.pNext = &dedicatedReqs;
+
+    _getImageMemoryRequirements2(_device, &requirementsInfo, &memReqs2);
+    *memReqs = memReqs2.memoryRequirements;
+    *prefersDedicated = dedicatedReqs.prefersDedicatedAllocation || dedicatedReqs.requiresDedicatedAllocation;
+}
+
+void GraphicsDevice::GetMappedMemoryFlags(MemoryIntent intent, VkMemoryPropertyFlags* requiredFlags, VkMemoryPropertyFlags* preferredFlags) const
+{
+    switch (intent)
+    {
+    case MemoryIntent::Readback:
+        // Write-combined memory is very slow to read from; cached memory may need invalidating instead.
+        *requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        *preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        break;
+    case MemoryIntent::Upload:
+    case MemoryIntent::FrequentlyUpdated:
+        *requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        *preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+    default:
+        *requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        *preferredFlags = 0;
+        break;
+    }
+}
+
+void GraphicsDevice::PadToNonCoherentAtom(VkMemoryRequirements* memReqs) const
+{
+    VkDeviceSize atomSize = _physicalDeviceProperties.limits.nonCoherentAtomSize;
+    memReqs->size = (memReqs->size + atomSize - 1) / atomSize * atomSize;
+    memReqs->alignment = std::max(memReqs->alignment, atomSize);
+}
+
+bool GraphicsDevice::GetNonCoherentRange(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange* range) const
+{
+    VkMemoryPropertyFlags flags = _physicalDeviceMemProperties.memoryTypes[block.MemoryTypeIndex].propertyFlags;
+    if (!block.IsPersistentMapped() || (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0)
+    {
+        return false;
+    }
+
+    // The block starts on an atom boundary and spans whole atoms (see PadToNonCoherentAtom), or is a dedicated
+    // allocation whose end is the end of the memory.
+    VkDeviceSize atomSize = _physicalDeviceProperties.limits.nonCoherentAtomSize;
+    VkDeviceSize end = size == VK_WHOLE_SIZE ? block.Size : std::min(block.Size, offset + size);
+    VkDeviceSize start = offset / atomSize * atomSize;
+    end = std::min(block.Size, (end + atomSize - 1) / atomSize * atomSize);
+
+    *range = {};
+    range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range->memory = block.DeviceMemory;
+    range->offset = block.Offset + start;
+    range->size = end - start;
+    return true;
+}
+
+void GraphicsDevice::FlushMappedMemory(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange range;
+    if (GetNonCoherentRange(block, offset, size, &range))
+    {
+        CheckResult(vkFlushMappedMemoryRanges(_device, 1, &range));
+    }
+}
+
+void GraphicsDevice::InvalidateMappedMemory(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkMappedMemoryRange range;
+    if (GetNonCoherentRange(block, offset, size, &range))
+    {
+        CheckResult(vkInvalidateMappedMemoryRanges(_device, 1, &range));
+    }
+}
+
+bool GraphicsDevice::ReserveDeviceLocalMappedMemory(uint32_t memoryTypeBits, VkDeviceSize size)
+{
+    const VkMemoryPropertyFlags deviceLocalMapped = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    bool hasType = false;
+    for (uint32_t i = 0; i < _physicalDeviceMemProperties.memoryTypeCount; i++)
+    {
+        if ((memoryTypeBits & (1 << i)) != 0
+            && (_physicalDeviceMemProperties.memoryTypes[i].propertyFlags & deviceLocalMapped) == deviceLocalMapped)
+        {
+            hasType = true;
+        }
+    }
+
+    if (!hasType)
+    {
+        return false;
+    }
+
+    _deviceLocalMappedLock.lock();
+    bool result = _deviceLocalMappedBytes + size <= _deviceLocalMappedBudget;
+    if (result)
+    {
+        _deviceLocalMappedBytes += size;
+    }
+    _deviceLocalMappedLock.unlock();
+
+    return result;
+}
+
+void GraphicsDevice::ReleaseDeviceLocalMappedMemory(VkDeviceSize size)
+{
+    _deviceLocalMappedLock.lock();
+    _deviceLocalMappedBytes -= size;
+    _deviceLocalMappedLock.unlock();
+}
+
+VdResult GraphicsDevice::SetDeviceLocalMappedBudget(uint64_t budgetInBytes)
+{
+    _deviceLocalMappedLock.lock();
+    _deviceLocalMappedBudget = budgetInBytes;
+    _deviceLocalMappedLock.unlock();
+
+    return VdResult::Success;
+}
+
+// Mappable buffers are always written directly; their users order writes against the GPU themselves. Other
+// buffers are updated in queue order through the staging ring, so writing one directly is only equivalent
+// when no recorded or submitted work can still read it and no queued copy to it would land afterwards.
+// The buffer stays locked until EndDirectWrite, so that no recording can start to use it in between.
+bool GraphicsDevice::BeginDirectWrite(DeviceBuffer* buffer)
+{
+    if (buffer->IsMappable())
+    {
+        return true;
+    }
+    if (!buffer->IsDeviceLocalMapped() || !buffer->LockIfIdle())
+    {
+        return false;
+    }
+
+    _uploadLock.lock();
+    bool pending = _graphicsUploads.BufferCopies.count(buffer->GetVkBuffer()) != 0
+        || _transferUploads.BufferCopies.count(buffer->GetVkBuffer()) != 0;
+    _uploadLock.unlock();
+    if (pending)
+    {
+        buffer->UnlockIdle();
+        return false;
+    }
+
+    return true;
+}
+
+void GraphicsDevice::EndDirectWrite(DeviceBuffer* buffer)
+{
+    if (!buffer->IsMappable())
+    {
+        buffer->UnlockIdle();
+    }
+}
+
 VdResult GraphicsDevice::SwapBuffers(Swapchain& sc)
 {
     VkPresentInfoKHR presentInfo = {};
@@ -317,6 +644,9 @@ VdResult GraphicsDevice::SwapBuffers(Swapchain& sc)
     }
     presentLock.unlock();
 
+    _memoryManager.NextFrame();
+    ProcessTextureStreams();
+
     return VdResult::Success;
 }
 
@@ -326,45 +656,204 @@ VdResult GraphicsDevice::UpdateBuffer(
     void* source,
     uint32_t sizeInBytes)
 {
-    DeviceBuffer* copySrcVkBuffer = nullptr;
-    void* mappedPtr;
-    void* destPtr = nullptr;
-    bool isPersistentMapped = buffer->GetMemory().IsPersistentMapped();
-    if (isPersistentMapped)
+    // Imported host memory belongs to the application and is only ever a copy source.
+    if (buffer->IsHostImported())
     {
-        mappedPtr = buffer->GetMemory().BlockMappedPointer();
-        destPtr = (uint8_t*)mappedPtr + bufferOffsetInBytes;
+        return VdResult::InvalidOperation;
     }
-    else
+
+    if (BeginDirectWrite(buffer))
     {
-        copySrcVkBuffer = GetFreeStagingBuffer(sizeInBytes);
-        mappedPtr = copySrcVkBuffer->GetMemory().BlockMappedPointer();
-        destPtr = (uint8_t*)mappedPtr;
+        if (buffer->IsVersioned())
+        {
+            buffer->DiscardRange(bufferOffsetInBytes, sizeInBytes);
+        }
+        uint8_t* destPtr = buffer->GetMemory().BlockMappedPointer() + bufferOffsetInBytes;
+        StreamingCopy(destPtr, source, sizeInBytes);
+        FlushMappedMemory(buffer->GetMemory(), bufferOffsetInBytes, sizeInBytes);
+        EndDirectWrite(buffer);
+        return VdResult::Success;
     }
 
-    memcpy(destPtr, source, sizeInBytes);
+    _uploadLock.lock();
+    // The first upload to a buffer goes through the transfer queue, which then hands it to the graphics
+    // queue. Later uploads stay on the graphics queue, ordered after any rendering that reads the buffer.
+    bool useTransferQueue = _transferQueue != VK_NULL_HANDLE && !buffer->IsOwnedByGraphicsQueue();
+    VkCommandBuffer cb = GetUploadCommandBuffer(useTransferQueue);
+    StagingAllocation staging = _stagingRing->Allocate(
+        cb,
+        sizeInBytes,
+        _physicalDeviceProperties.limits.optimalBufferCopyOffsetAlignment);
+    StreamingCopy(staging.MappedPointer, source, sizeInBytes);
+    QueueBufferCopy(useTransferQueue, buffer, staging, bufferOffsetInBytes, sizeInBytes);
+    _uploadLock.unlock();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::BeginUpdateBuffer(
+    DeviceBuffer* buffer,
+    uint32_t bufferOffsetInBytes,
+    uint32_t sizeInBytes,
+    BufferUpdate* update)
+{
+    // Imported host memory belongs to the application and is only ever a copy source.
+    if (buffer->IsHostImported())
+    {
+        return VdResult::InvalidOperation;
+    }
 
-    if (!isPersistentMapped)
+    update->Buffer = buffer;
+    update->Offset = bufferOffsetInBytes;
+    update->SizeInBytes = sizeInBytes;
+    // Other buffers can't stay locked while the caller writes, so only mappable ones are written in place.
+    if (buffer->IsMappable())
     {
-        SharedCommandPool* pool = GetFreeCommandPool();
-        VkCommandBuffer cb = pool->BeginNewCommandBuffer();
+        if (buffer->IsVersioned())
+        {
+            buffer->DiscardRange(bufferOffsetInBytes, sizeInBytes);
+        }
+        update->Data = buffer->GetMemory().BlockMappedPointer() + bufferOffsetInBytes;
+        update->Staging = {};
+        return VdResult::Success;
+    }
 
-        VkBufferCopy copyRegion;
+    // Not tied to an upload command buffer yet: that may be submitted before the caller is done.
+    update->Staging = _stagingRing->Reserve(sizeInBytes, _physicalDeviceProperties.limits.optimalBufferCopyOffsetAlignment);
+    update->Data = update->Staging.MappedPointer;
 
-        copyRegion.dstOffset = bufferOffsetInBytes;
-        copyRegion.size = sizeInBytes;
-        copyRegion.srcOffset = 0;
-        vkCmdCopyBuffer(cb, copySrcVkBuffer->GetVkBuffer(), buffer->GetVkBuffer(), 1, &copyRegion);
+    return VdResult::Success;
+}
 
-        pool->EndAndSubmit(cb);
-        _stagingResourcesLock.lock();
-        _submittedStagingBuffers.emplace(cb, copySrcVkBuffer);
-        _stagingResourcesLock.unlock();
+VdResult GraphicsDevice::EndUpdateBuffer(BufferUpdate* update)
+{
+    if (update->Staging.Buffer == VK_NULL_HANDLE)
+    {
+        FlushMappedMemory(update->Buffer->GetMemory(), update->Offset, update->SizeInBytes);
+        return VdResult::Success;
     }
 
+    _uploadLock.lock();
+    bool useTransferQueue = _transferQueue != VK_NULL_HANDLE && !update->Buffer->IsOwnedByGraphicsQueue();
+    VkCommandBuffer cb = GetUploadCommandBuffer(useTransferQueue);
+    _stagingRing->Commit(update->Staging, cb);
+    QueueBufferCopy(useTransferQueue, update->Buffer, update->Staging, update->Offset, update->SizeInBytes);
+    _uploadLock.unlock();
+
     return VdResult::Success;
 }
 
+void GraphicsDevice::QueueBufferCopy(
+    bool useTransferQueue,
+    DeviceBuffer* buffer,
+    const StagingAllocation& staging,
+    uint32_t bufferOffsetInBytes,
+    uint32_t sizeInBytes)
+{
+    UploadBatch& batch = useTransferQueue ? _transferUploads : _graphicsUploads;
+    PendingBufferCopy copy;
+    copy.Source = staging.Buffer;
+    copy.Region.srcOffset = staging.Offset;
+    copy.Region.dstOffset = bufferOffsetInBytes;
+    copy.Region.size = sizeInBytes;
+
+    // Regions of one vkCmdCopyBuffer must not overlap, and a later update must land after an earlier one.
+    std::vector<PendingBufferCopy>& copies = batch.BufferCopies[buffer->GetVkBuffer()];
+    for (const PendingBufferCopy& pending : copies)
+    {
+        if (pending.Region.dstOffset < copy.Region.dstOffset + copy.Region.size
+            && copy.Region.dstOffset < pending.Region.dstOffset + pending.Region.size)
+        {
+            RecordBufferCopies(batch.CommandBuffer, buffer->GetVkBuffer(), copies);
+
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(batch.CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            break;
+        }
+    }
+    copies.push_back(copy);
+
+    if (useTransferQueue)
+    {
+        VkBufferMemoryBarrier release = {};
+        release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        release.srcQueueFamilyIndex = _transferQueueIndex;
+        release.dstQueueFamilyIndex = _graphicsQueueIndex;
+        release.buffer = buffer->GetVkBuffer();
+        release.offset = 0;
+        release.size = VK_WHOLE_SIZE;
+        batch.BufferReleases.push_back(release);
+        buffer->SetOwnedByGraphicsQueue();
+    }
+
+    _pendingUploadBytes += sizeInBytes;
+    if (_pendingUploadBytes >= MaxPendingUploadBytes)
+    {
+        FlushUploads();
+    }
+}
+
+VkCommandBuffer GraphicsDevice::GetUploadCommandBuffer(bool transfer)
+{
+    UploadBatch& batch = transfer ? _transferUploads : _graphicsUploads;
+    if (batch.CommandBuffer == VK_NULL_HANDLE)
+    {
+        batch.Pool = GetFreeCommandPool(transfer);
+        batch.CommandBuffer = batch.Pool->BeginNewCommandBuffer();
+    }
+
+    return batch.CommandBuffer;
+}
+
+void GraphicsDevice::RecordBufferCopies(VkCommandBuffer cb, VkBuffer destination, std::vector<PendingBufferCopy>& copies)
+{
+    std::sort(copies.begin(), copies.end(), [](const PendingBufferCopy& a, const PendingBufferCopy& b)
+    {
+        return a.Source != b.Source ? a.Source < b.Source : a.Region.dstOffset < b.Region.dstOffset;
+    });
+
+    // Adjacent uploads usually come from adjacent ring space as well, and merge into one region.
+    std::vector<VkBufferCopy> regions;
+    for (uint32_t i = 0; i < copies.size(); i++)
+    {
+        const VkBufferCopy& region = copies[i].Region;
+        if (regions.size() > 0
+            && regions.back().srcOffset + regions.back().size == region.srcOffset
+            && regions.back().dstOffset + regions.back().size == region.dstOffset)
+        {
+            regions.back().size += region.size;
+        }
+        else
+        {
+            regions.push_back(region);
+        }
+
+        if (i + 1 == copies.size() || copies[i + 1].Source != copies[i].Source)
+        {
+            vkCmdCopyBuffer(cb, copies[i].Source, destination, static_cast<uint32_t>(regions.size()), regions.data());
+            regions.clear();
+        }
+    }
+
+    copies.clear();
+}
+
+void GraphicsDevice::RecordPendingBufferCopies(UploadBatch& batch)
+{
+    for (auto& kvp : batch.BufferCopies)
+    {
+        if (kvp.second.size() > 0)
+        {
+            RecordBufferCopies(batch.CommandBuffer, kvp.first, kvp.second);
+        }
+    }
+    batch.BufferCopies.clear();
+}
+
 VdResult GraphicsDevice::UpdateTexture(
     Texture* texture,
     void* source, uint32_t sizeInBytes,
@@ -391,57 +880,431 @@ VdResult GraphicsDevice::UpdateTexture(
             (uint32_t)layout.rowPitch, (uint32_t)layout.depthPitch,
             width, height, depth,
             texture->GetFormat());
+        FlushMappedMemory(memBlock, layout.offset, layout.size);
     }
     else
     {
-        Texture* stagingTex = GetFreeStagingTexture(width, height, depth, texture->GetFormat());
-        UpdateTexture(stagingTex, source, sizeInBytes, 0, 0, 0, width, height, depth, 0, 0);
-        SharedCommandPool* pool = GetFreeCommandPool();
-        VkCommandBuffer cb = pool->BeginNewCommandBuffer();
-        CommandList::CopyTextureCore_CommandBuffer(
-            cb,
-            stagingTex, 0, 0, 0, 0, 0,
-            texture, x, y, z, mipLevel, arrayLayer,
-            width, height, depth, 1);
-        pool->EndAndSubmit(cb);
-        _stagingResourcesLock.lock();
-        _submittedStagingTextures.emplace(cb, stagingTex);
-        _stagingResourcesLock.unlock();
+        TextureUploadRegion region;
+        region.Data = source;
+        region.X = x;
+        region.Y = y;
+        region.Z = z;
+        region.Width = width;
+        region.Height = height;
+        region.Depth = depth;
+        region.MipLevel = mipLevel;
+        region.ArrayLayer = arrayLayer;
+        UpdateTextureRegions(texture, 1, &region);
     }
 
     return VdResult::Success;
 }
 
-VdResult GraphicsDevice::SubmitCommands(CommandList* cl, Fence* fence)
+static VkDeviceSize LeastCommonMultiple(VkDeviceSize a, VkDeviceSize b)
 {
-    SubmitCommandBuffer(
-        cl,
-        cl->GetVkCommandBuffer(),
-        0, nullptr,
-        0, nullptr,
-        fence);
-    cl->CommandBufferSubmitted();
-
-    return VdResult::Success;
+    VkDeviceSize x = a;
+    VkDeviceSize y = b;
+    while (y != 0)
+    {
+        VkDeviceSize remainder = x % y;
+        x = y;
+        y = remainder;
+    }
+    return a / x * b;
 }
 
-VdResult GraphicsDevice::MapBuffer(DeviceBuffer* buffer, MapMode mode, MappedResource* mappedResource)
+VdResult GraphicsDevice::UpdateTextureRegions(Texture* texture, uint32_t regionCount, const TextureUploadRegion* regions)
 {
-    mappedResource->Mode = mode;
+    uint32_t layerCount = HasFlag(texture->GetUsage(), TextureUsage::Cubemap)
+        ? texture->GetArrayLayers() * 6
+        : texture->GetArrayLayers();
+    if (HasFlag(texture->GetUsage(), TextureUsage::Staging))
+    {
+        return VdResult::InvalidOperation;
+    }
+    for (uint32_t i = 0; i < regionCount; i++)
+    {
+        const TextureUploadRegion& region = regions[i];
+        if (region.MipLevel >= texture->GetMipLevels() || region.ArrayLayer >= layerCount)
+        {
+            return VdResult::InvalidOperation;
+        }
 
-    MemoryBlock memoryBlock = buffer->GetMemory();
-    mappedResource->SizeInBytes = buffer->GetSizeInBytes();
-    mappedResource->Data = memoryBlock.BlockMappedPointer();
+        uint32_t mipWidth, mipHeight, mipDepth;
+        GetMipDimensions(texture, region.MipLevel, &mipWidth, &mipHeight, &mipDepth);
+        if (uint64_t(region.X) + region.Width > mipWidth
+            || uint64_t(region.Y) + region.Height > mipHeight
+            || uint64_t(region.Z) + region.Depth > mipDepth)
+        {
+            return VdResult::InvalidOperation;
+        }
+    }
 
-    return VdResult::Success;
-}
+    PixelFormat format = texture->GetFormat();
+    VkDeviceSize texelSize = IsCompressedFormat(format) ? GetBlockSizeInBytes(format) : GetSizeInBytes(format);
+    // Every bufferOffset must be a multiple of both the texel block size and 4.
+    VkDeviceSize alignment = LeastCommonMultiple(
+        LeastCommonMultiple(texelSize, 4),
+        _physicalDeviceProperties.limits.optimalBufferCopyOffsetAlignment);
+
+    // The source data is already tightly packed, which is what bufferRowLength and bufferImageHeight of
+    // zero describe, so each region is a single copy into the staging ring.
+    std::vector<VkBufferImageCopy> copies(regionCount);
+    std::vector<VkDeviceSize> sizes(regionCount);
+    VkDeviceSize totalSize = 0;
+    for (uint32_t i = 0; i < regionCount; i++)
+    {
+        uint32_t rowPitch = GetRowPitch(regions[i].Width, format);
+        sizes[i] = static_cast<VkDeviceSize>(GetDepthPitch(rowPitch, regions[i].Height, format)) * regions[i].Depth;
+        copies[i].bufferOffset = totalSize;
+        totalSize = (totalSize + sizes[i] + alignment - 1) / alignment * alignment;
+    }
+
+    _uploadLock.lock();
+    // Subresources that have never been touched can be written by the transfer queue.
+    bool useTransferQueue = _transferQueue != VK_NULL_HANDLE
+        && _transferQueueCopiesImages
+        && !texture->IsOwnedByGraphicsQueue();
+    for (uint32_t i = 0; i < regionCount && useTransferQueue; i++)
+    {
+        useTransferQueue = texture->GetImageLayout(regions[i].MipLevel, regions[i].ArrayLayer) == VK_IMAGE_LAYOUT_PREINITIALIZED;
+    }
+    UploadBatch& batch = useTransferQueue ? _transferUploads : _graphicsUploads;
+    VkCommandBuffer cb = GetUploadCommandBuffer(useTransferQueue);
+    StagingAllocation staging = _stagingRing->Allocate(cb, totalSize, alignment);
+
+    // A copy writes a single aspect; the uploaded data of a depth-stencil texture is its depth.
+    VkImageAspectFlags aspectMask = texture->GetAspectMask();
+    VkImageAspectFlags copyAspect = (aspectMask & VK_IMAGE_ASPECT_DEPTH_BIT) != 0 ? VK_IMAGE_ASPECT_DEPTH_BIT : aspectMask;
+
+    bool rewritesSubresource = false;
+    for (uint32_t i = 0; i < regionCount; i++)
+    {
+        const TextureUploadRegion& region = regions[i];
+        StreamingCopy(staging.MappedPointer + copies[i].bufferOffset, region.Data, sizes[i]);
+
+        VkBufferImageCopy& copy = copies[i];
+        copy.bufferOffset += staging.Offset;
+        copy.bufferRowLength = 0;
+        copy.bufferImageHeight = 0;
+        copy.imageSubresource.aspectMask = copyAspect;
+        copy.imageSubresource.mipLevel = region.MipLevel;
+        copy.imageSubresource.baseArrayLayer = region.ArrayLayer;
+        copy.imageSubresource.layerCount = 1;
+        copy.imageOffset.x = static_cast<int32_t>(region.X);
+        copy.imageOffset.y = static_cast<int32_t>(region.Y);
+        copy.imageOffset.z = static_cast<int32_t>(region.Z);
+        copy.imageExtent.width = region.Width;
+        copy.imageExtent.height = region.Height;
+        copy.imageExtent.depth = region.Depth;
+
+        rewritesSubresource |= texture->GetImageLayout(region.MipLevel, region.ArrayLayer) == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        texture->TransitionImageLayout(cb, region.MipLevel, 1, region.ArrayLayer, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        if (useTransferQueue)
+        {
+            VkImageMemoryBarrier release = {};
+            release.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            release.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            release.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            release.srcQueueFamilyIndex = _transferQueueIndex;
+            release.dstQueueFamilyIndex = _graphicsQueueIndex;
+            release.image = texture->GetOptimalImage();
+            release.subresourceRange.aspectMask = aspectMask;
+            release.subresourceRange.baseMipLevel = region.MipLevel;
+            release.subresourceRange.levelCount = 1;
+            release.subresourceRange.baseArrayLayer = region.ArrayLayer;
+            release.subresourceRange.layerCount = 1;
+            batch.ImageReleases.push_back(release);
+        }
+    }
+
+    // An earlier upload in this batch may have written the same texels.
+    if (rewritesSubresource)
+    {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    vkCmdCopyBufferToImage(
+        cb,
+        staging.Buffer,
+        texture->GetOptimalImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        regionCount,
+        copies.data());
+
+    _pendingUploadBytes += totalSize;
+    if (_pendingUploadBytes >= MaxPendingUploadBytes)
+    {
+        FlushUploads();
+    }
+    _uploadLock.unlock();
 
-VdResult GraphicsDevice::UnmapBuffer(DeviceBuffer* buffer)
-{
     return VdResult::Success;
 }
 
-VdResult GraphicsDevice::MapTexture(Texture* texture, MapMode mode, uint32_t subresource, MappedResource* mappedResource)
+VdResult GraphicsDevice::LoadTextures(
+    uint32_t count,
+    const char* const* paths,
+    TextureUsage usage,
+    Texture** textures,
+    VdResult* results)
+{
+    // Staging textures have no image to upload to.
+    if (!HasFlag(usage, TextureUsage::Sampled) || HasFlag(usage, TextureUsage::Staging))
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            textures[i] = nullptr;
+            if (results != nullptr)
+            {
+                results[i] = VdResult::InvalidOperation;
+            }
+        }
+        return VdResult::InvalidOperation;
+    }
+
+    // Mapping and parsing is independent per file, so it is spread over worker threads. Creating the
+    // textures and recording the uploads stays on this thread.
+    std::vector<TextureFile*> files(count, nullptr);
+    std::vector<VdResult> fileResults(count);
+    std::atomic<uint32_t> nextFile { 0 };
+    auto openFiles = [&]()
+    {
+        for (uint32_t i = nextFile++; i < count; i = nextFile++)
+        {
+            fileResults[i] = TextureFile::Open(paths[i], _physicalDeviceProperties.limits, &files[i]);
+        }
+    };
+    uint32_t threadCount = std::min(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        workers.push_back(std::thread(openFiles));
+    }
+    openFiles();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    VdResult result = VdResult::Success;
+    std::vector<TextureUploadRegion> regions;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        textures[i] = nullptr;
+        TextureFile* file = files[i];
+        if (fileResults[i] == VdResult::Success)
+        {
+            Texture* texture = _factory->CreateTexture(file->GetDescription(usage));
+            regions.clear();
+            for (uint32_t layer = 0; layer < file->GetLayerCount(); layer++)
+            {
+                for (uint32_t level = 0; level < file->GetMipLevels(); level++)
+                {
+                    TextureUploadRegion region = {};
+                    region.Data = file->GetSubresourceData(level, layer);
+                    file->GetMipDimensions(level, &region.Width, &region.Height, &region.Depth);
+                    region.MipLevel = level;
+                    region.ArrayLayer = layer;
+                    regions.push_back(region);
+                }
+            }
+            // Every subresource is copied out of the mapping here, so the file can be closed right away.
+            fileResults[i] = UpdateTextureRegions(texture, static_cast<uint32_t>(regions.size()), regions.data());
+            textures[i] = texture;
+            delete file;
+        }
+
+        if (results != nullptr)
+        {
+            results[i] = fileResults[i];
+        }
+        if (fileResults[i] != VdResult::Success && result == VdResult::Success)
+        {
+            result = fileResults[i];
+        }
+    }
+
+    FlushUploads();
+    return result;
+}
+
+VdResult GraphicsDevice::SubmitCommands(CommandList* cl, Fence* fence)
+{
+    if (cl->IsSecondary())
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    FlushUploads();
+    uint64_t serial = SubmitCommandBuffer(
+        cl,
+        cl->GetVkCommandBuffer(),
+        0, nullptr,
+        0, nullptr,
+        fence);
+    // The buffer versions stay pending, and so busy, until they are marked with a serial that exists and can
+    // be waited for.
+    cl->MarkBufferVersionsUsed(serial);
+    cl->CommandBufferSubmitted();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::FlushUploads()
+{
+    _uploadLock.lock();
+    // Transfer-queue uploads are acquired first, so graphics-queue uploads to the same resources land after them.
+    if (_transferUploads.CommandBuffer != VK_NULL_HANDLE)
+    {
+        SubmitTransferUploads();
+    }
+
+    if (_graphicsUploads.CommandBuffer != VK_NULL_HANDLE)
+    {
+        RecordPendingBufferCopies(_graphicsUploads);
+
+        VkCommandBuffer cb = _graphicsUploads.CommandBuffer;
+        RegisterSubmittedUploads(cb);
+        _graphicsUploads.Pool->EndAndSubmit(cb);
+
+        _graphicsUploads.Pool = nullptr;
+        _graphicsUploads.CommandBuffer = VK_NULL_HANDLE;
+    }
+
+    _pendingUploadBytes = 0;
+    _uploadLock.unlock();
+
+    return VdResult::Success;
+}
+
+void GraphicsDevice::SubmitTransferUploads()
+{
+    UploadBatch& batch = _transferUploads;
+    RecordPendingBufferCopies(batch);
+
+    vkCmdPipelineBarrier(
+        batch.CommandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0,
+        0, nullptr,
+        static_cast<uint32_t>(batch.BufferReleases.size()), batch.BufferReleases.data(),
+        static_cast<uint32_t>(batch.ImageReleases.size()), batch.ImageReleases.data());
+    CheckResult(vkEndCommandBuffer(batch.CommandBuffer));
+
+    VkSemaphore semaphore = GetFreeSemaphore();
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &batch.CommandBuffer;
+    si.signalSemaphoreCount = 1;
+    si.pSignalSemaphores = &semaphore;
+    _transferQueueLock.lock();
+    CheckResult(vkQueueSubmit(_transferQueue, 1, &si, VK_NULL_HANDLE));
+    _transferQueueLock.unlock();
+
+    // The matching acquire barriers run on the graphics queue, ahead of anything submitted after this point.
+    for (VkBufferMemoryBarrier& barrier : batch.BufferReleases)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    for (VkImageMemoryBarrier& barrier : batch.ImageReleases)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    SharedCommandPool* acquirePool = GetFreeCommandPool();
+    VkCommandBuffer acquireCB = acquirePool->BeginNewCommandBuffer();
+    vkCmdPipelineBarrier(
+        acquireCB,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0, nullptr,
+        static_cast<uint32_t>(batch.BufferReleases.size()), batch.BufferReleases.data(),
+        static_cast<uint32_t>(batch.ImageReleases.size()), batch.ImageReleases.data());
+
+    // The transfer submission has no fence; it is known to be complete once the acquire is.
+    TransferHandoff handoff;
+    handoff.Pool = batch.Pool;
+    handoff.CommandBuffer = batch.CommandBuffer;
+    handoff.Semaphore = semaphore;
+    _stagingResourcesLock.lock();
+    _submittedTransferHandoffs[acquireCB] = handoff;
+    _stagingResourcesLock.unlock();
+    if (_graphicsUploads.CommandBuffer == VK_NULL_HANDLE)
+    {
+        RegisterSubmittedUploads(acquireCB);
+    }
+    acquirePool->EndAndSubmit(acquireCB, semaphore);
+
+    batch.Pool = nullptr;
+    batch.CommandBuffer = VK_NULL_HANDLE;
+    batch.BufferReleases.clear();
+    batch.ImageReleases.clear();
+}
+
+// Ties the texture stream levels queued since the last flush to cb, the last command buffer of the flush.
+void GraphicsDevice::RegisterSubmittedUploads(VkCommandBuffer cb)
+{
+    if (_uploadedStreamLevels.size() == 0)
+    {
+        return;
+    }
+
+    _stagingResourcesLock.lock();
+    std::vector<std::pair<TextureStream*, uint32_t>>& levels = _submittedStreamLevels[cb];
+    for (auto& streamLevel : _uploadedStreamLevels)
+    {
+        streamLevel.first->SetLastCommandBuffer(cb);
+        levels.push_back(streamLevel);
+    }
+    _stagingResourcesLock.unlock();
+    _uploadedStreamLevels.clear();
+}
+
+VdResult GraphicsDevice::MapBuffer(DeviceBuffer* buffer, MapMode mode, MappedResource* mappedResource)
+{
+    if (buffer->IsHostImported())
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    mappedResource->Mode = mode;
+    // Write-only maps of Dynamic buffers discard the previous contents, as with D3D11's MAP_WRITE_DISCARD.
+    if (mode == MapMode::Write && buffer->IsVersioned())
+    {
+        buffer->Discard();
+    }
+
+    MemoryBlock memoryBlock = buffer->GetMemory();
+    mappedResource->SizeInBytes = buffer->GetSizeInBytes();
+    mappedResource->Data = memoryBlock.BlockMappedPointer();
+    if (mode != MapMode::Write)
+    {
+        InvalidateMappedMemory(memoryBlock, 0, buffer->GetSizeInBytes());
+    }
+
+    return VdResult::Success;
+}
+
+// The map mode is not known here, so read-only mappings are flushed as well; that is harmless.
+VdResult GraphicsDevice::UnmapBuffer(DeviceBuffer* buffer)
+{
+    FlushMappedMemory(buffer->GetMemory(), 0, buffer->GetSizeInBytes());
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::MapTexture(Texture* texture, MapMode mode, uint32_t subresource, MappedResource* mappedResource)
 {
     mappedResource->Mode = mode;
     mappedResource->Subresource = subresource;
@@ -452,33 +1315,60 @@ VdResult GraphicsDevice::MapTexture(Texture* texture, MapMode mode, uint32_t sub
     mappedResource->RowPitch = static_cast<uint32_t>(layout.rowPitch);
     mappedResource->DepthPitch = static_cast<uint32_t>(layout.depthPitch);
     mappedResource->Data = (memoryBlock.BlockMappedPointer() + layout.offset);
+    if (mode != MapMode::Write)
+    {
+        InvalidateMappedMemory(memoryBlock, layout.offset, layout.size);
+    }
 
     return VdResult::Success;
 }
 
 VdResult GraphicsDevice::UnmapTexture(Texture * texture, uint32_t subresource)
 {
+    VkSubresourceLayout layout = texture->GetSubresourceLayout(subresource);
+    FlushMappedMemory(texture->GetMemory(), layout.offset, layout.size);
     return VdResult::Success;
 }
 
-GraphicsDevice::SharedCommandPool* GraphicsDevice::GetFreeCommandPool()
+GraphicsDevice::SharedCommandPool* GraphicsDevice::GetFreeCommandPool(bool transfer)
 {
     _stagingResourcesLock.lock();
+    std::vector<SharedCommandPool*>& availablePools = transfer ? _availableTransferCommandPools : _availableSharedCommandPools;
     GraphicsDevice::SharedCommandPool* result;
-    if (_availableSharedCommandPools.size() > 0)
+    if (availablePools.size() > 0)
     {
-        result = _availableSharedCommandPools[_availableSharedCommandPools.size() - 1];
-        _availableSharedCommandPools.pop_back();
+        result = availablePools[availablePools.size() - 1];
+        availablePools.pop_back();
     }
     else
     {
-        result = new GraphicsDevice::SharedCommandPool(this, true);
+        result = new GraphicsDevice::SharedCommandPool(this, true, transfer ? _transferQueueIndex : _graphicsQueueIndex);
     }
     _stagingResourcesLock.unlock();
 
     return result;
 }
 
+VkSemaphore GraphicsDevice::GetFreeSemaphore()
+{
+    _stagingResourcesLock.lock();
+    if (_availableSemaphores.size() > 0)
+    {
+        VkSemaphore semaphore = _availableSemaphores.back();
+        _availableSemaphores.pop_back();
+        _stagingResourcesLock.unlock();
+        return semaphore;
+    }
+    _stagingResourcesLock.unlock();
+
+    VkSemaphore ret;
+    VkSemaphoreCreateInfo semaphoreCI = {};
+    semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    CheckResult(vkCreateSemaphore(_device, &semaphoreCI, nullptr, &ret));
+
+    return ret;
+}
+
 VkFence GraphicsDevice::GetFreeSubmissionFence()
 {
     _submissionFencesLock.lock();
@@ -501,14 +1391,15 @@ VkFence GraphicsDevice::GetFreeSubmissionFence()
     return ret;
 }
 
-void GraphicsDevice::SubmitCommandBuffer(
+uint64_t GraphicsDevice::SubmitCommandBuffer(
     CommandList* commandList,
     VkCommandBuffer vkCB,
     uint32_t waitSemaphoreCount,
     VkSemaphore* waitSemaphoresPtr,
     uint32_t signalSemaphoreCount,
     VkSemaphore* signalSemaphoresPtr,
-    Fence* fence)
+    Fence* fence,
+    VkPipelineStageFlags waitDstStageMask)
 {
     CheckSubmittedFences();
 
@@ -518,7 +1409,6 @@ void GraphicsDevice::SubmitCommandBuffer(
     si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     si.commandBufferCount = 1;
     si.pCommandBuffers = &vkCB;
-    VkPipelineStageFlags waitDstStageMask = VkPipelineStageFlagBits::VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     si.pWaitDstStageMask = &waitDstStageMask;
 
     si.pWaitSemaphores = waitSemaphoresPtr;
@@ -541,7 +1431,10 @@ void GraphicsDevice::SubmitCommandBuffer(
 
     _graphicsQueueLock.lock();
     vkQueueSubmit(_graphicsQueue, 1, &si, vkFence);
-    _submittedFences[submissionFence] = std::tuple<CommandList*, VkCommandBuffer>(commandList, vkCB);
+    _submittedFencesLock.lock();
+    uint64_t serial = ++_submissionSerial;
+    _submittedFences[submissionFence] = std::tuple<CommandList*, VkCommandBuffer, uint64_t>(commandList, vkCB, serial);
+    _submittedFencesLock.unlock();
 
     if (useExtraFence)
     {
@@ -549,6 +1442,7 @@ void GraphicsDevice::SubmitCommandBuffer(
     }
 
     _graphicsQueueLock.unlock();
+    return serial;
 }
 
 void GraphicsDevice::CheckSubmittedFences()
@@ -581,27 +1475,41 @@ void GraphicsDevice::CheckSubmittedFences()
             _availableSubmissionFences.push_back(fence);
             _stagingResourcesLock.lock();
             {
-                auto texI = _submittedStagingTextures.find(completedCB);
-                if (texI != _submittedStagingTextures.end())
+                // Must run before the pool below is recycled and its command buffer tags new ring space.
+                _stagingRing->Release(completedCB);
+
+                auto levelsI = _submittedStreamLevels.find(completedCB);
+                if (levelsI != _submittedStreamLevels.end())
                 {
-                    _availableStagingTextures.push_back(texI->second);
-                    _submittedStagingTextures.erase(texI);
+                    for (auto& streamLevel : levelsI->second)
+                    {
+                        streamLevel.first->LevelCompleted(streamLevel.second);
+                    }
+                    _submittedStreamLevels.erase(levelsI);
                 }
 
-                auto bufferI = _submittedStagingBuffers.find(completedCB);
-                if (bufferI != _submittedStagingBuffers.end())
+                auto readbackI = _submittedReadbacks.find(completedCB);
+                if (readbackI != _submittedReadbacks.end())
                 {
-                    auto stagingBuffer = bufferI->second;
-                    if (stagingBuffer->GetSizeInBytes() <= MaxStagingBufferSize)
+                    if (readbackI->second->IsDisposed())
                     {
-                        _availableStagingBuffers.push_back(stagingBuffer);
+                        delete readbackI->second;
                     }
                     else
                     {
-                        delete stagingBuffer;
+                        readbackI->second->Completed();
                     }
+                    _submittedReadbacks.erase(readbackI);
+                }
 
-                    _submittedStagingBuffers.erase(bufferI);
+                auto handoffI = _submittedTransferHandoffs.find(completedCB);
+                if (handoffI != _submittedTransferHandoffs.end())
+                {
+                    TransferHandoff& handoff = handoffI->second;
+                    _stagingRing->Release(handoff.CommandBuffer);
+                    _availableTransferCommandPools.push_back(handoff.Pool);
+                    _availableSemaphores.push_back(handoff.Semaphore);
+                    _submittedTransferHandoffs.erase(handoffI);
                 }
 
                 auto commandPoolI = _submittedSharedCommandPools.find(completedCB);
@@ -623,166 +1531,1039 @@ void GraphicsDevice::CheckSubmittedFences()
 
                     _submittedSharedCommandPools.erase(commandPoolI);
                 }
+
+                auto retiredI = _submittedRetiredResources.find(completedCB);
+                if (retiredI != _submittedRetiredResources.end())
+                {
+                    DestroyRetiredResources(retiredI->second);
+                    _submittedRetiredResources.erase(retiredI);
+                }
             }
             _stagingResourcesLock.unlock();
 
             if (completedCL != nullptr)
             {
-                _commandListsToDisposeLock.lock();
-                {
-                    if (completedCL->GetSubmissionCount() == 0)
-                    {
-                        if (_commandListsToDispose.erase(completedCL) != 0)
-                        {
-                            delete completedCL;
-                        }
-                    }
-                }
-                _commandListsToDisposeLock.unlock();
+                DestroyIfDisposed(completedCL);
             }
         }
 
         _completedFences.clear();
-    }
-    _submittedFencesLock.unlock();
-}
 
-DeviceBuffer* GraphicsDevice::GetFreeStagingBuffer(uint32_t size)
-{
-    _stagingResourcesLock.lock();
-    for (uint32_t i = 0; i < _availableStagingBuffers.size(); i++)
-    {
-        DeviceBuffer* buffer = _availableStagingBuffers[i];
-        if (buffer->GetSizeInBytes() >= size)
+        // Fences on one queue signal in submission order, but each was polled separately above, so a later
+        // one may have been seen signaled before an earlier one. Only count up to the oldest still outstanding.
+        uint64_t completedSerial = _submissionSerial;
+        for (auto& kvp : _submittedFences)
         {
-            _availableStagingBuffers.erase(_availableStagingBuffers.begin() + i);
-            _stagingResourcesLock.unlock();
-            return buffer;
+            completedSerial = std::min(completedSerial, std::get<2>(kvp.second) - 1);
         }
+        _completedSerial = completedSerial;
     }
-    _stagingResourcesLock.unlock();
+    _submittedFencesLock.unlock();
+}
 
-    uint32_t newBufferSize = std::max(MinStagingBufferSize, size);
-    DeviceBuffer* newBuffer = _factory->CreateBuffer(
-        BufferDescription(newBufferSize, BufferUsage::Staging));
-    return newBuffer;
+uint64_t GraphicsDevice::PollCompletedSubmissionSerial()
+{
+    CheckSubmittedFences();
+    return _completedSerial;
 }
 
-Texture* GraphicsDevice::GetFreeStagingTexture(uint32_t width, uint32_t height, uint32_t depth, PixelFormat format)
+void GraphicsDevice::WaitForSubmissionSerial(uint64_t serial)
 {
-    uint32_t pixelSize = GetSizeInBytes(format);
-    uint32_t totalSize = width * height * depth * pixelSize;
-    _stagingResourcesLock.lock();
-    for (int i = 0; i < _availableStagingTextures.size(); i++)
+    if (serial <= _completedSerial)
     {
-        Texture* tex = _availableStagingTextures[i];
-        if (tex->GetMemory().Size >= totalSize)
-        {
-            _availableStagingTextures.erase(_availableStagingTextures.begin() + i);
-            tex->SetStagingDimensions(width, height, depth, format);
-            _stagingResourcesLock.unlock();
-            return tex;
-        }
+        return;
     }
-    _stagingResourcesLock.unlock();
 
-    uint32_t texWidth = std::max(256u, width);
-    uint32_t texHeight = std::max(256u, height);
-    Texture* newTex = _factory->CreateTexture(
-        TextureDescription::Texture3D(texWidth, texHeight, depth, 1, format, TextureUsage::Staging));
-    newTex->SetStagingDimensions(width, height, depth, format);
+    while (serial > _completedSerial)
+    {
+        // Fences on one queue signal in submission order, so the newest one up to the serial covers it.
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t fenceSerial = 0;
+        _submittedFencesLock.lock();
+        if (serial > _submissionSerial)
+        {
+            VdFail("Serial has not been submitted.");
+            _submittedFencesLock.unlock();
+            return;
+        }
+        for (auto& kvp : _submittedFences)
+        {
+            uint64_t submissionSerial = std::get<2>(kvp.second);
+            if (submissionSerial <= serial && submissionSerial > fenceSerial)
+            {
+                fence = kvp.first;
+                fenceSerial = submissionSerial;
+            }
+        }
+        _submittedFencesLock.unlock();
 
-    return newTex;
+        // Wait without the lock, so that submissions aren't held up. Another thread may complete and recycle
+        // the fence meanwhile, so the wait is bounded and the serial checked again.
+        if (fence != VK_NULL_HANDLE)
+        {
+            VkResult result = vkWaitForFences(_device, 1, &fence, true, SubmissionFenceWaitTimeout);
+            if (result != VK_TIMEOUT)
+            {
+                CheckResult(result);
+            }
+        }
+        CheckSubmittedFences();
+    }
 }
 
 VdResult GraphicsDevice::WaitForIdle()
 {
+    FlushUploads();
     _graphicsQueueLock.lock();
     CheckResult(vkQueueWaitIdle(_graphicsQueue));
     _graphicsQueueLock.unlock();
+    CheckSubmittedFences();
 
     return VdResult::Success;
 }
 
-void GraphicsDevice::ClearColorTexture(Texture * texture, VkClearColorValue color)
+VdResult GraphicsDevice::GetMemoryTypeStatistics(uint32_t* count, MemoryTypeStatistics* stats)
 {
-    VkImageSubresourceRange range;
-    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    range.baseMipLevel = 0;
-    range.levelCount = texture->GetMipLevels();
-    range.baseArrayLayer = 0;
-    range.layerCount = texture->GetArrayLayers();
-    SharedCommandPool* pool = GetFreeCommandPool();
-    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
-    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkCmdClearColorImage(cb, texture->GetOptimalImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
-    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    pool->EndAndSubmit(cb);
-}
+    if (stats == nullptr)
+    {
+        *count = _physicalDeviceMemProperties.memoryTypeCount;
+        return VdResult::Success;
+    }
 
-void GraphicsDevice::ClearDepthTexture(Texture * texture, VkClearDepthStencilValue clearValue)
-{
-    VkImageSubresourceRange range;
-    range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    range.baseMipLevel = 0;
-    range.levelCount = texture->GetMipLevels();
-    range.baseArrayLayer = 0;
-    range.layerCount = texture->GetArrayLayers();
-    SharedCommandPool* pool = GetFreeCommandPool();
-    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
-    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    vkCmdClearDepthStencilImage(
-        cb,
-        texture->GetOptimalImage(),
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        &clearValue,
-        1,
-        &range);
-    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-    pool->EndAndSubmit(cb);
-}
+    uint32_t memoryTypeCount = _physicalDeviceMemProperties.memoryTypeCount;
+    std::vector<MemoryTypeStatistics> allStats(memoryTypeCount);
+    _memoryManager.GetStatistics(memoryTypeCount, allStats.data());
+    for (uint32_t i = 0; i < memoryTypeCount; i++)
+    {
+        allStats[i].HeapIndex = _physicalDeviceMemProperties.memoryTypes[i].heapIndex;
+        allStats[i].PropertyFlags = _physicalDeviceMemProperties.memoryTypes[i].propertyFlags;
+    }
 
-void GraphicsDevice::EnqueueDisposedCommandBuffer(CommandList* cl)
-{
-    _commandListsToDisposeLock.lock();
-    _commandListsToDispose.insert(cl);
-    _commandListsToDisposeLock.unlock();
+    *count = std::min(*count, memoryTypeCount);
+    memcpy(stats, allStats.data(), sizeof(MemoryTypeStatistics) * *count);
+    return VdResult::Success;
 }
 
-VD_EXPORT VdResult VdGraphicsDevice_CreateVulkan(
-    GraphicsDeviceOptions* options,
-    GraphicsDeviceCallbacks* callbacks,
-    GraphicsDevice** graphicsDevice)
+VdResult GraphicsDevice::GetMemoryHeapStatistics(uint32_t* count, MemoryHeapStatistics* stats)
 {
-    GraphicsDevice* gd = new GraphicsDevice();
-    auto result = gd->Init(*options, *callbacks);
-    if (result == VdResult::Success)
+    uint32_t heapCount = _physicalDeviceMemProperties.memoryHeapCount;
+    if (stats == nullptr)
     {
-        *graphicsDevice = gd;
+        *count = heapCount;
+        return VdResult::Success;
     }
 
-    return result;
-}
+    uint32_t memoryTypeCount = _physicalDeviceMemProperties.memoryTypeCount;
+    std::vector<MemoryTypeStatistics> typeStats(memoryTypeCount);
+    _memoryManager.GetStatistics(memoryTypeCount, typeStats.data());
 
-VD_EXPORT ResourceFactory* VdGraphicsDevice_GetResourceFactory(GraphicsDevice* gd)
-{
-    return gd->GetResourceFactory();
-}
+    std::vector<MemoryHeapStatistics> allStats(heapCount);
+    for (uint32_t i = 0; i < heapCount; i++)
+    {
+        allStats[i] = {};
+        allStats[i].Size = _physicalDeviceMemProperties.memoryHeaps[i].size;
+        allStats[i].Flags = _physicalDeviceMemProperties.memoryHeaps[i].flags;
+    }
 
-VD_EXPORT VdResult VdGraphicsDevice_SwapBuffers(GraphicsDevice* gd, Swapchain* sc)
-{
-    return gd->SwapBuffers(*sc);
-}
+    for (uint32_t i = 0; i < memoryTypeCount; i++)
+    {
+        MemoryHeapStatistics& heap = allStats[_physicalDeviceMemProperties.memoryTypes[i].heapIndex];
+        const MemoryTypeStatistics& type = typeStats[i];
+        heap.DeviceMemoryBytes += type.ChunkBytes + type.DedicatedBytes;
+        heap.AllocatedBytes += type.ChunkAllocatedBytes - type.SlabBytes + type.SlabAllocatedBytes + type.DedicatedBytes;
+    }
 
-VD_EXPORT VdResult VdGraphicsDevice_UpdateBuffer(
-    GraphicsDevice* gd,
-    DeviceBuffer* buffer,
-    uint32_t bufferOffsetInBytes,
-    void* source,
-    uint32_t sizeInBytes)
-{
-    return gd->UpdateBuffer(buffer, bufferOffsetInBytes, source, sizeInBytes);
-}
+    for (uint32_t i = 0; i < heapCount; i++)
+    {
+        allStats[i].Budget = allStats[i].Size;
+        allStats[i].Usage = allStats[i].DeviceMemoryBytes;
+    }
+
+#ifdef VK_EXT_memory_budget
+    if (_memoryBudgetEnabled)
+    {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2KHR memProperties2 = {};
+        memProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        memProperties2.pNext = &budgetProperties;
+        _getPhysicalDeviceMemoryProperties2(_physicalDevice, &memProperties2);
+
+        for (uint32_t i = 0; i < heapCount; i++)
+        {
+            allStats[i].BudgetIsDriverReported = true;
+            allStats[i].Budget = budgetProperties.heapBudget[i];
+            allStats[i].Usage = budgetProperties.heapUsage[i];
+        }
+    }
+#endif
+
+    *count = std::min(*count, heapCount);
+    memcpy(stats, allStats.data(), sizeof(MemoryHeapStatistics) * *count);
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::GetMemoryReport(uint32_t* size, char* json)
+{
+    uint32_t heapCount;
+    GetMemoryHeapStatistics(&heapCount, nullptr);
+    std::vector<MemoryHeapStatistics> heaps(heapCount);
+    GetMemoryHeapStatistics(&heapCount, heaps.data());
+
+    std::ostringstream report;
+    report << "{\"heaps\":[";
+    for (uint32_t i = 0; i < heapCount; i++)
+    {
+        if (i != 0)
+        {
+            report << ",";
+        }
+        report << "{\"index\":" << i
+            << ",\"size\":" << heaps[i].Size
+            << ",\"budget\":" << heaps[i].Budget
+            << ",\"usage\":" << heaps[i].Usage
+            << ",\"budgetIsDriverReported\":" << (heaps[i].BudgetIsDriverReported ? "true" : "false")
+            << ",\"deviceMemoryBytes\":" << heaps[i].DeviceMemoryBytes
+            << ",\"allocatedBytes\":" << heaps[i].AllocatedBytes << "}";
+    }
+    report << "],\"allocator\":";
+    _memoryManager.WriteJson(report);
+    report << "}";
+
+    // Like the other count-then-fill getters: a null buffer queries the required size, including the terminator.
+    std::string text = report.str();
+    if (json == nullptr)
+    {
+        *size = static_cast<uint32_t>(text.size() + 1);
+        return VdResult::Success;
+    }
+
+    if (*size == 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t copySize = std::min(*size - 1, static_cast<uint32_t>(text.size()));
+    memcpy(json, text.data(), copySize);
+    json[copySize] = '\0';
+    *size = copySize + 1;
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::TrimMemory()
+{
+    _memoryManager.Trim();
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::SetMemoryTrimPolicy(uint32_t frameDelay, uint64_t maxEmptyBytes)
+{
+    _memoryManager.SetTrimPolicy(frameDelay, maxEmptyBytes);
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::DefragmentMemory(uint64_t maxBytesMoved, uint64_t* bytesMoved)
+{
+    *bytesMoved = 0;
+    // Queued copies refer to the current buffer handles.
+    FlushUploads();
+    _memoryManager.SelectDefragmentationSources();
+
+    // Taken before _registeredResourcesLock; CheckSubmittedFences holds the staging lock while
+    // destroying resources.
+    SharedCommandPool* pool = GetFreeCommandPool();
+
+    _registeredResourcesLock.lock();
+    uint64_t budget = maxBytesMoved;
+    std::vector<DeviceBuffer*> buffers;
+    for (DeviceBuffer* buffer : _registeredBuffers)
+    {
+        MemoryBlock memory = buffer->GetMemory();
+        if (memory.Size <= budget && _memoryManager.IsDefragmentationSource(memory))
+        {
+            buffers.push_back(buffer);
+            budget -= memory.Size;
+        }
+    }
+    std::vector<Texture*> textures;
+    for (Texture* texture : _registeredTextures)
+    {
+        const MemoryBlock& memory = texture->GetMemory();
+        if (memory.Size <= budget && texture->IsRelocatable() && _memoryManager.IsDefragmentationSource(memory))
+        {
+            textures.push_back(texture);
+            budget -= memory.Size;
+        }
+    }
+
+    if (buffers.size() == 0 && textures.size() == 0)
+    {
+        _registeredResourcesLock.unlock();
+        _stagingResourcesLock.lock();
+        _availableSharedCommandPools.push_back(pool);
+        _stagingResourcesLock.unlock();
+        return VdResult::Success;
+    }
+
+    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
+
+    // Everything submitted earlier may still be using the old resources.
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    RetiredResources retired;
+    std::unordered_set<void*> relocated;
+    for (DeviceBuffer* buffer : buffers)
+    {
+        VkBuffer oldBuffer;
+        MemoryBlock oldMemory;
+        if (buffer->Relocate(cb, &oldBuffer, &oldMemory))
+        {
+            retired.Buffers.push_back(oldBuffer);
+            retired.MemoryBlocks.push_back(oldMemory);
+            relocated.insert(buffer);
+            *bytesMoved += oldMemory.Size;
+        }
+    }
+    for (Texture* texture : textures)
+    {
+        VkImage oldImage;
+        MemoryBlock oldMemory;
+        if (texture->Relocate(cb, &oldImage, &oldMemory))
+        {
+            retired.Images.push_back(oldImage);
+            retired.MemoryBlocks.push_back(oldMemory);
+            relocated.insert(texture);
+            *bytesMoved += oldMemory.Size;
+        }
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    for (TextureView* view : _registeredTextureViews)
+    {
+        if (relocated.count(view->GetTarget()) != 0)
+        {
+            retired.ImageViews.push_back(view->Recreate());
+            relocated.insert(view);
+        }
+    }
+    for (ResourceSet* set : _registeredResourceSets)
+    {
+        if (set->References(relocated))
+        {
+            std::vector<DescriptorAllocationToken> oldSets;
+            set->Rewrite(relocated, &oldSets);
+            for (const DescriptorAllocationToken& oldSet : oldSets)
+            {
+                retired.DescriptorSets.push_back(std::make_pair(oldSet, set->GetDescriptorCounts()));
+            }
+        }
+    }
+    _registeredResourcesLock.unlock();
+
+    pool->EndAndSubmit(cb);
+    _stagingResourcesLock.lock();
+    _submittedRetiredResources.emplace(cb, retired);
+    _stagingResourcesLock.unlock();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::StreamTexture(Texture* texture, const void* source, TextureStream** stream)
+{
+    TextureStream* newStream = new TextureStream(this, texture, source);
+    // Views created from now on only show the smallest level, until more have landed.
+    texture->SetMinResidentMipLevel(texture->GetMipLevels() - 1);
+
+    _textureStreamsLock.lock();
+    _textureStreams.push_back(newStream);
+    // The mip tail is cheap, and makes the texture usable as soon as this upload batch completes.
+    do
+    {
+        QueueTextureStreamLevel(newStream);
+    } while (newStream->HasPendingLevels() && newStream->GetNextLevelSize() <= MipTailSize);
+    _textureStreamsLock.unlock();
+
+    *stream = newStream;
+    return VdResult::Success;
+}
+
+void GraphicsDevice::QueueTextureStreamLevel(TextureStream* stream)
+{
+    _uploadLock.lock();
+    uint32_t mipLevel = stream->QueueNextLevel();
+    _uploadedStreamLevels.push_back(std::make_pair(stream, mipLevel));
+    _uploadLock.unlock();
+}
+
+VdResult GraphicsDevice::ProcessTextureStreams()
+{
+    _textureStreamsLock.lock();
+    // Always take the cheapest pending level across all streams, so that every texture gets some detail
+    // before any gets its largest levels.
+    VkDeviceSize budget = _textureStreamingBudget;
+    bool queuedAny = false;
+    while (true)
+    {
+        TextureStream* next = nullptr;
+        for (TextureStream* stream : _textureStreams)
+        {
+            if (stream->HasPendingLevels()
+                && (next == nullptr || stream->GetNextLevelSize() < next->GetNextLevelSize()))
+            {
+                next = stream;
+            }
+        }
+
+        if (next == nullptr)
+        {
+            break;
+        }
+
+        // A level larger than the whole budget still goes through, on its own.
+        VkDeviceSize size = next->GetNextLevelSize();
+        if (size > budget && queuedAny)
+        {
+            break;
+        }
+
+        QueueTextureStreamLevel(next);
+        budget -= std::min(size, budget);
+        queuedAny = true;
+    }
+
+    if (queuedAny)
+    {
+        FlushUploads();
+    }
+
+    UpdateTextureStreamViews();
+    _textureStreamsLock.unlock();
+
+    return VdResult::Success;
+}
+
+void GraphicsDevice::UpdateTextureStreamViews()
+{
+    std::unordered_set<Texture*> streamedTextures;
+    for (uint32_t i = 0; i < _textureStreams.size();)
+    {
+        TextureStream* stream = _textureStreams[i];
+        if (stream->IsDisposed())
+        {
+            if (!stream->IsInFlight())
+            {
+                delete stream;
+                _textureStreams.erase(_textureStreams.begin() + i);
+                continue;
+            }
+        }
+        else
+        {
+            Texture* texture = stream->GetTarget();
+            texture->SetMinResidentMipLevel(std::min(stream->GetResidentMipLevel(), texture->GetMipLevels() - 1));
+            streamedTextures.insert(texture);
+        }
+
+        i++;
+    }
+
+    if (streamedTextures.size() == 0)
+    {
+        return;
+    }
+
+    RetiredResources retired;
+    std::unordered_set<void*> changed;
+    _registeredResourcesLock.lock();
+    for (TextureView* view : _registeredTextureViews)
+    {
+        Texture* target = view->GetTarget();
+        if (streamedTextures.count(target) != 0 && view->GetMinResidentMipLevel() != target->GetMinResidentMipLevel())
+        {
+            retired.ImageViews.push_back(view->Recreate());
+            changed.insert(view);
+        }
+    }
+    if (changed.size() > 0)
+    {
+        for (ResourceSet* set : _registeredResourceSets)
+        {
+            if (set->References(changed))
+            {
+                std::vector<DescriptorAllocationToken> oldSets;
+                set->Rewrite(changed, &oldSets);
+                for (const DescriptorAllocationToken& oldSet : oldSets)
+                {
+                    retired.DescriptorSets.push_back(std::make_pair(oldSet, set->GetDescriptorCounts()));
+                }
+            }
+        }
+    }
+    _registeredResourcesLock.unlock();
+
+    if (retired.ImageViews.size() > 0)
+    {
+        RetireResources(retired);
+    }
+}
+
+// Destroys the resources once everything submitted so far has completed.
+void GraphicsDevice::RetireResources(RetiredResources& retired)
+{
+    SharedCommandPool* pool = GetFreeCommandPool();
+    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
+    _stagingResourcesLock.lock();
+    _submittedRetiredResources[cb] = retired;
+    _stagingResourcesLock.unlock();
+    pool->EndAndSubmit(cb);
+}
+
+VdResult GraphicsDevice::SetTextureStreamingBudget(uint64_t bytesPerFrame)
+{
+    _textureStreamsLock.lock();
+    _textureStreamingBudget = bytesPerFrame;
+    _textureStreamsLock.unlock();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::WaitForTextureStream(TextureStream* stream)
+{
+    _textureStreamsLock.lock();
+    while (stream->HasPendingLevels())
+    {
+        QueueTextureStreamLevel(stream);
+    }
+    FlushUploads();
+
+    // Work completes in submission order, so the command buffer holding the last level covers the rest.
+    WaitForCommandBuffer(stream->GetLastCommandBuffer());
+
+    UpdateTextureStreamViews();
+    _textureStreamsLock.unlock();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::DisposeTextureStream(TextureStream* stream)
+{
+    _textureStreamsLock.lock();
+    stream->Dispose();
+    _textureStreamsLock.unlock();
+
+    return VdResult::Success;
+}
+
+// Blocks until cb, if it is still in flight, has completed, and processes everything that completed with it.
+void GraphicsDevice::WaitForCommandBuffer(VkCommandBuffer cb)
+{
+    uint64_t serial = 0;
+    _submittedFencesLock.lock();
+    for (auto& kvp : _submittedFences)
+    {
+        if (std::get<1>(kvp.second) == cb)
+        {
+            serial = std::get<2>(kvp.second);
+        }
+    }
+    _submittedFencesLock.unlock();
+
+    if (serial != 0)
+    {
+        WaitForSubmissionSerial(serial);
+    }
+    else
+    {
+        CheckSubmittedFences();
+    }
+}
+
+VdResult GraphicsDevice::ReadbackBuffer(DeviceBuffer* buffer, uint32_t offsetInBytes, uint32_t sizeInBytes, ReadbackTicket** ticket)
+{
+    if (sizeInBytes == 0 || static_cast<uint64_t>(offsetInBytes) + sizeInBytes > buffer->GetSizeInBytes())
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    ReadbackTicket* result = new ReadbackTicket(this, sizeInBytes, sizeInBytes, sizeInBytes);
+    SharedCommandPool* pool;
+    VkCommandBuffer cb = BeginReadback(&pool);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy region = {};
+    region.srcOffset = offsetInBytes;
+    region.size = sizeInBytes;
+    vkCmdCopyBuffer(cb, buffer->GetVkBuffer(), result->GetVkBuffer(), 1, &region);
+    // The copy runs on the graphics queue, so later uploads must not assume the transfer queue owns it.
+    buffer->SetOwnedByGraphicsQueue();
+
+    SubmitReadback(pool, cb, result);
+    *ticket = result;
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::ReadbackTexture(Texture* texture, uint32_t mipLevel, uint32_t arrayLayer, ReadbackTicket** ticket)
+{
+    uint32_t layerCount = HasFlag(texture->GetUsage(), TextureUsage::Cubemap)
+        ? texture->GetArrayLayers() * 6
+        : texture->GetArrayLayers();
+    if (mipLevel >= texture->GetMipLevels() || arrayLayer >= layerCount
+        || texture->GetSampleCount() != TextureSampleCount::Count1)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t mipWidth, mipHeight, mipDepth;
+    GetMipDimensions(texture, mipLevel, &mipWidth, &mipHeight, &mipDepth);
+
+    if (HasFlag(texture->GetUsage(), TextureUsage::Staging))
+    {
+        VkSubresourceLayout layout = texture->GetSubresourceLayout(texture->CalculateSubresource(mipLevel, arrayLayer));
+        ReadbackTicket* result = new ReadbackTicket(
+            this,
+            layout.size,
+            static_cast<uint32_t>(layout.rowPitch),
+            static_cast<uint32_t>(layout.depthPitch));
+        SharedCommandPool* pool;
+        VkCommandBuffer cb = BeginReadback(&pool);
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkBufferCopy region = {};
+        region.srcOffset = layout.offset;
+        region.size = layout.size;
+        vkCmdCopyBuffer(cb, texture->GetStagingBuffer(), result->GetVkBuffer(), 1, &region);
+
+        SubmitReadback(pool, cb, result);
+        *ticket = result;
+        return VdResult::Success;
+    }
+
+    uint32_t rowPitch = GetRowPitch(mipWidth, texture->GetFormat());
+    uint32_t depthPitch = GetDepthPitch(rowPitch, mipHeight, texture->GetFormat());
+    ReadbackTicket* result = new ReadbackTicket(this, static_cast<VkDeviceSize>(depthPitch) * mipDepth, rowPitch, depthPitch);
+    SharedCommandPool* pool;
+    VkCommandBuffer cb = BeginReadback(&pool);
+
+    // The layout transitions cover every aspect of the format, but the copy reads only the depth of a
+    // depth-stencil texture.
+    VkImageAspectFlags aspectMask = texture->GetAspectMask();
+    VkImageAspectFlags copyAspect = (aspectMask & VK_IMAGE_ASPECT_DEPTH_BIT) != 0 ? VK_IMAGE_ASPECT_DEPTH_BIT : aspectMask;
+    VkImageLayout oldLayout = texture->GetImageLayout(mipLevel, arrayLayer);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture->GetOptimalImage();
+    barrier.subresourceRange.aspectMask = aspectMask;
+    barrier.subresourceRange.baseMipLevel = mipLevel;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = arrayLayer;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = copyAspect;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = arrayLayer;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { mipWidth, mipHeight, mipDepth };
+    vkCmdCopyImageToBuffer(cb, texture->GetOptimalImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, result->GetVkBuffer(), 1, &region);
+
+    // Contents in an undefined or preinitialized layout are not worth restoring; the subresource stays readable.
+    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED || oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED)
+    {
+        texture->SetImageLayout(mipLevel, arrayLayer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    }
+    else
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = oldLayout;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    texture->SetOwnedByGraphicsQueue();
+
+    SubmitReadback(pool, cb, result);
+    *ticket = result;
+    return VdResult::Success;
+}
+
+// Readbacks get a command buffer of their own, submitted after any pending uploads so that they observe them.
+VkCommandBuffer GraphicsDevice::BeginReadback(SharedCommandPool** pool)
+{
+    FlushUploads();
+    *pool = GetFreeCommandPool();
+    return (*pool)->BeginNewCommandBuffer();
+}
+
+void GraphicsDevice::SubmitReadback(SharedCommandPool* pool, VkCommandBuffer cb, ReadbackTicket* ticket)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    ticket->SetCommandBuffer(cb);
+    _stagingResourcesLock.lock();
+    _submittedReadbacks[cb] = ticket;
+    _stagingResourcesLock.unlock();
+    pool->EndAndSubmit(cb);
+}
+
+// Tickets are only marked complete by CheckSubmittedFences, so check here rather than wait for the next submission.
+bool GraphicsDevice::IsReadbackComplete(ReadbackTicket* ticket)
+{
+    if (!ticket->IsComplete())
+    {
+        CheckSubmittedFences();
+    }
+
+    return ticket->IsComplete();
+}
+
+VdResult GraphicsDevice::WaitForReadback(ReadbackTicket* ticket)
+{
+    if (!ticket->IsComplete())
+    {
+        WaitForCommandBuffer(ticket->GetCommandBuffer());
+    }
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::MapReadback(ReadbackTicket* ticket, MappedResource* mappedResource)
+{
+    return ticket->Map(mappedResource);
+}
+
+// In-flight tickets are destroyed when their copy completes.
+VdResult GraphicsDevice::DisposeReadback(ReadbackTicket* ticket)
+{
+    _stagingResourcesLock.lock();
+    if (ticket->IsComplete())
+    {
+        delete ticket;
+    }
+    else
+    {
+        ticket->Dispose();
+    }
+    _stagingResourcesLock.unlock();
+
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::GetHostImportAlignment(uint64_t* alignment)
+{
+    if (!_externalMemoryHostEnabled)
+    {
+        return VdResult::UnsupportedSystem;
+    }
+
+    *alignment = _minImportedHostPointerAlignment;
+    return VdResult::Success;
+}
+
+VdResult GraphicsDevice::ImportHostBuffer(
+    void* hostPointer,
+    uint32_t sizeInBytes,
+    HostMemoryReleasedCallback onReleased,
+    void* userData,
+    DeviceBuffer** buffer)
+{
+#ifdef VK_EXT_external_memory_host
+    if (!_externalMemoryHostEnabled)
+    {
+        return VdResult::UnsupportedSystem;
+    }
+    if (sizeInBytes == 0
+        || reinterpret_cast<uintptr_t>(hostPointer) % _minImportedHostPointerAlignment != 0
+        || sizeInBytes % _minImportedHostPointerAlignment != 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (_getMemoryHostPointerProperties(
+        _device,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        hostPointer,
+        &pointerProperties) != VK_SUCCESS)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    VkExternalMemoryBufferCreateInfoKHR externalCI = {};
+    externalCI.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR;
+    externalCI.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferCI = {};
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.pNext = &externalCI;
+    bufferCI.size = sizeInBytes;
+    bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    VkBuffer vkBuffer;
+    CheckResult(vkCreateBuffer(_device, &bufferCI, nullptr, &vkBuffer));
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(_device, vkBuffer, &memReqs);
+    uint32_t typeBits = memReqs.memoryTypeBits & pointerProperties.memoryTypeBits;
+    if (typeBits == 0 || memReqs.size > sizeInBytes)
+    {
+        vkDestroyBuffer(_device, vkBuffer, nullptr);
+        return VdResult::InvalidOperation;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = hostPointer;
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = &importInfo;
+    allocateInfo.allocationSize = sizeInBytes;
+    allocateInfo.memoryTypeIndex = FindMemoryType(_physicalDeviceMemProperties, typeBits, 0);
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(_device, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+        vkDestroyBuffer(_device, vkBuffer, nullptr);
+        return VdResult::OutOfMemory;
+    }
+    CheckResult(vkBindBufferMemory(_device, vkBuffer, memory, 0));
+
+    *buffer = new DeviceBuffer(this, vkBuffer, memory, sizeInBytes, hostPointer, onReleased, userData);
+    return VdResult::Success;
+#else
+    return VdResult::UnsupportedSystem;
+#endif
+}
+
+void GraphicsDevice::RetireHostImport(
+    VkBuffer buffer,
+    VkDeviceMemory memory,
+    void* hostPointer,
+    HostMemoryReleasedCallback onReleased,
+    void* userData)
+{
+    // Work recorded against the buffer but not yet submitted is the caller's to finish first, as with
+    // any other destroyed resource; anything already submitted is waited for here.
+    FlushUploads();
+    RetiredResources retired;
+    retired.Buffers.push_back(buffer);
+    retired.DeviceMemory.push_back(memory);
+    if (onReleased != nullptr)
+    {
+        retired.HostMemoryReleases.push_back({ onReleased, hostPointer, userData });
+    }
+    RetireResources(retired);
+}
+
+void GraphicsDevice::DestroyRetiredResources(const RetiredResources& retired)
+{
+    for (VkImageView view : retired.ImageViews)
+    {
+        vkDestroyImageView(_device, view, nullptr);
+    }
+    for (VkImage image : retired.Images)
+    {
+        vkDestroyImage(_device, image, nullptr);
+    }
+    for (VkBuffer buffer : retired.Buffers)
+    {
+        vkDestroyBuffer(_device, buffer, nullptr);
+    }
+    for (const MemoryBlock& block : retired.MemoryBlocks)
+    {
+        _memoryManager.Free(block);
+    }
+    for (auto& set : retired.DescriptorSets)
+    {
+        _descriptorPoolManager->Free(set.first, set.second);
+    }
+    for (VkDeviceMemory memory : retired.DeviceMemory)
+    {
+        vkFreeMemory(_device, memory, nullptr);
+    }
+    for (const HostMemoryRelease& release : retired.HostMemoryReleases)
+    {
+        release.Callback(release.HostPointer, release.UserData);
+    }
+}
+
+void GraphicsDevice::ClearColorTexture(Texture * texture, VkClearColorValue color)
+{
+    VkImageSubresourceRange range;
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = texture->GetMipLevels();
+    range.baseArrayLayer = 0;
+    range.layerCount = texture->GetArrayLayers();
+    SharedCommandPool* pool = GetFreeCommandPool();
+    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
+    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdClearColorImage(cb, texture->GetOptimalImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    pool->EndAndSubmit(cb);
+}
+
+void GraphicsDevice::ClearDepthTexture(Texture * texture, VkClearDepthStencilValue clearValue)
+{
+    VkImageSubresourceRange range;
+    range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = texture->GetMipLevels();
+    range.baseArrayLayer = 0;
+    range.layerCount = texture->GetArrayLayers();
+    SharedCommandPool* pool = GetFreeCommandPool();
+    VkCommandBuffer cb = pool->BeginNewCommandBuffer();
+    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdClearDepthStencilImage(
+        cb,
+        texture->GetOptimalImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        &clearValue,
+        1,
+        &range);
+    texture->TransitionImageLayout(cb, 0, texture->GetMipLevels(), 0, texture->GetArrayLayers(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    pool->EndAndSubmit(cb);
+}
+
+void GraphicsDevice::EnqueueDisposedCommandBuffer(CommandList* cl)
+{
+    _commandListsToDisposeLock.lock();
+    _commandListsToDispose.insert(cl);
+    _commandListsToDisposeLock.unlock();
+}
+
+void GraphicsDevice::DestroyIfDisposed(CommandList* cl)
+{
+    _commandListsToDisposeLock.lock();
+    if (cl->GetSubmissionCount() == 0)
+    {
+        if (_commandListsToDispose.erase(cl) != 0)
+        {
+            delete cl;
+        }
+    }
+    _commandListsToDisposeLock.unlock();
+}
+
+void GraphicsDevice::RegisterResource(DeviceBuffer* buffer)
+{
+    _registeredResourcesLock.lock();
+    _registeredBuffers.insert(buffer);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::RegisterResource(Texture* texture)
+{
+    _registeredResourcesLock.lock();
+    _registeredTextures.insert(texture);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::RegisterResource(TextureView* view)
+{
+    _registeredResourcesLock.lock();
+    _registeredTextureViews.insert(view);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::RegisterResource(ResourceSet* set)
+{
+    _registeredResourcesLock.lock();
+    _registeredResourceSets.insert(set);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::UnregisterResource(DeviceBuffer* buffer)
+{
+    _registeredResourcesLock.lock();
+    _registeredBuffers.erase(buffer);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::UnregisterResource(Texture* texture)
+{
+    _registeredResourcesLock.lock();
+    _registeredTextures.erase(texture);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::UnregisterResource(TextureView* view)
+{
+    _registeredResourcesLock.lock();
+    _registeredTextureViews.erase(view);
+    _registeredResourcesLock.unlock();
+}
+
+void GraphicsDevice::UnregisterResource(ResourceSet* set)
+{
+    _registeredResourcesLock.lock();
+    _registeredResourceSets.erase(set);
+    _registeredResourcesLock.unlock();
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_CreateVulkan(
+    GraphicsDeviceOptions* options,
+    GraphicsDeviceCallbacks* callbacks,
+    GraphicsDevice** graphicsDevice)
+{
+    GraphicsDevice* gd = new GraphicsDevice();
+    auto result = gd->Init(*options, *callbacks);
+    if (result == VdResult::Success)
+    {
+        *graphicsDevice = gd;
+    }
+
+    return result;
+}
+
+VD_EXPORT ResourceFactory* VdGraphicsDevice_GetResourceFactory(GraphicsDevice* gd)
+{
+    return gd->GetResourceFactory();
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_SwapBuffers(GraphicsDevice* gd, Swapchain* sc)
+{
+    return gd->SwapBuffers(*sc);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_UpdateBuffer(
+    GraphicsDevice* gd,
+    DeviceBuffer* buffer,
+    uint32_t bufferOffsetInBytes,
+    void* source,
+    uint32_t sizeInBytes)
+{
+    return gd->UpdateBuffer(buffer, bufferOffsetInBytes, source, sizeInBytes);
+}
 
 VD_EXPORT VdResult VdGraphicsDevice_SubmitCommands(
     GraphicsDevice* gd,
@@ -792,6 +2573,26 @@ VD_EXPORT VdResult VdGraphicsDevice_SubmitCommands(
     return gd->SubmitCommands(cl, fence);
 }
 
+VD_EXPORT VdResult VdGraphicsDevice_BeginUpdateBuffer(
+    GraphicsDevice* gd,
+    DeviceBuffer* buffer,
+    uint32_t bufferOffsetInBytes,
+    uint32_t sizeInBytes,
+    BufferUpdate* update)
+{
+    return gd->BeginUpdateBuffer(buffer, bufferOffsetInBytes, sizeInBytes, update);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_EndUpdateBuffer(GraphicsDevice* gd, BufferUpdate* update)
+{
+    return gd->EndUpdateBuffer(update);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_FlushUploads(GraphicsDevice* gd)
+{
+    return gd->FlushUploads();
+}
+
 VD_EXPORT VdResult VdGraphicsDevice_MapBuffer(
     GraphicsDevice* gd,
     DeviceBuffer* buffer,
@@ -842,6 +2643,133 @@ VD_EXPORT VdResult VdGraphicsDevice_WaitForIdle(GraphicsDevice* gd)
     return gd->WaitForIdle();
 }
 
+VD_EXPORT VdResult VdGraphicsDevice_GetMemoryTypeStatistics(GraphicsDevice* gd, uint32_t* count, MemoryTypeStatistics* stats)
+{
+    return gd->GetMemoryTypeStatistics(count, stats);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_GetMemoryHeapStatistics(GraphicsDevice* gd, uint32_t* count, MemoryHeapStatistics* stats)
+{
+    return gd->GetMemoryHeapStatistics(count, stats);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_GetMemoryReport(GraphicsDevice* gd, uint32_t* size, char* json)
+{
+    return gd->GetMemoryReport(size, json);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_TrimMemory(GraphicsDevice* gd)
+{
+    return gd->TrimMemory();
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_SetMemoryTrimPolicy(GraphicsDevice* gd, uint32_t frameDelay, uint64_t maxEmptyBytes)
+{
+    return gd->SetMemoryTrimPolicy(frameDelay, maxEmptyBytes);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_DefragmentMemory(GraphicsDevice* gd, uint64_t maxBytesMoved, uint64_t* bytesMoved)
+{
+    return gd->DefragmentMemory(maxBytesMoved, bytesMoved);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_StreamTexture(GraphicsDevice* gd, Texture* texture, const void* source, TextureStream** stream)
+{
+    return gd->StreamTexture(texture, source, stream);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_ProcessTextureStreams(GraphicsDevice* gd)
+{
+    return gd->ProcessTextureStreams();
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_SetTextureStreamingBudget(GraphicsDevice* gd, uint64_t bytesPerFrame)
+{
+    return gd->SetTextureStreamingBudget(bytesPerFrame);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_WaitForTextureStream(GraphicsDevice* gd, TextureStream* stream)
+{
+    return gd->WaitForTextureStream(stream);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_DisposeTextureStream(GraphicsDevice* gd, TextureStream* stream)
+{
+    return gd->DisposeTextureStream(stream);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_SetDeviceLocalMappedBudget(GraphicsDevice* gd, uint64_t budgetInBytes)
+{
+    return gd->SetDeviceLocalMappedBudget(budgetInBytes);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_ReadbackBuffer(
+    GraphicsDevice* gd,
+    DeviceBuffer* buffer,
+    uint32_t offsetInBytes,
+    uint32_t sizeInBytes,
+    ReadbackTicket** ticket)
+{
+    return gd->ReadbackBuffer(buffer, offsetInBytes, sizeInBytes, ticket);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_ReadbackTexture(
+    GraphicsDevice* gd,
+    Texture* texture,
+    uint32_t mipLevel,
+    uint32_t arrayLayer,
+    ReadbackTicket** ticket)
+{
+    return gd->ReadbackTexture(texture, mipLevel, arrayLayer, ticket);
+}
+
+VD_EXPORT bool VdGraphicsDevice_IsReadbackComplete(GraphicsDevice* gd, ReadbackTicket* ticket)
+{
+    return gd->IsReadbackComplete(ticket);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_WaitForReadback(GraphicsDevice* gd, ReadbackTicket* ticket)
+{
+    return gd->WaitForReadback(ticket);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_MapReadback(GraphicsDevice* gd, ReadbackTicket* ticket, MappedResource* mappedResource)
+{
+    return gd->MapReadback(ticket, mappedResource);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_DisposeReadback(GraphicsDevice* gd, ReadbackTicket* ticket)
+{
+    return gd->DisposeReadback(ticket);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_LoadTextures(
+    GraphicsDevice* gd,
+    uint32_t count,
+    const char* const* paths,
+    TextureUsage usage,
+    Texture** textures,
+    VdResult* results)
+{
+    return gd->LoadTextures(count, paths, usage, textures, results);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_GetHostImportAlignment(GraphicsDevice* gd, uint64_t* alignment)
+{
+    return gd->GetHostImportAlignment(alignment);
+}
+
+VD_EXPORT VdResult VdGraphicsDevice_ImportHostBuffer(
+    GraphicsDevice* gd,
+    void* hostPointer,
+    uint32_t sizeInBytes,
+    HostMemoryReleasedCallback onReleased,
+    void* userData,
+    DeviceBuffer** buffer)
+{
+    return gd->ImportHostBuffer(hostPointer, sizeInBytes, onReleased, userData, buffer);
+}
+
 VD_EXPORT VdResult VdGraphicsDevice_Dispose(GraphicsDevice* gd)
 {
     delete gd;
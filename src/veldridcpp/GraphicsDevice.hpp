@@ -4,11 +4,18 @@
 #include "vulkan.h"
 #include "VdResult.hpp"
 #include "MemoryManager.hpp"
+#include "MemoryStatistics.hpp"
+#include "DescriptorAllocationToken.hpp"
+#include "DescriptorResourceCounts.hpp"
 #include "MapMode.hpp"
 #include "MappedResource.hpp"
+#include "BufferUpdate.hpp"
 #include "PixelFormat.hpp"
+#include "TextureUsage.hpp"
+#include "MemoryIntent.hpp"
 #include "stdint.h"
 #include <mutex>
+#include <atomic>
 #include <deque>
 #include <unordered_set>
 
@@ -20,9 +27,15 @@ class ResourceFactory;
 class Swapchain;
 class DeviceBuffer;
 class Texture;
+class TextureView;
+class ResourceSet;
 class Fence;
 class CommandList;
 class DescriptorPoolManager;
+class StagingRing;
+class ReadbackPool;
+class TextureStream;
+class ReadbackTicket;
 
 class GraphicsDevice
 {
@@ -42,17 +55,131 @@ public:
     const GraphicsDeviceCallbacks& GetGraphicsDeviceCallbacks() const { return _callbacks; }
     MemoryManager& GetMemoryManager() { return _memoryManager; }
     DescriptorPoolManager& GetDescriptorPoolManager() { return *_descriptorPoolManager; }
+    ReadbackPool& GetReadbackPool() { return *_readbackPool; }
+    void GetBufferMemoryRequirements(VkBuffer buffer, VkMemoryRequirements* memReqs, bool* prefersDedicated);
+    void GetImageMemoryRequirements(VkImage image, VkMemoryRequirements* memReqs, bool* prefersDedicated);
+    // Memory properties for a persistently mapped resource with the given intent.
+    void GetMappedMemoryFlags(MemoryIntent intent, VkMemoryPropertyFlags* requiredFlags, VkMemoryPropertyFlags* preferredFlags) const;
+    // Buffers that are not Staging, Readback or GpuOnly are placed in memory that is both device-local and
+    // host-visible while it lasts and the total stays under the budget. Such buffers are persistently mapped,
+    // and UpdateBuffer writes straight into them when no recorded or submitted work uses them.
+    bool ReserveDeviceLocalMappedMemory(uint32_t memoryTypeBits, VkDeviceSize size);
+    void ReleaseDeviceLocalMappedMemory(VkDeviceSize size);
+    VdResult SetDeviceLocalMappedBudget(uint64_t budgetInBytes);
+    // Pads host-visible memory requirements to nonCoherentAtomSize, so that flushing or invalidating a block
+    // never touches its neighbours.
+    void PadToNonCoherentAtom(VkMemoryRequirements* memReqs) const;
+    // Make CPU writes visible to the GPU, and GPU writes visible to the CPU. No-ops for coherent memory.
+    void FlushMappedMemory(const MemoryBlock& block, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void InvalidateMappedMemory(const MemoryBlock& block, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
 
     VdResult SwapBuffers(Swapchain& sc);
     VdResult UpdateBuffer(DeviceBuffer* buffer, uint32_t bufferOffsetInBytes, void* source, uint32_t sizeInBytes);
+    // Like UpdateBuffer, but the caller writes the new contents straight into update->Data, which is upload
+    // memory (or the buffer itself, if it is mappable). EndUpdateBuffer queues the copy. Several
+    // updates may be open at once, on any threads, but each should be ended promptly: the staging ring can't
+    // reclaim space allocated after an open update.
+    VdResult BeginUpdateBuffer(DeviceBuffer* buffer, uint32_t bufferOffsetInBytes, uint32_t sizeInBytes, BufferUpdate* update);
+    VdResult EndUpdateBuffer(BufferUpdate* update);
     VdResult UpdateTexture(Texture* texture, void* source, uint32_t sizeInBytes, uint32_t x, uint32_t y, uint32_t z, uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevel, uint32_t arrayLayer);
+    // One region of an UpdateTextureRegions call. Data is tightly packed: rows are GetRowPitch(Width) bytes
+    // apart and depth slices GetDepthPitch(rowPitch, Height) bytes apart.
+    struct TextureUploadRegion
+    {
+        const void* Data;
+        uint32_t X;
+        uint32_t Y;
+        uint32_t Z;
+        uint32_t Width;
+        uint32_t Height;
+        uint32_t Depth;
+        uint32_t MipLevel;
+        uint32_t ArrayLayer;
+    };
+    // Copies every region into the staging ring and records a single vkCmdCopyBufferToImage for all of them.
+    // Fails with InvalidOperation for Staging textures and regions outside the texture.
+    VdResult UpdateTextureRegions(Texture* texture, uint32_t regionCount, const TextureUploadRegion* regions);
+    // Creates a texture from each KTX2 or DDS file, with the given usage, and uploads all of its mip levels
+    // and layers in one submission. Files are memory-mapped and parsed on worker threads, and copied straight
+    // from the mapping into the staging ring. textures[i] is null for files that failed to load; results, if
+    // not null, receives each file's outcome, and the first failure is returned. usage must include Sampled
+    // and not Staging.
+    VdResult LoadTextures(uint32_t count, const char* const* paths, TextureUsage usage, Texture** textures, VdResult* results);
     VdResult SubmitCommands(CommandList* cl, Fence* fence);
+    // Submits the copies queued by UpdateBuffer and UpdateTexture. This also happens implicitly before
+    // SubmitCommands, WaitForIdle and DefragmentMemory, and whenever enough upload data has accumulated.
+    VdResult FlushUploads();
+    // Only Dynamic and Staging buffers, buffers with an Upload, Readback or FrequentlyUpdated intent, and
+    // buffers placed in device-local mapped memory can be mapped. Use ReadbackBuffer to read others.
+    // Mapping a Dynamic buffer with MapMode::Write, or updating it, moves it to a version that submitted work
+    // is not reading instead of stalling; a Write map leaves the contents undefined.
     VdResult MapBuffer(DeviceBuffer* buffer, MapMode mode, MappedResource* mappedResource);
     VdResult UnmapBuffer(DeviceBuffer* buffer);
     VdResult MapTexture(Texture* texture, MapMode mode, uint32_t subresource, MappedResource* mappedResource);
     VdResult UnmapTexture(Texture* texture, uint32_t subresource);
 
     VdResult WaitForIdle();
+    VdResult GetMemoryTypeStatistics(uint32_t* count, MemoryTypeStatistics* stats);
+    VdResult GetMemoryHeapStatistics(uint32_t* count, MemoryHeapStatistics* stats);
+    VdResult GetMemoryReport(uint32_t* size, char* json);
+    VdResult TrimMemory();
+    VdResult SetMemoryTrimPolicy(uint32_t frameDelay, uint64_t maxEmptyBytes);
+    // Moves up to maxBytesMoved of buffer and texture contents out of the sparsest memory chunks, so that
+    // those chunks can be released. Meant to be called once per frame, between submitting one frame's
+    // CommandLists and recording the next: any CommandList recorded but not yet submitted may refer to
+    // moved resources. ResourceLayouts must outlive the ResourceSets created from them.
+    VdResult DefragmentMemory(uint64_t maxBytesMoved, uint64_t* bytesMoved);
+    // Queues every mip level and array layer of texture for upload and returns a handle to poll. source holds
+    // all subresources laid out as in a staging Texture, and must stay valid until the stream completes or is
+    // disposed. The mip tail is queued at once; larger levels follow, smallest first, within the per-frame
+    // streaming budget. Views of the texture only expose the levels that have landed.
+    VdResult StreamTexture(Texture* texture, const void* source, TextureStream** stream);
+    // Queues streamed texture levels up to the budget and moves views on to newly landed levels. Called by
+    // SwapBuffers; like DefragmentMemory it must run between frames, since ResourceSets may be rewritten.
+    VdResult ProcessTextureStreams();
+    VdResult SetTextureStreamingBudget(uint64_t bytesPerFrame);
+    // Queues all remaining levels of stream regardless of the budget and blocks until they have landed.
+    VdResult WaitForTextureStream(TextureStream* stream);
+    // Stops uploading further levels. Must be called before the texture is destroyed.
+    VdResult DisposeTextureStream(TextureStream* stream);
+    // Copies the range, or one tightly packed subresource, into host memory without stalling. The copy is
+    // ordered after everything submitted so far; the returned ticket can be polled, waited on and mapped once
+    // complete, and must be disposed.
+    VdResult ReadbackBuffer(DeviceBuffer* buffer, uint32_t offsetInBytes, uint32_t sizeInBytes, ReadbackTicket** ticket);
+    VdResult ReadbackTexture(Texture* texture, uint32_t mipLevel, uint32_t arrayLayer, ReadbackTicket** ticket);
+    bool IsReadbackComplete(ReadbackTicket* ticket);
+    VdResult WaitForReadback(ReadbackTicket* ticket);
+    VdResult MapReadback(ReadbackTicket* ticket, MappedResource* mappedResource);
+    VdResult DisposeReadback(ReadbackTicket* ticket);
+    // Wraps application memory (a page-aligned allocation or a mapped file region) in a DeviceBuffer that
+    // can only be a copy source, so CommandList::CopyBuffer and CopyBufferToTexture read it in place instead
+    // of through a staging copy. The pointer and size must be multiples of GetHostImportAlignment. The memory
+    // must stay valid and unchanged until onReleased is called, which happens once the buffer has been
+    // disposed and all work submitted before that has completed. UnsupportedSystem without
+    // VK_EXT_external_memory_host.
+    VdResult GetHostImportAlignment(uint64_t* alignment);
+    VdResult ImportHostBuffer(
+        void* hostPointer,
+        uint32_t sizeInBytes,
+        HostMemoryReleasedCallback onReleased,
+        void* userData,
+        DeviceBuffer** buffer);
+    // Called by DeviceBuffer::Destroy for imported buffers.
+    void RetireHostImport(
+        VkBuffer buffer,
+        VkDeviceMemory memory,
+        void* hostPointer,
+        HostMemoryReleasedCallback onReleased,
+        void* userData);
+
+    // Every graphics queue submission gets a serial. Dynamic buffers use them to tell which of their
+    // versions submitted work may still be reading.
+    uint64_t GetCompletedSubmissionSerial() const { return _completedSerial; }
+    uint64_t PollCompletedSubmissionSerial();
+    void WaitForSubmissionSerial(uint64_t serial);
+    // Counts Dynamic buffer version switches, so that CommandLists can tell when to rebind.
+    uint64_t GetBufferDiscardCount() const { return _bufferDiscardCount; }
+    void BufferDiscarded() { _bufferDiscardCount++; }
 
     uint32_t GetGraphicsQueueIndex() { return _graphicsQueueIndex; }
     uint32_t GetPresentQueueIndex() { return _presentQueueIndex; }
@@ -60,6 +187,18 @@ public:
     void ClearColorTexture(Texture* texture, VkClearColorValue color);
     void ClearDepthTexture(Texture* texture, VkClearDepthStencilValue value);
     void EnqueueDisposedCommandBuffer(CommandList* cl);
+    // Deletes a disposed CommandList once none of its command buffers are in flight.
+    void DestroyIfDisposed(CommandList* cl);
+
+    // Live resources, so that DefragmentMemory can find what to move and what refers to it.
+    void RegisterResource(DeviceBuffer* buffer);
+    void RegisterResource(Texture* texture);
+    void RegisterResource(TextureView* view);
+    void RegisterResource(ResourceSet* set);
+    void UnregisterResource(DeviceBuffer* buffer);
+    void UnregisterResource(Texture* texture);
+    void UnregisterResource(TextureView* view);
+    void UnregisterResource(ResourceSet* set);
 
 private:
     bool _debug;
@@ -80,6 +219,18 @@ private:
     VkDebugReportCallbackEXT _debugLayerCallback;
     bool _debugMarkerEnabled;
     PFN_vkDebugMarkerSetObjectNameEXT _setObjectNamePtr;
+    bool _dedicatedAllocationEnabled = false;
+    PFN_vkGetBufferMemoryRequirements2KHR _getBufferMemoryRequirements2;
+    PFN_vkGetImageMemoryRequirements2KHR _getImageMemoryRequirements2;
+    bool _physicalDeviceProperties2Enabled = false;
+    bool _memoryBudgetEnabled = false;
+    std::mutex _deviceLocalMappedLock;
+    VkDeviceSize _deviceLocalMappedBudget = 0;
+    VkDeviceSize _deviceLocalMappedBytes = 0;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR _getPhysicalDeviceMemoryProperties2;
+    bool _externalMemoryHostEnabled = false;
+    VkDeviceSize _minImportedHostPointerAlignment = 0;
+    PFN_vkGetMemoryHostPointerPropertiesEXT _getMemoryHostPointerProperties;
 
     // Queue stuff
     std::recursive_mutex _graphicsQueueLock;
@@ -88,42 +239,139 @@ private:
     uint32_t _presentQueueIndex;
     VkQueue _graphicsQueue;
     VkQueue _presentQueue;
+    // A transfer-only queue family used for first uploads to new resources, if the device has one.
+    std::recursive_mutex _transferQueueLock;
+    uint32_t _transferQueueIndex;
+    VkQueue _transferQueue = VK_NULL_HANDLE;
+    // Image copies need a minImageTransferGranularity of (1, 1, 1) to allow arbitrary regions.
+    bool _transferQueueCopiesImages = false;
 
     // Cached resources
-    static const uint32_t MinStagingBufferSize = 256;
-    static const uint32_t MaxStagingBufferSize = 512;
+    StagingRing* _stagingRing;
+    ReadbackPool* _readbackPool;
     std::recursive_mutex _stagingResourcesLock;
-    std::vector<DeviceBuffer*> _availableStagingBuffers;
-    std::vector<Texture*> _availableStagingTextures;
     std::recursive_mutex _graphicsCommandPoolLock;
     std::vector<SharedCommandPool*> _availableSharedCommandPools;
     std::unordered_map<VkCommandBuffer, SharedCommandPool*> _submittedSharedCommandPools;
-    std::unordered_map<VkCommandBuffer, DeviceBuffer*> _submittedStagingBuffers;
-    std::unordered_map<VkCommandBuffer, Texture*> _submittedStagingTextures;
+
+    // Uploads are recorded into one command buffer per queue and submitted together by FlushUploads.
+    // Buffer copies are held back so that adjacent regions can be merged.
+    static const VkDeviceSize MaxPendingUploadBytes = 1024 * 1024 * 64;
+    struct PendingBufferCopy
+    {
+        VkBuffer Source;
+        VkBufferCopy Region;
+    };
+    struct UploadBatch
+    {
+        SharedCommandPool* Pool = nullptr;
+        VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
+        std::unordered_map<VkBuffer, std::vector<PendingBufferCopy>> BufferCopies;
+        // Transfer queue only: ownership releases to the graphics queue family, recorded at flush.
+        std::vector<VkBufferMemoryBarrier> BufferReleases;
+        std::vector<VkImageMemoryBarrier> ImageReleases;
+    };
+    // A flushed transfer-queue batch, kept until the graphics-queue command buffer that acquires its
+    // resources has completed (which implies the transfer work has too).
+    struct TransferHandoff
+    {
+        SharedCommandPool* Pool;
+        VkCommandBuffer CommandBuffer;
+        VkSemaphore Semaphore;
+    };
+    std::recursive_mutex _uploadLock;
+    UploadBatch _graphicsUploads;
+    UploadBatch _transferUploads;
+    VkDeviceSize _pendingUploadBytes = 0;
+    std::vector<SharedCommandPool*> _availableTransferCommandPools;
+    std::vector<VkSemaphore> _availableSemaphores;
+    std::unordered_map<VkCommandBuffer, TransferHandoff> _submittedTransferHandoffs;
+
+    // Levels larger than this are held back for ProcessTextureStreams.
+    static const VkDeviceSize MipTailSize = 64 * 1024;
+    static const VkDeviceSize DefaultTextureStreamingBudget = 1024 * 1024 * 32;
+    std::recursive_mutex _textureStreamsLock;
+    std::vector<TextureStream*> _textureStreams;
+    VkDeviceSize _textureStreamingBudget = DefaultTextureStreamingBudget;
+    // Levels queued since the last FlushUploads, and those waiting for a submitted command buffer.
+    std::vector<std::pair<TextureStream*, uint32_t>> _uploadedStreamLevels;
+    std::unordered_map<VkCommandBuffer, std::vector<std::pair<TextureStream*, uint32_t>>> _submittedStreamLevels;
+    std::unordered_map<VkCommandBuffer, ReadbackTicket*> _submittedReadbacks;
 
     std::recursive_mutex _submissionFencesLock;
+    // In nanoseconds.
+    static const uint64_t SubmissionFenceWaitTimeout = 1000 * 1000;
     std::deque<VkFence> _availableSubmissionFences;
-    std::unordered_map<VkFence, std::tuple<CommandList*, VkCommandBuffer>> _submittedFences;
-    std::vector<std::pair<VkFence, std::tuple<CommandList*, VkCommandBuffer>>> _completedFences;
+    // Each submission gets a serial; every submission up to _completedSerial has completed.
+    std::unordered_map<VkFence, std::tuple<CommandList*, VkCommandBuffer, uint64_t>> _submittedFences;
+    std::vector<std::pair<VkFence, std::tuple<CommandList*, VkCommandBuffer, uint64_t>>> _completedFences;
+    uint64_t _submissionSerial = 0;
+    std::atomic<uint64_t> _completedSerial { 0 };
+    std::atomic<uint64_t> _bufferDiscardCount { 0 };
+
+    struct HostMemoryRelease
+    {
+        HostMemoryReleasedCallback Callback;
+        void* HostPointer;
+        void* UserData;
+    };
+
+    // Handles replaced by DefragmentMemory, destroyed once its copy commands have completed.
+    struct RetiredResources
+    {
+        std::vector<VkBuffer> Buffers;
+        std::vector<VkImage> Images;
+        std::vector<VkImageView> ImageViews;
+        std::vector<MemoryBlock> MemoryBlocks;
+        std::vector<std::pair<DescriptorAllocationToken, DescriptorResourceCounts>> DescriptorSets;
+        // Imported host memory, freed directly rather than through the MemoryManager.
+        std::vector<VkDeviceMemory> DeviceMemory;
+        std::vector<HostMemoryRelease> HostMemoryReleases;
+    };
+
+    std::recursive_mutex _registeredResourcesLock;
+    std::unordered_set<DeviceBuffer*> _registeredBuffers;
+    std::unordered_set<Texture*> _registeredTextures;
+    std::unordered_set<TextureView*> _registeredTextureViews;
+    std::unordered_set<ResourceSet*> _registeredResourceSets;
+    std::unordered_map<VkCommandBuffer, RetiredResources> _submittedRetiredResources;
 
     VdResult CreateInstance();
     VdResult CreatePhysicalDevice();
     void GetQueueFamilyIndices(VkSurfaceKHR surface);
     VdResult CreateLogicalDevice(VkSurfaceKHR surface);
     void CheckSubmittedFences();
-    DeviceBuffer* GetFreeStagingBuffer(uint32_t size);
-    Texture* GetFreeStagingTexture(uint32_t width, uint32_t height, uint32_t depth, PixelFormat format);
-    SharedCommandPool* GetFreeCommandPool();
+    void InitDeviceLocalMappedBudget();
+    bool BeginDirectWrite(DeviceBuffer* buffer);
+    void EndDirectWrite(DeviceBuffer* buffer);
+    bool GetNonCoherentRange(const MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange* range) const;
+    void WaitForCommandBuffer(VkCommandBuffer cb);
+    SharedCommandPool* GetFreeCommandPool(bool transfer = false);
+    VkSemaphore GetFreeSemaphore();
     VkFence GetFreeSubmissionFence();
+    VkCommandBuffer GetUploadCommandBuffer(bool transfer);
+    void QueueBufferCopy(bool useTransferQueue, DeviceBuffer* buffer, const StagingAllocation& staging, uint32_t bufferOffsetInBytes, uint32_t sizeInBytes);
+    void RecordBufferCopies(VkCommandBuffer cb, VkBuffer destination, std::vector<PendingBufferCopy>& copies);
+    void RecordPendingBufferCopies(UploadBatch& batch);
+    void SubmitTransferUploads();
+    void RegisterSubmittedUploads(VkCommandBuffer cb);
+    void QueueTextureStreamLevel(TextureStream* stream);
+    void UpdateTextureStreamViews();
+    void RetireResources(RetiredResources& retired);
+    void DestroyRetiredResources(const RetiredResources& retired);
+    VkCommandBuffer BeginReadback(SharedCommandPool** pool);
+    void SubmitReadback(SharedCommandPool* pool, VkCommandBuffer cb, ReadbackTicket* ticket);
 
-    void SubmitCommandBuffer(
+    // Returns the submission's serial.
+    uint64_t SubmitCommandBuffer(
         CommandList* commandList,
         VkCommandBuffer vkCB,
         uint32_t waitSemaphoreCount,
         VkSemaphore* waitSemaphoresPtr,
         uint32_t signalSemaphoreCount,
         VkSemaphore* signalSemaphoresPtr,
-        Fence* fence);
+        Fence* fence,
+        VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
 
     class SharedCommandPool
     {
@@ -136,7 +384,7 @@ private:
     public:
         bool IsCached() const { return _isCached; }
 
-        SharedCommandPool(GraphicsDevice* gd, bool isCached)
+        SharedCommandPool(GraphicsDevice* gd, bool isCached, uint32_t queueFamilyIndex)
         {
             _gd = gd;
             _isCached = isCached;
@@ -144,7 +392,7 @@ private:
             VkCommandPoolCreateInfo commandPoolCI = {};
             commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
             commandPoolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-            commandPoolCI.queueFamilyIndex = _gd->_graphicsQueueIndex;
+            commandPoolCI.queueFamilyIndex = queueFamilyIndex;
             CheckResult(vkCreateCommandPool(_gd->GetVkDevice(), &commandPoolCI, nullptr, &_pool));
 
             VkCommandBufferAllocateInfo allocateInfo = {};
@@ -171,10 +419,17 @@ private:
             return _cb;
         }
 
-        void EndAndSubmit(VkCommandBuffer cb)
+        void EndAndSubmit(VkCommandBuffer cb, VkSemaphore waitSemaphore = VK_NULL_HANDLE)
         {
             CheckResult(vkEndCommandBuffer(cb));
-            _gd->SubmitCommandBuffer(nullptr, cb, 0, nullptr, 0, nullptr, nullptr);
+            _gd->SubmitCommandBuffer(
+                nullptr,
+                cb,
+                waitSemaphore != VK_NULL_HANDLE ? 1 : 0,
+                &waitSemaphore,
+                0, nullptr,
+                nullptr,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
             _gd->_stagingResourcesLock.lock();
             _gd->_submittedSharedCommandPools[cb] = this;
             _gd->_stagingResourcesLock.unlock();
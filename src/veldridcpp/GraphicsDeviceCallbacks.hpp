@@ -5,6 +5,7 @@
 namespace Veldrid
 {
 typedef void(*ErrorCallback) (uint32_t errorCode, const char* errorMessage);
+typedef void(*HostMemoryReleasedCallback) (void* hostPointer, void* userData);
 
 struct GraphicsDeviceCallbacks
 {
@@ -11,6 +11,14 @@ struct MemoryBlock
     void* BaseMappedPointer;
     VkDeviceSize Offset;
     VkDeviceSize Size;
+    // Allocator-private handle used to find the block's bookkeeping in O(1) when it is freed.
+    uint32_t BlockIndex;
+    // Index of the owning ChunkAllocator within its ChunkAllocatorSet, or of the owning slab for slab blocks.
+    uint32_t ChunkIndex;
+    // The block owns its whole VkDeviceMemory and is released directly rather than returned to a chunk.
+    bool IsDedicated;
+    // The block is a fixed-size block from a SlabAllocator.
+    bool IsSlab;
 
     uint8_t* BlockMappedPointer() const { return (uint8_t*)BaseMappedPointer + Offset; }
     bool IsPersistentMapped() const { return BaseMappedPointer != nullptr; }
@@ -24,6 +32,10 @@ struct MemoryBlock
         Size = size;
         MemoryTypeIndex = memoryTypeIndex;
         BaseMappedPointer = baseMappedPtr;
+        BlockIndex = 0;
+        ChunkIndex = 0;
+        IsDedicated = false;
+        IsSlab = false;
     }
 };
 }
\ No newline at end of file
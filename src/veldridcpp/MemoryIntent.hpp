@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+
+namespace Veldrid
+{
+// How the CPU will access a resource, which decides the memory type it is placed in.
+enum class MemoryIntent : uint8_t
+{
+    // Device-local memory, or host-visible coherent memory for Dynamic and Staging resources.
+    Default,
+    // Written by the CPU and read by the GPU; host-visible, write-combined memory is fine.
+    Upload,
+    // Written by the GPU and read by the CPU; host-cached memory is preferred.
+    Readback,
+    // Never mapped. Ignored for Dynamic and Staging resources, which must be mappable.
+    GpuOnly,
+    // Rewritten by the CPU every frame or more often.
+    FrequentlyUpdated,
+};
+}
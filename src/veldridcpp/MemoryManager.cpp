@@ -1,16 +1,78 @@
 #include "stdafx.h"
 #include "MemoryManager.hpp"
+#include <unordered_set>
+#include <algorithm>
 
 namespace Veldrid
 {
-void MemoryManager::Init(VkDevice device, VkPhysicalDevice physicalDevice)
+static std::mutex s_liveManagersLock;
+static std::unordered_set<uint64_t> s_liveManagers;
+static uint64_t s_nextManagerId = 1;
+
+struct ThreadCacheEntry
+{
+    uint64_t ManagerId;
+    MemoryManager* Manager;
+    MemoryThreadCache* Cache;
+};
+
+// The calling thread's caches, one per MemoryManager it has allocated from.
+// When the thread exits, each cache still owned by a live manager is flushed and released.
+struct ThreadCacheTable
+{
+    std::vector<ThreadCacheEntry> Entries;
+
+    ~ThreadCacheTable()
+    {
+        s_liveManagersLock.lock();
+        for (ThreadCacheEntry& entry : Entries)
+        {
+            if (s_liveManagers.count(entry.ManagerId) != 0)
+            {
+                entry.Manager->ReleaseThreadCache(entry.Cache);
+            }
+        }
+        s_liveManagersLock.unlock();
+    }
+};
+
+static thread_local ThreadCacheTable t_threadCaches;
+
+void MemoryManager::Init(VkDevice device, VkPhysicalDevice physicalDevice, bool dedicatedAllocationEnabled)
 {
     _device = device;
     _physicalDevice = physicalDevice;
+    _dedicatedAllocationEnabled = dedicatedAllocationEnabled;
+
+    s_liveManagersLock.lock();
+    _id = s_nextManagerId++;
+    s_liveManagers.insert(_id);
+    s_liveManagersLock.unlock();
 }
 
 MemoryManager::~MemoryManager()
 {
+    // Once removed from the live set, exiting threads no longer touch their caches for this manager.
+    s_liveManagersLock.lock();
+    s_liveManagers.erase(_id);
+    s_liveManagersLock.unlock();
+
+    _threadCachesLock.lock();
+    for (MemoryThreadCache* cache : _threadCaches)
+    {
+        delete cache;
+    }
+    _threadCaches.clear();
+    _threadCachesLock.unlock();
+
+    for (auto it : _slabAllocatorsByMemoryType)
+    {
+        delete it.second;
+    }
+    for (auto it : _slabAllocatorsByMemoryTypeUnmapped)
+    {
+        delete it.second;
+    }
     for (auto it : _allocatorsByMemoryType)
     {
         it.second->Dispose();
@@ -25,16 +87,35 @@ MemoryBlock MemoryManager::Allocate(
     VkPhysicalDeviceMemoryProperties memProperties,
     uint32_t memoryTypeBits,
     VkMemoryPropertyFlags flags,
+    VkMemoryPropertyFlags preferredFlags,
     bool persistentMapped,
     VkDeviceSize size,
-    VkDeviceSize alignment)
+    VkDeviceSize alignment,
+    bool prefersDedicated,
+    VkImage dedicatedImage,
+    VkBuffer dedicatedBuffer)
 {
-    _recursive_mutex.lock();
-    uint32_t memoryTypeIndex = FindMemoryType(memProperties, memoryTypeBits, flags);
-    ChunkAllocatorSet* allocator = GetAllocator(memoryTypeIndex, persistentMapped);
+    uint32_t memoryTypeIndex = FindMemoryType(memProperties, memoryTypeBits, flags, preferredFlags);
+    VkDeviceSize dedicatedThreshold = persistentMapped ? PersistentMappedDedicatedThreshold : UnmappedDedicatedThreshold;
+    if (prefersDedicated || size >= dedicatedThreshold)
+    {
+        return AllocateDedicated(memoryTypeIndex, persistentMapped, size, dedicatedImage, dedicatedBuffer);
+    }
+
     MemoryBlock ret;
-    bool result = allocator->Allocate(size, alignment, &ret);
-    _recursive_mutex.unlock();
+    bool result;
+    uint32_t sizeClass;
+    if (SlabAllocator::GetSizeClass(size, alignment, &sizeClass))
+    {
+        result = GetThreadCache()->Allocate(memoryTypeIndex, persistentMapped, sizeClass, &ret);
+    }
+    else
+    {
+        _recursive_mutex.lock();
+        ChunkAllocatorSet* allocator = GetAllocator(memoryTypeIndex, persistentMapped);
+        result = allocator->Allocate(size, alignment, &ret);
+        _recursive_mutex.unlock();
+    }
 
     if (!result)
     {
@@ -44,14 +125,253 @@ MemoryBlock MemoryManager::Allocate(
     return ret;
 }
 
+MemoryBlock MemoryManager::AllocateDedicated(
+    uint32_t memoryTypeIndex,
+    bool persistentMapped,
+    VkDeviceSize size,
+    VkImage dedicatedImage,
+    VkBuffer dedicatedBuffer)
+{
+    VkMemoryAllocateInfo memoryAI = {};
+    memoryAI.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAI.allocationSize = size;
+    memoryAI.memoryTypeIndex = memoryTypeIndex;
+
+    VkMemoryDedicatedAllocateInfoKHR dedicatedAI = {};
+    if (_dedicatedAllocationEnabled && (dedicatedImage != VK_NULL_HANDLE || dedicatedBuffer != VK_NULL_HANDLE))
+    {
+        // A dedicated allocation must be exactly the resource's size, so drop any padding from the caller
+        // (e.g. PadToNonCoherentAtom). The block starts at offset 0 and ends with the allocation, so ranges
+        // flushed or invalidated to its end are still valid.
+        VkMemoryRequirements memReqs;
+        if (dedicatedImage != VK_NULL_HANDLE)
+        {
+            vkGetImageMemoryRequirements(_device, dedicatedImage, &memReqs);
+        }
+        else
+        {
+            vkGetBufferMemoryRequirements(_device, dedicatedBuffer, &memReqs);
+        }
+        VdAssert(memReqs.size <= size);
+        size = memReqs.size;
+        memoryAI.allocationSize = size;
+
+        dedicatedAI.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+        dedicatedAI.image = dedicatedImage;
+        dedicatedAI.buffer = dedicatedBuffer;
+        memoryAI.pNext = &dedicatedAI;
+    }
+
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(_device, &memoryAI, nullptr, &memory);
+    if (result != VK_SUCCESS)
+    {
+        throw new std::exception("Unable to allocate memory.");
+    }
+
+    void* mappedPtr = nullptr;
+    if (persistentMapped)
+    {
+        CheckResult(vkMapMemory(_device, memory, 0, size, 0, &mappedPtr));
+    }
+
+    _recursive_mutex.lock();
+    _dedicatedAllocationCounts[memoryTypeIndex] += 1;
+    _dedicatedBytes[memoryTypeIndex] += size;
+    _recursive_mutex.unlock();
+
+    MemoryBlock ret(memory, 0, size, memoryTypeIndex, mappedPtr);
+    ret.IsDedicated = true;
+    return ret;
+}
+
 void MemoryManager::Free(MemoryBlock block)
 {
+    if (block.IsDedicated)
+    {
+        vkFreeMemory(_device, block.DeviceMemory, nullptr);
+        _recursive_mutex.lock();
+        _dedicatedAllocationCounts[block.MemoryTypeIndex] -= 1;
+        _dedicatedBytes[block.MemoryTypeIndex] -= block.Size;
+        _recursive_mutex.unlock();
+        return;
+    }
+
+    if (block.IsSlab)
+    {
+        uint32_t sizeClass;
+        SlabAllocator::GetSizeClass(block.Size, 1, &sizeClass);
+        GetThreadCache()->Free(block, sizeClass);
+        return;
+    }
+
     _recursive_mutex.lock();
     ChunkAllocatorSet* allocator = GetAllocator(block.MemoryTypeIndex, block.IsPersistentMapped());
     allocator->Free(block);
     _recursive_mutex.unlock();
 }
 
+void MemoryManager::GetStatistics(uint32_t memoryTypeCount, MemoryTypeStatistics* stats)
+{
+    memset(stats, 0, sizeof(MemoryTypeStatistics) * memoryTypeCount);
+
+    _recursive_mutex.lock();
+    for (uint32_t i = 0; i < memoryTypeCount; i++)
+    {
+        MemoryTypeStatistics& typeStats = stats[i];
+        for (bool persistentMapped : { false, true })
+        {
+            auto& allocators = persistentMapped ? _allocatorsByMemoryType : _allocatorsByMemoryTypeUnmapped;
+            auto allocator = allocators.find(i);
+            if (allocator != allocators.end())
+            {
+                allocator->second->AddStatistics(&typeStats);
+            }
+
+            auto& slabAllocators = persistentMapped ? _slabAllocatorsByMemoryType : _slabAllocatorsByMemoryTypeUnmapped;
+            auto slabAllocator = slabAllocators.find(i);
+            if (slabAllocator != slabAllocators.end())
+            {
+                slabAllocator->second->AddStatistics(&typeStats);
+            }
+        }
+
+        typeStats.DedicatedAllocationCount = _dedicatedAllocationCounts[i];
+        typeStats.DedicatedBytes = _dedicatedBytes[i];
+
+        uint64_t freeBytes = typeStats.ChunkBytes - typeStats.ChunkAllocatedBytes;
+        typeStats.Fragmentation = freeBytes == 0
+            ? 0.f
+            : 1.f - static_cast<float>(typeStats.LargestFreeBlock) / static_cast<float>(freeBytes);
+    }
+    _recursive_mutex.unlock();
+}
+
+void MemoryManager::NextFrame()
+{
+    _recursive_mutex.lock();
+    _frame += 1;
+    for (auto it : _allocatorsByMemoryType)
+    {
+        it.second->Trim(_frame, _trimFrameDelay, _trimMaxEmptyBytes);
+    }
+    for (auto it : _allocatorsByMemoryTypeUnmapped)
+    {
+        it.second->Trim(_frame, _trimFrameDelay, _trimMaxEmptyBytes);
+    }
+    _recursive_mutex.unlock();
+}
+
+void MemoryManager::Trim()
+{
+    // Cached blocks keep their slabs, and so their chunks, alive.
+    _threadCachesLock.lock();
+    for (MemoryThreadCache* cache : _threadCaches)
+    {
+        cache->Flush();
+    }
+    _threadCachesLock.unlock();
+
+    _recursive_mutex.lock();
+    for (auto it : _slabAllocatorsByMemoryType)
+    {
+        it.second->ReleaseEmptySlabs();
+    }
+    for (auto it : _slabAllocatorsByMemoryTypeUnmapped)
+    {
+        it.second->ReleaseEmptySlabs();
+    }
+    for (auto it : _allocatorsByMemoryType)
+    {
+        it.second->Trim(_frame, 0, 0);
+    }
+    for (auto it : _allocatorsByMemoryTypeUnmapped)
+    {
+        it.second->Trim(_frame, 0, 0);
+    }
+    _recursive_mutex.unlock();
+}
+
+void MemoryManager::SetTrimPolicy(uint32_t frameDelay, VkDeviceSize maxEmptyBytes)
+{
+    _recursive_mutex.lock();
+    _trimFrameDelay = frameDelay;
+    _trimMaxEmptyBytes = maxEmptyBytes;
+    _recursive_mutex.unlock();
+}
+
+void MemoryManager::SelectDefragmentationSources()
+{
+    _recursive_mutex.lock();
+    for (auto it : _allocatorsByMemoryTypeUnmapped)
+    {
+        it.second->SelectDefragmentationSources();
+    }
+    _recursive_mutex.unlock();
+}
+
+bool MemoryManager::IsDefragmentationSource(const MemoryBlock& block)
+{
+    if (block.IsDedicated || block.IsSlab || block.IsPersistentMapped())
+    {
+        return false;
+    }
+
+    _recursive_mutex.lock();
+    bool result = GetAllocator(block.MemoryTypeIndex, false)->IsDefragmentationSource(block);
+    _recursive_mutex.unlock();
+    return result;
+}
+
+bool MemoryManager::AllocateRelocation(const MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* newBlock)
+{
+    _recursive_mutex.lock();
+    bool result = GetAllocator(block.MemoryTypeIndex, false)->AllocateRelocation(size, alignment, newBlock);
+    _recursive_mutex.unlock();
+    return result;
+}
+
+void MemoryManager::WriteJson(std::ostream& json)
+{
+    _recursive_mutex.lock();
+    json << "{\"memoryTypes\":[";
+    bool firstType = true;
+    for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+    {
+        auto mapped = _allocatorsByMemoryType.find(i);
+        auto unmapped = _allocatorsByMemoryTypeUnmapped.find(i);
+        bool hasMapped = mapped != _allocatorsByMemoryType.end();
+        bool hasUnmapped = unmapped != _allocatorsByMemoryTypeUnmapped.end();
+        if (!hasMapped && !hasUnmapped && _dedicatedAllocationCounts[i] == 0)
+        {
+            continue;
+        }
+
+        if (!firstType)
+        {
+            json << ",";
+        }
+        firstType = false;
+
+        json << "{\"index\":" << i
+            << ",\"dedicatedAllocationCount\":" << _dedicatedAllocationCounts[i]
+            << ",\"dedicatedBytes\":" << _dedicatedBytes[i]
+            << ",\"chunks\":[";
+        if (hasUnmapped)
+        {
+            unmapped->second->WriteJson(json);
+        }
+        json << "],\"persistentMappedChunks\":[";
+        if (hasMapped)
+        {
+            mapped->second->WriteJson(json);
+        }
+        json << "]}";
+    }
+    json << "]}";
+    _recursive_mutex.unlock();
+}
+
 ChunkAllocatorSet* MemoryManager::GetAllocator(uint32_t memoryTypeIndex, bool persistentMapped)
 {
     ChunkAllocatorSet* ret;
@@ -86,4 +406,87 @@ ChunkAllocatorSet* MemoryManager::GetAllocator(uint32_t memoryTypeIndex, bool pe
 
     return ret;
 }
+
+MemoryThreadCache* MemoryManager::GetThreadCache()
+{
+    for (ThreadCacheEntry& entry : t_threadCaches.Entries)
+    {
+        if (entry.ManagerId == _id)
+        {
+            return entry.Cache;
+        }
+    }
+
+    MemoryThreadCache* cache = new MemoryThreadCache(this);
+    _threadCachesLock.lock();
+    _threadCaches.push_back(cache);
+    _threadCachesLock.unlock();
+
+    ThreadCacheEntry entry;
+    entry.ManagerId = _id;
+    entry.Manager = this;
+    entry.Cache = cache;
+    t_threadCaches.Entries.push_back(entry);
+    return cache;
+}
+
+void MemoryManager::ReleaseThreadCache(MemoryThreadCache* cache)
+{
+    cache->Flush();
+
+    _threadCachesLock.lock();
+    auto it = std::find(_threadCaches.begin(), _threadCaches.end(), cache);
+    if (it != _threadCaches.end())
+    {
+        _threadCaches.erase(it);
+    }
+    _threadCachesLock.unlock();
+
+    delete cache;
+}
+
+uint32_t MemoryManager::AllocateBatch(
+    uint32_t memoryTypeIndex,
+    bool persistentMapped,
+    uint32_t sizeClass,
+    uint32_t count,
+    MemoryBlock* blocks)
+{
+    _recursive_mutex.lock();
+    SlabAllocator* allocator = GetSlabAllocator(memoryTypeIndex, persistentMapped);
+    uint32_t allocated = 0;
+    while (allocated < count && allocator->Allocate(sizeClass, &blocks[allocated]))
+    {
+        allocated += 1;
+    }
+    _recursive_mutex.unlock();
+
+    return allocated;
+}
+
+void MemoryManager::FreeBatch(const MemoryBlock* blocks, uint32_t count)
+{
+    _recursive_mutex.lock();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        GetSlabAllocator(blocks[i].MemoryTypeIndex, blocks[i].IsPersistentMapped())->Free(blocks[i]);
+    }
+    _recursive_mutex.unlock();
+}
+
+SlabAllocator* MemoryManager::GetSlabAllocator(uint32_t memoryTypeIndex, bool persistentMapped)
+{
+    std::unordered_map<uint32_t, SlabAllocator*>& slabAllocators = persistentMapped
+        ? _slabAllocatorsByMemoryType
+        : _slabAllocatorsByMemoryTypeUnmapped;
+    auto iter = slabAllocators.find(memoryTypeIndex);
+    if (iter != slabAllocators.end())
+    {
+        return iter->second;
+    }
+
+    SlabAllocator* ret = new SlabAllocator(GetAllocator(memoryTypeIndex, persistentMapped));
+    slabAllocators.emplace(memoryTypeIndex, ret);
+    return ret;
+}
 }
\ No newline at end of file
@@ -5,30 +5,91 @@
 #include "ChunkAllocatorSet.hpp"
 #include "ChunkAllocator.hpp"
 #include "MemoryBlock.hpp"
+#include "MemoryThreadCache.hpp"
+#include "SlabAllocator.hpp"
+#include "MemoryStatistics.hpp"
+#include <ostream>
+#include <vector>
 
 namespace Veldrid
 {
 class MemoryManager
 {
 public:
-    void Init(VkDevice device, VkPhysicalDevice physicalDevice);
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, bool dedicatedAllocationEnabled);
     ~MemoryManager();
     MemoryBlock Allocate(
         VkPhysicalDeviceMemoryProperties memProperties,
         uint32_t memoryTypeBits,
         VkMemoryPropertyFlags flags,
+        VkMemoryPropertyFlags preferredFlags,
         bool persistentMapped,
         VkDeviceSize size,
-        VkDeviceSize alignment);
+        VkDeviceSize alignment,
+        bool prefersDedicated = false,
+        VkImage dedicatedImage = VK_NULL_HANDLE,
+        VkBuffer dedicatedBuffer = VK_NULL_HANDLE);
     void Free(MemoryBlock block);
+    // Fills one entry per memory type; HeapIndex and PropertyFlags are left for the caller.
+    void GetStatistics(uint32_t memoryTypeCount, MemoryTypeStatistics* stats);
+    void WriteJson(std::ostream& json);
+    // Called once per frame; releases chunks according to the trim policy.
+    void NextFrame();
+    // Returns all cached and empty memory to the driver immediately.
+    void Trim();
+    void SetTrimPolicy(uint32_t frameDelay, VkDeviceSize maxEmptyBytes);
+    // Defragmentation only moves blocks sub-allocated from unmapped chunks; slab, dedicated and
+    // persistently mapped blocks stay where they are.
+    void SelectDefragmentationSources();
+    bool IsDefragmentationSource(const MemoryBlock& block);
+    // Allocates a denser home for a block in a defragmentation source, or returns false.
+    bool AllocateRelocation(const MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, MemoryBlock* newBlock);
 
 private:
+    friend class MemoryThreadCache;
+    friend struct ThreadCacheTable;
+
+    // Requests at or above these sizes get their own VkDeviceMemory instead of a chunk sub-allocation.
+    static const VkDeviceSize UnmappedDedicatedThreshold = 1024 * 1024 * 32;
+    static const VkDeviceSize PersistentMappedDedicatedThreshold = 1024 * 1024 * 8;
+    static const uint32_t DefaultTrimFrameDelay = 120;
+    static const VkDeviceSize DefaultTrimMaxEmptyBytes = 1024 * 1024 * 256;
+
     VkDevice _device;
     VkPhysicalDevice _physicalDevice;
+    bool _dedicatedAllocationEnabled;
+    // Never reused, so a thread's cache table can tell a destroyed manager from a new one at the same address.
+    uint64_t _id;
     std::recursive_mutex _recursive_mutex;
     std::unordered_map<uint32_t, ChunkAllocatorSet*> _allocatorsByMemoryTypeUnmapped;
     std::unordered_map<uint32_t, ChunkAllocatorSet*> _allocatorsByMemoryType;
+    std::unordered_map<uint32_t, SlabAllocator*> _slabAllocatorsByMemoryTypeUnmapped;
+    std::unordered_map<uint32_t, SlabAllocator*> _slabAllocatorsByMemoryType;
+    uint64_t _frame = 0;
+    uint32_t _trimFrameDelay = DefaultTrimFrameDelay;
+    VkDeviceSize _trimMaxEmptyBytes = DefaultTrimMaxEmptyBytes;
+    uint32_t _dedicatedAllocationCounts[VK_MAX_MEMORY_TYPES] = {};
+    VkDeviceSize _dedicatedBytes[VK_MAX_MEMORY_TYPES] = {};
+    // Lock order: a thread cache's lock may be held while taking _recursive_mutex, never the reverse.
+    std::mutex _threadCachesLock;
+    std::vector<MemoryThreadCache*> _threadCaches;
 
     ChunkAllocatorSet* GetAllocator(uint32_t memoryTypeIndex, bool persistentMapped);
+    SlabAllocator* GetSlabAllocator(uint32_t memoryTypeIndex, bool persistentMapped);
+    MemoryBlock AllocateDedicated(
+        uint32_t memoryTypeIndex,
+        bool persistentMapped,
+        VkDeviceSize size,
+        VkImage dedicatedImage,
+        VkBuffer dedicatedBuffer);
+    MemoryThreadCache* GetThreadCache();
+    void ReleaseThreadCache(MemoryThreadCache* cache);
+    uint32_t AllocateBatch(
+        uint32_t memoryTypeIndex,
+        bool persistentMapped,
+        uint32_t sizeClass,
+        uint32_t count,
+        MemoryBlock* blocks);
+    void FreeBatch(const MemoryBlock* blocks, uint32_t count);
 };
 }
\ No newline at end of file
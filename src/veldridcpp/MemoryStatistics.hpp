@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+namespace Veldrid
+{
+// Device memory held by one memory type. Blocks parked in per-thread caches count as allocated.
+struct MemoryTypeStatistics
+{
+    uint32_t HeapIndex;
+    uint32_t PropertyFlags;
+
+    // Sub-allocated chunks. ChunkAllocatedBytes includes whole slabs.
+    uint32_t ChunkCount;
+    uint32_t ChunkAllocationCount;
+    uint64_t ChunkBytes;
+    uint64_t ChunkAllocatedBytes;
+    uint32_t FreeBlockCount;
+    uint64_t LargestFreeBlock;
+    // 0 when all free chunk space is one block; approaches 1 as it is split into many small ones.
+    float Fragmentation;
+
+    uint32_t SlabCount;
+    uint32_t SlabAllocationCount;
+    uint64_t SlabBytes;
+    uint64_t SlabAllocatedBytes;
+
+    uint32_t DedicatedAllocationCount;
+    uint64_t DedicatedBytes;
+};
+
+struct MemoryHeapStatistics
+{
+    uint64_t Size;
+    uint32_t Flags;
+    // True if Budget and Usage come from VK_EXT_memory_budget. Otherwise Budget is the heap size
+    // and Usage is the memory held by this GraphicsDevice.
+    bool BudgetIsDriverReported;
+    uint64_t Budget;
+    uint64_t Usage;
+    // VkDeviceMemory held by this GraphicsDevice (chunks and dedicated allocations).
+    uint64_t DeviceMemoryBytes;
+    // Bytes handed out to resources.
+    uint64_t AllocatedBytes;
+};
+}
@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "MemoryThreadCache.hpp"
+#include "MemoryManager.hpp"
+#include <algorithm>
+
+namespace Veldrid
+{
+MemoryThreadCache::MemoryThreadCache(MemoryManager* manager)
+{
+    _manager = manager;
+}
+
+uint32_t MemoryThreadCache::GetBatchSize(uint32_t sizeClass)
+{
+    // Refill roughly 64 KB at a time, but always at least a couple of blocks.
+    uint32_t count = 1u << (SlabAllocator::SizeClassCount - 1 - sizeClass);
+    return std::min(std::max(count, 2u), 32u);
+}
+
+bool MemoryThreadCache::Allocate(uint32_t memoryTypeIndex, bool persistentMapped, uint32_t sizeClass, MemoryBlock* block)
+{
+    _mutex.lock();
+    std::vector<MemoryBlock>& freeBlocks = _freeBlocks[memoryTypeIndex][persistentMapped ? 1 : 0][sizeClass];
+    if (freeBlocks.size() == 0)
+    {
+        uint32_t batchSize = GetBatchSize(sizeClass);
+        freeBlocks.resize(batchSize);
+        uint32_t allocated = _manager->AllocateBatch(
+            memoryTypeIndex,
+            persistentMapped,
+            sizeClass,
+            batchSize,
+            freeBlocks.data());
+        freeBlocks.resize(allocated);
+
+        if (allocated == 0)
+        {
+            _mutex.unlock();
+            return false;
+        }
+    }
+
+    *block = freeBlocks.back();
+    freeBlocks.pop_back();
+    _mutex.unlock();
+    return true;
+}
+
+void MemoryThreadCache::Free(MemoryBlock block, uint32_t sizeClass)
+{
+    _mutex.lock();
+    std::vector<MemoryBlock>& freeBlocks = _freeBlocks[block.MemoryTypeIndex][block.IsPersistentMapped() ? 1 : 0][sizeClass];
+    freeBlocks.push_back(block);
+
+    uint32_t batchSize = GetBatchSize(sizeClass);
+    if (freeBlocks.size() > batchSize * 2)
+    {
+        // Give back the oldest half; the most recently freed blocks are the likeliest to be reused.
+        _manager->FreeBatch(freeBlocks.data(), batchSize);
+        freeBlocks.erase(freeBlocks.begin(), freeBlocks.begin() + batchSize);
+    }
+    _mutex.unlock();
+}
+
+void MemoryThreadCache::Flush()
+{
+    _mutex.lock();
+    for (uint32_t memoryType = 0; memoryType < VK_MAX_MEMORY_TYPES; memoryType++)
+    {
+        for (uint32_t mapped = 0; mapped < 2; mapped++)
+        {
+            for (uint32_t sizeClass = 0; sizeClass < SlabAllocator::SizeClassCount; sizeClass++)
+            {
+                std::vector<MemoryBlock>& freeBlocks = _freeBlocks[memoryType][mapped][sizeClass];
+                if (freeBlocks.size() > 0)
+                {
+                    _manager->FreeBatch(freeBlocks.data(), static_cast<uint32_t>(freeBlocks.size()));
+                    freeBlocks.clear();
+                }
+            }
+        }
+    }
+    _mutex.unlock();
+}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "vulkan.h"
+#include "MemoryBlock.hpp"
+#include "SlabAllocator.hpp"
+
+namespace Veldrid
+{
+class MemoryManager;
+
+// Per-thread cache of SlabAllocator blocks. Blocks are taken from and returned to the
+// MemoryManager in batches so that most allocations and frees never touch the shared allocator lock.
+class MemoryThreadCache
+{
+public:
+    MemoryThreadCache(MemoryManager* manager);
+
+    bool Allocate(uint32_t memoryTypeIndex, bool persistentMapped, uint32_t sizeClass, MemoryBlock* block);
+    void Free(MemoryBlock block, uint32_t sizeClass);
+    // Returns every cached block to the MemoryManager.
+    void Flush();
+
+private:
+    MemoryManager* _manager;
+    std::mutex _mutex;
+    std::vector<MemoryBlock> _freeBlocks[VK_MAX_MEMORY_TYPES][2][SlabAllocator::SizeClassCount];
+
+    static uint32_t GetBatchSize(uint32_t sizeClass);
+};
+}
@@ -3,12 +3,14 @@
 #include "FormatHelpers.hpp"
 #include "VkFormats.hpp"
 #include <array>
+#include <algorithm>
 
 namespace Veldrid
 {
 Pipeline::Pipeline(GraphicsDevice* gd, const GraphicsPipelineDescription& description)
 {
     _gd = gd;
+    IsComputePipeline = false;
 
     VkGraphicsPipelineCreateInfo pipelineCI = {};
     pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -196,6 +198,7 @@ Pipeline::Pipeline(GraphicsDevice* gd, const GraphicsPipelineDescription& descri
 
     vkCreatePipelineLayout(_gd->GetVkDevice(), &pipelineLayoutCI, nullptr, &_pipelineLayout);
     pipelineCI.layout = _pipelineLayout;
+    _setLayouts = dsls;
 
     // Create fake RenderPass for compatibility.
 
@@ -284,6 +287,21 @@ Pipeline::Pipeline(GraphicsDevice* gd, const GraphicsPipelineDescription& descri
     ResourceSetCount = description.ResourceLayouts.Count;
 }
 
+uint32_t Pipeline::GetCompatibleSetCount(const Pipeline& other) const
+{
+    // Pipeline layouts are compatible up to a set if they share the layouts of every set up to it, and their
+    // push constant ranges, which are never used here. ResourceLayouts each own their set layout, so sets
+    // match when they were created from the same ResourceLayout.
+    uint32_t count = std::min(ResourceSetCount, other.ResourceSetCount);
+    uint32_t compatible = 0;
+    while (compatible < count && _setLayouts[compatible] == other._setLayouts[compatible])
+    {
+        compatible += 1;
+    }
+
+    return compatible;
+}
+
 VD_EXPORT void VdPipeline_Dispose(Pipeline* pipeline)
 {
     delete pipeline;
@@ -2,6 +2,7 @@
 #include "GraphicsDevice.hpp"
 #include "GraphicsPipelineDescription.hpp"
 #include "vulkan.h"
+#include <vector>
 
 namespace Veldrid
 {
@@ -14,10 +15,14 @@ public:
     uint32_t ResourceSetCount;
     bool IsComputePipeline;
     VkPipelineLayout PipelineLayout() const { return _pipelineLayout; }
+    // The number of leading resource sets laid out the same way in both pipelines. Descriptor sets bound
+    // for those stay bound when switching between them.
+    uint32_t GetCompatibleSetCount(const Pipeline& other) const;
 
 private:
     GraphicsDevice * _gd;
     VkPipelineLayout _pipelineLayout;
+    std::vector<VkDescriptorSetLayout> _setLayouts;
     VkRenderPass _renderPass;
 };
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "ReadbackPool.hpp"
+#include "GraphicsDevice.hpp"
+#include "VulkanUtil.hpp"
+
+namespace Veldrid
+{
+ReadbackPool::ReadbackPool(GraphicsDevice* gd)
+{
+    _gd = gd;
+}
+
+ReadbackPool::~ReadbackPool()
+{
+    for (auto& freeBuffers : _freeBuffers)
+    {
+        for (const ReadbackBuffer& buffer : freeBuffers)
+        {
+            DestroyBuffer(buffer);
+        }
+    }
+}
+
+ReadbackBuffer ReadbackPool::Acquire(VkDeviceSize size)
+{
+    uint32_t sizeClass = GetSizeClass(size);
+    _mutex.lock();
+    if (sizeClass < _freeBuffers.size() && _freeBuffers[sizeClass].size() > 0)
+    {
+        ReadbackBuffer ret = _freeBuffers[sizeClass].back();
+        _freeBuffers[sizeClass].pop_back();
+        _mutex.unlock();
+        return ret;
+    }
+    _mutex.unlock();
+
+    return CreateBuffer(MinCapacity << sizeClass);
+}
+
+void ReadbackPool::Release(const ReadbackBuffer& buffer)
+{
+    if (buffer.Capacity <= MaxPooledCapacity)
+    {
+        uint32_t sizeClass = GetSizeClass(buffer.Capacity);
+        _mutex.lock();
+        if (sizeClass >= _freeBuffers.size())
+        {
+            _freeBuffers.resize(sizeClass + 1);
+        }
+        if (_freeBuffers[sizeClass].size() < MaxFreeBuffersPerClass)
+        {
+            _freeBuffers[sizeClass].push_back(buffer);
+            _mutex.unlock();
+            return;
+        }
+        _mutex.unlock();
+    }
+
+    DestroyBuffer(buffer);
+}
+
+uint32_t ReadbackPool::GetSizeClass(VkDeviceSize size)
+{
+    uint32_t sizeClass = 0;
+    while ((MinCapacity << sizeClass) < size)
+    {
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+ReadbackBuffer ReadbackPool::CreateBuffer(VkDeviceSize capacity)
+{
+    ReadbackBuffer buffer;
+    buffer.Capacity = capacity;
+
+    VkBufferCreateInfo bufferCI = {};
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.size = capacity;
+    bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    CheckResult(vkCreateBuffer(_gd->GetVkDevice(), &bufferCI, nullptr, &buffer.Buffer));
+
+    VkMemoryRequirements memReqs;
+    bool prefersDedicated;
+    _gd->GetBufferMemoryRequirements(buffer.Buffer, &memReqs, &prefersDedicated);
+
+    _gd->PadToNonCoherentAtom(&memReqs);
+
+    // Reads from uncached memory are very slow, so take a cached type whenever there is one.
+    buffer.Memory = _gd->GetMemoryManager().Allocate(
+        _gd->GetPhysicalDeviceMemProperties(),
+        memReqs.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+        true,
+        memReqs.size,
+        memReqs.alignment,
+        prefersDedicated,
+        VK_NULL_HANDLE,
+        buffer.Buffer);
+    CheckResult(vkBindBufferMemory(_gd->GetVkDevice(), buffer.Buffer, buffer.Memory.DeviceMemory, buffer.Memory.Offset));
+
+    return buffer;
+}
+
+void ReadbackPool::DestroyBuffer(const ReadbackBuffer& buffer)
+{
+    vkDestroyBuffer(_gd->GetVkDevice(), buffer.Buffer, nullptr);
+    _gd->GetMemoryManager().Free(buffer.Memory);
+}
+}
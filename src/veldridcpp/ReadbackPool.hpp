@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "vulkan.h"
+#include "MemoryBlock.hpp"
+
+namespace Veldrid
+{
+class GraphicsDevice;
+
+struct ReadbackBuffer
+{
+    VkBuffer Buffer;
+    MemoryBlock Memory;
+    VkDeviceSize Capacity;
+};
+
+// Host-visible readback buffers, host-cached where the device offers it. Capacities are rounded up to a
+// power of two, and released buffers are kept for reuse by later readbacks of the same size class.
+class ReadbackPool
+{
+public:
+    ReadbackPool(GraphicsDevice* gd);
+    ~ReadbackPool();
+
+    ReadbackBuffer Acquire(VkDeviceSize size);
+    // The GPU must be done with the buffer.
+    void Release(const ReadbackBuffer& buffer);
+
+private:
+    static const VkDeviceSize MinCapacity = 64 * 1024;
+    // Larger buffers are destroyed on release rather than held on to.
+    static const VkDeviceSize MaxPooledCapacity = 1024 * 1024 * 16;
+    static const size_t MaxFreeBuffersPerClass = 4;
+
+    GraphicsDevice* _gd;
+    std::mutex _mutex;
+    // Indexed by size class; class i holds buffers of MinCapacity << i bytes.
+    std::vector<std::vector<ReadbackBuffer>> _freeBuffers;
+
+    static uint32_t GetSizeClass(VkDeviceSize size);
+    ReadbackBuffer CreateBuffer(VkDeviceSize capacity);
+    void DestroyBuffer(const ReadbackBuffer& buffer);
+};
+}
@@ -0,0 +1,51 @@
+#include "stdafx.h"
+#include "ReadbackTicket.hpp"
+#include "GraphicsDevice.hpp"
+#include "VulkanUtil.hpp"
+
+namespace Veldrid
+{
+ReadbackTicket::ReadbackTicket(GraphicsDevice* gd, VkDeviceSize sizeInBytes, uint32_t rowPitch, uint32_t depthPitch)
+{
+    _gd = gd;
+    _size = sizeInBytes;
+    _rowPitch = rowPitch;
+    _depthPitch = depthPitch;
+    _isComplete = false;
+    _isDisposed = false;
+    _buffer = _gd->GetReadbackPool().Acquire(sizeInBytes);
+}
+
+ReadbackTicket::~ReadbackTicket()
+{
+    _gd->GetReadbackPool().Release(_buffer);
+}
+
+VdResult ReadbackTicket::Map(MappedResource* mappedResource)
+{
+    if (!_isComplete)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    if (!_isInvalidated)
+    {
+        _gd->InvalidateMappedMemory(_buffer.Memory, 0, _size);
+        _isInvalidated = true;
+    }
+
+    mappedResource->Mode = MapMode::Read;
+    mappedResource->Data = _buffer.Memory.BlockMappedPointer();
+    mappedResource->SizeInBytes = static_cast<uint32_t>(_size);
+    mappedResource->Subresource = 0;
+    mappedResource->RowPitch = _rowPitch;
+    mappedResource->DepthPitch = _depthPitch;
+
+    return VdResult::Success;
+}
+
+VD_EXPORT bool VdReadbackTicket_IsComplete(ReadbackTicket* ticket)
+{
+    return ticket->IsComplete();
+}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "vulkan.h"
+#include "VdResult.hpp"
+#include "ReadbackPool.hpp"
+#include "MappedResource.hpp"
+
+namespace Veldrid
+{
+class GraphicsDevice;
+
+// The destination of a GraphicsDevice::ReadbackBuffer or ReadbackTexture call: a buffer from the device's
+// ReadbackPool, which the copy lands in once its command buffer has completed.
+class ReadbackTicket
+{
+public:
+    ReadbackTicket(GraphicsDevice* gd, VkDeviceSize sizeInBytes, uint32_t rowPitch, uint32_t depthPitch);
+    ~ReadbackTicket();
+
+    VkBuffer GetVkBuffer() const { return _buffer.Buffer; }
+    VkDeviceSize GetSizeInBytes() const { return _size; }
+    VkCommandBuffer GetCommandBuffer() const { return _commandBuffer; }
+    void SetCommandBuffer(VkCommandBuffer cb) { _commandBuffer = cb; }
+
+    bool IsComplete() const { return _isComplete; }
+    void Completed() { _isComplete = true; }
+    bool IsDisposed() const { return _isDisposed; }
+    void Dispose() { _isDisposed = true; }
+
+    // Exposes the read-back data. Fails with InvalidOperation until the ticket is complete.
+    VdResult Map(MappedResource* mappedResource);
+
+private:
+    GraphicsDevice* _gd;
+    ReadbackBuffer _buffer;
+    VkDeviceSize _size;
+    uint32_t _rowPitch;
+    uint32_t _depthPitch;
+    bool _isInvalidated = false;
+    VkCommandBuffer _commandBuffer = VK_NULL_HANDLE;
+    std::atomic<bool> _isComplete;
+    std::atomic<bool> _isDisposed;
+};
+}
@@ -26,6 +26,11 @@ CommandList* ResourceFactory::CreateCommandList() const
     return new CommandList(_device);
 }
 
+CommandList* ResourceFactory::CreateSecondaryCommandList() const
+{
+    return new CommandList(_device, true);
+}
+
 Framebuffer* ResourceFactory::CreateFramebuffer(const FramebufferDescription &description) const
 {
     return new Framebuffer(_device, description, false);
@@ -76,6 +81,11 @@ VD_EXPORT CommandList* VdResourceFactory_CreateCommandList(ResourceFactory* fact
     return factory->CreateCommandList();
 }
 
+VD_EXPORT CommandList* VdResourceFactory_CreateSecondaryCommandList(ResourceFactory* factory)
+{
+    return factory->CreateSecondaryCommandList();
+}
+
 VD_EXPORT Texture* VdResourceFactory_CreateTexture(ResourceFactory* factory, TextureDescription* description)
 {
     return factory->CreateTexture(*description);
@@ -24,6 +24,7 @@ public:
     Sampler* CreateSampler(const SamplerDescription & description) const;
     Texture* CreateTexture(const TextureDescription& description) const;
     CommandList* CreateCommandList() const;
+    CommandList* CreateSecondaryCommandList() const;
     Framebuffer* CreateFramebuffer(const FramebufferDescription& description) const;
     Swapchain* CreateSwapchain(const SwapchainDescription& description) const;
     Shader* CreateShader(const ShaderDescription& description) const;
@@ -9,53 +9,208 @@ ResourceSet::ResourceSet(GraphicsDevice * gd, const ResourceSetDescription & des
     _gd = gd;
     ResourceLayout* vkLayout = description.Layout;
 
-    VkDescriptorSetLayout dsl = vkLayout->DescriptorSetLayout();
+    _descriptorSetLayout = vkLayout->DescriptorSetLayout();
     _descriptorCounts = vkLayout->DescriptorCounts();
-    _descriptorAllocationToken = _gd->GetDescriptorPoolManager().Allocate(_descriptorCounts, dsl);
+    _descriptorTypes = vkLayout->DescriptorTypes();
 
     const InteropArray<void*>& boundResources = description.BoundResources;
     uint32_t descriptorWriteCount = boundResources.Count;
+    _boundResources.assign(boundResources.Data, boundResources.Data + descriptorWriteCount);
+    _bufferInfos.resize(descriptorWriteCount);
+    _imageInfos.resize(descriptorWriteCount);
+    for (uint32_t i = 0; i < descriptorWriteCount; i++)
+    {
+        UpdateDescriptorInfo(i);
+        VkDescriptorType type = _descriptorTypes[i];
+        if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+        {
+            DeviceBuffer* buffer = (DeviceBuffer*)_boundResources[i];
+            if (buffer->IsVersioned())
+            {
+                _dynamicBufferIndices.push_back(i);
+            }
+            else if (buffer->IsUseTracked())
+            {
+                _trackedBufferIndices.push_back(i);
+            }
+        }
+    }
+
+    _descriptorAllocationToken = _gd->GetDescriptorPoolManager().Allocate(_descriptorCounts, _descriptorSetLayout);
+    WriteDescriptorSet(_descriptorAllocationToken.Set);
+    if (_dynamicBufferIndices.size() > 0)
+    {
+        GetCurrentVersions(&_currentVersions);
+        _versionedSets.push_back({ _currentVersions, _descriptorAllocationToken });
+    }
+
+    _gd->RegisterResource(this);
+}
+
+ResourceSet::~ResourceSet()
+{
+    _gd->UnregisterResource(this);
+}
+
+bool ResourceSet::References(const std::unordered_set<void*>& resources) const
+{
+    for (void* resource : _boundResources)
+    {
+        if (resources.count(resource) != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ResourceSet::Rewrite(const std::unordered_set<void*>& relocatedResources, std::vector<DescriptorAllocationToken>* oldSets)
+{
+    _versionedSetsLock.lock();
+    for (uint32_t i = 0; i < _boundResources.size(); i++)
+    {
+        if (relocatedResources.count(_boundResources[i]) != 0)
+        {
+            UpdateDescriptorInfo(i);
+        }
+    }
+    for (uint32_t index : _dynamicBufferIndices)
+    {
+        UpdateDescriptorInfo(index);
+    }
+
+    // The old sets may still be in use by submitted work, so they can't be updated in place.
+    oldSets->push_back(_descriptorAllocationToken);
+    for (const VersionedSet& versionedSet : _versionedSets)
+    {
+        if (versionedSet.Token.Set != _descriptorAllocationToken.Set)
+        {
+            oldSets->push_back(versionedSet.Token);
+        }
+    }
+    _versionedSets.clear();
+
+    _descriptorAllocationToken = _gd->GetDescriptorPoolManager().Allocate(_descriptorCounts, _descriptorSetLayout);
+    WriteDescriptorSet(_descriptorAllocationToken.Set);
+    if (_dynamicBufferIndices.size() > 0)
+    {
+        GetCurrentVersions(&_currentVersions);
+        _versionedSets.push_back({ _currentVersions, _descriptorAllocationToken });
+    }
+    _versionedSetsLock.unlock();
+}
+
+void ResourceSet::GetCurrentVersions(std::vector<uint32_t>* versions) const
+{
+    versions->resize(_dynamicBufferIndices.size());
+    for (uint32_t i = 0; i < _dynamicBufferIndices.size(); i++)
+    {
+        (*versions)[i] = ((DeviceBuffer*)_boundResources[_dynamicBufferIndices[i]])->GetVersion();
+    }
+}
 
+VkDescriptorSet ResourceSet::GetDescriptorSet(std::vector<std::pair<DeviceBuffer*, uint32_t>>* usedVersions)
+{
+    for (uint32_t index : _trackedBufferIndices)
+    {
+        DeviceBuffer* buffer = (DeviceBuffer*)_boundResources[index];
+        buffer->MarkVersionPending(0);
+        usedVersions->push_back(std::make_pair(buffer, 0u));
+    }
+
+    if (_dynamicBufferIndices.size() == 0)
+    {
+        return _descriptorAllocationToken.Set;
+    }
+
+    _versionedSetsLock.lock();
+    // Reused between calls, so that draws don't allocate once every version has a set.
+    std::vector<uint32_t>& versions = _currentVersions;
+    GetCurrentVersions(&versions);
+    for (uint32_t i = 0; i < _dynamicBufferIndices.size(); i++)
+    {
+        DeviceBuffer* buffer = (DeviceBuffer*)_boundResources[_dynamicBufferIndices[i]];
+        buffer->MarkVersionPending(versions[i]);
+        usedVersions->push_back(std::make_pair(buffer, versions[i]));
+    }
+
+    VkDescriptorSet result = VK_NULL_HANDLE;
+    for (const VersionedSet& versionedSet : _versionedSets)
+    {
+        if (versionedSet.Versions == versions)
+        {
+            result = versionedSet.Token.Set;
+            break;
+        }
+    }
+
+    if (result == VK_NULL_HANDLE)
+    {
+        for (uint32_t index : _dynamicBufferIndices)
+        {
+            UpdateDescriptorInfo(index);
+        }
+        DescriptorAllocationToken token = _gd->GetDescriptorPoolManager().Allocate(_descriptorCounts, _descriptorSetLayout);
+        WriteDescriptorSet(token.Set);
+        _versionedSets.push_back({ versions, token });
+        result = token.Set;
+    }
+    _versionedSetsLock.unlock();
+
+    return result;
+}
+
+void ResourceSet::UpdateDescriptorInfo(uint32_t index)
+{
+    VkDescriptorType type = _descriptorTypes[index];
+    if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+    {
+        DeviceBuffer* vkBuffer = (DeviceBuffer*)_boundResources[index];
+        _bufferInfos[index].buffer = vkBuffer->GetVkBuffer();
+        _bufferInfos[index].range = vkBuffer->GetSizeInBytes();
+    }
+    else if (type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE)
+    {
+        TextureView* textureView = (TextureView*)_boundResources[index];
+        _imageInfos[index].imageView = textureView->GetVkImageView();
+        _imageInfos[index].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    else if (type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
+    {
+        TextureView* textureView = (TextureView*)_boundResources[index];
+        _imageInfos[index].imageView = textureView->GetVkImageView();
+        _imageInfos[index].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+    else if (type == VkDescriptorType::VK_DESCRIPTOR_TYPE_SAMPLER)
+    {
+        Sampler* sampler = (Sampler*)_boundResources[index];
+        _imageInfos[index].sampler = sampler->GetVkSampler();
+    }
+}
+
+void ResourceSet::WriteDescriptorSet(VkDescriptorSet set)
+{
+    uint32_t descriptorWriteCount = static_cast<uint32_t>(_boundResources.size());
     std::vector<VkWriteDescriptorSet> descriptorWrites(descriptorWriteCount);
-    std::vector<VkDescriptorBufferInfo> bufferInfos(descriptorWriteCount);
-    std::vector<VkDescriptorImageInfo> imageInfos(descriptorWriteCount);
 
     for (uint32_t i = 0; i < descriptorWriteCount; i++)
     {
-        VkDescriptorType type = vkLayout->DescriptorTypes()[i];
+        VkDescriptorType type = _descriptorTypes[i];
 
         descriptorWrites[i].sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[i].descriptorCount = 1;
         descriptorWrites[i].descriptorType = type;
         descriptorWrites[i].dstBinding = i;
-        descriptorWrites[i].dstSet = _descriptorAllocationToken.Set;
+        descriptorWrites[i].dstSet = set;
 
         if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
         {
-            DeviceBuffer* vkBuffer = (DeviceBuffer*)boundResources[i];
-            bufferInfos[i].buffer = vkBuffer->GetVkBuffer();
-            bufferInfos[i].range = vkBuffer->GetSizeInBytes();
-            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
-        }
-        else if (type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE)
-        {
-            TextureView* textureView = (TextureView*)boundResources[i];
-            imageInfos[i].imageView = textureView->GetVkImageView();
-            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptorWrites[i].pImageInfo = &imageInfos[i];
-        }
-        else if (type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
-        {
-            TextureView* textureView = (TextureView*)boundResources[i];
-            imageInfos[i].imageView = textureView->GetVkImageView();
-            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            descriptorWrites[i].pImageInfo = &imageInfos[i];
+            descriptorWrites[i].pBufferInfo = &_bufferInfos[i];
         }
-        else if (type == VkDescriptorType::VK_DESCRIPTOR_TYPE_SAMPLER)
+        else
         {
-            Sampler* sampler = (Sampler*)boundResources[i];
-            imageInfos[i].sampler = sampler->GetVkSampler();
-            descriptorWrites[i].pImageInfo = &imageInfos[i];
+            descriptorWrites[i].pImageInfo = &_imageInfos[i];
         }
     }
 
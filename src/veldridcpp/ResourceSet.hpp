@@ -7,6 +7,9 @@
 #include "Sampler.hpp"
 #include "vulkan.h"
 #include "DescriptorPoolManager.hpp"
+#include <unordered_set>
+#include <mutex>
+#include <vector>
 
 namespace Veldrid
 {
@@ -14,11 +17,45 @@ class ResourceSet
 {
 public:
     ResourceSet(GraphicsDevice* gd, const ResourceSetDescription& description);
-    VkDescriptorSet DescriptorSet() const { return _descriptorAllocationToken.Set; };
+    ~ResourceSet();
+    // Sets that bind Dynamic buffers keep one descriptor set per combination of buffer versions, written
+    // when first needed. Returns the set for the current versions and appends those versions, and any other
+    // use-tracked buffers, to usedVersions, marking them pending.
+    VkDescriptorSet GetDescriptorSet(std::vector<std::pair<DeviceBuffer*, uint32_t>>* usedVersions);
+    bool HasDynamicBuffers() const { return _dynamicBufferIndices.size() > 0; }
+    DescriptorResourceCounts GetDescriptorCounts() const { return _descriptorCounts; }
+
+    bool References(const std::unordered_set<void*>& resources) const;
+    // Writes a new descriptor set using the current handles of the given relocated resources.
+    // Appends the old sets, which must be kept alive until work using them has completed.
+    void Rewrite(const std::unordered_set<void*>& relocatedResources, std::vector<DescriptorAllocationToken>* oldSets);
 
 private:
     GraphicsDevice * _gd;
     DescriptorResourceCounts _descriptorCounts;
     DescriptorAllocationToken _descriptorAllocationToken;
+    VkDescriptorSetLayout _descriptorSetLayout;
+    std::vector<VkDescriptorType> _descriptorTypes;
+    std::vector<void*> _boundResources;
+    std::vector<VkDescriptorBufferInfo> _bufferInfos;
+    std::vector<VkDescriptorImageInfo> _imageInfos;
+
+    struct VersionedSet
+    {
+        std::vector<uint32_t> Versions;
+        DescriptorAllocationToken Token;
+    };
+    std::vector<uint32_t> _dynamicBufferIndices;
+    // Use-tracked buffers that aren't versioned.
+    std::vector<uint32_t> _trackedBufferIndices;
+    std::mutex _versionedSetsLock;
+    // Includes _descriptorAllocationToken, which was written with the versions current at creation.
+    std::vector<VersionedSet> _versionedSets;
+    // Scratch space for the current versions, guarded by _versionedSetsLock.
+    std::vector<uint32_t> _currentVersions;
+
+    void UpdateDescriptorInfo(uint32_t index);
+    void WriteDescriptorSet(VkDescriptorSet set);
+    void GetCurrentVersions(std::vector<uint32_t>* versions) const;
 };
-}
\ No newline at end of file
+}
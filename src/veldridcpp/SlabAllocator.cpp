@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include "SlabAllocator.hpp"
+#include "ChunkAllocatorSet.hpp"
+#include "BitOperations.hpp"
+#include "VeldridConfig.hpp"
+#include <algorithm>
+
+namespace Veldrid
+{
+SlabAllocator::SlabAllocator(ChunkAllocatorSet* chunks)
+{
+    _chunks = chunks;
+    for (uint32_t i = 0; i < SizeClassCount; i++)
+    {
+        _partialSlabs[i] = NullIndex;
+    }
+}
+
+bool SlabAllocator::GetSizeClass(VkDeviceSize size, VkDeviceSize alignment, uint32_t* sizeClass)
+{
+    VkDeviceSize classSize = std::max(std::max(size, alignment), VkDeviceSize(1) << MinBlockSizeLog2);
+    if (classSize > (VkDeviceSize(1) << MaxBlockSizeLog2))
+    {
+        return false;
+    }
+
+    uint32_t sizeLog2 = FindLastSetBit(classSize);
+    if ((classSize & (classSize - 1)) != 0)
+    {
+        sizeLog2 += 1;
+    }
+
+    *sizeClass = sizeLog2 - MinBlockSizeLog2;
+    return true;
+}
+
+bool SlabAllocator::Allocate(uint32_t sizeClass, MemoryBlock* block)
+{
+    uint32_t index = _partialSlabs[sizeClass];
+    if (index == NullIndex)
+    {
+        index = CreateSlab(sizeClass);
+        if (index == NullIndex)
+        {
+            return false;
+        }
+
+        PushPartial(index);
+    }
+
+    Slab& slab = _slabs[index];
+    uint32_t word = slab.FirstFreeWord;
+    while (slab.FreeBits[word] == 0)
+    {
+        word += 1;
+    }
+
+    slab.FirstFreeWord = word;
+    uint32_t bit = FindFirstSetBit(slab.FreeBits[word]);
+    slab.FreeBits[word] &= ~(uint64_t(1) << bit);
+    slab.FreeCount -= 1;
+    if (slab.FreeCount == 0)
+    {
+        RemovePartial(index);
+    }
+
+    uint32_t blockIndex = word * 64 + bit;
+    VkDeviceSize classSize = GetClassSize(sizeClass);
+    *block = MemoryBlock(
+        slab.Memory.DeviceMemory,
+        slab.Memory.Offset + blockIndex * classSize,
+        classSize,
+        slab.Memory.MemoryTypeIndex,
+        slab.Memory.BaseMappedPointer);
+    block->BlockIndex = blockIndex;
+    block->ChunkIndex = index;
+    block->IsSlab = true;
+    return true;
+}
+
+void SlabAllocator::Free(MemoryBlock block)
+{
+    uint32_t index = block.ChunkIndex;
+    Slab& slab = _slabs[index];
+    uint32_t word = block.BlockIndex / 64;
+    uint64_t mask = uint64_t(1) << (block.BlockIndex % 64);
+    VdAssert((slab.FreeBits[word] & mask) == 0, "Invalid MemoryBlock freed.");
+
+    slab.FreeBits[word] |= mask;
+    slab.FirstFreeWord = std::min(slab.FirstFreeWord, word);
+    slab.FreeCount += 1;
+    if (slab.FreeCount == 1)
+    {
+        PushPartial(index);
+    }
+
+    // Keep the last partial slab of a class around so that a single alloc/free pair doesn't churn slabs.
+    if (slab.FreeCount == slab.BlockCount
+        && (_partialSlabs[slab.SizeClass] != index || slab.NextPartial != NullIndex))
+    {
+        RemovePartial(index);
+        ReleaseSlab(index);
+    }
+}
+
+void SlabAllocator::ReleaseEmptySlabs()
+{
+    for (uint32_t sizeClass = 0; sizeClass < SizeClassCount; sizeClass++)
+    {
+        uint32_t index = _partialSlabs[sizeClass];
+        while (index != NullIndex)
+        {
+            uint32_t next = _slabs[index].NextPartial;
+            if (_slabs[index].FreeCount == _slabs[index].BlockCount)
+            {
+                RemovePartial(index);
+                ReleaseSlab(index);
+            }
+            index = next;
+        }
+    }
+}
+
+void SlabAllocator::AddStatistics(MemoryTypeStatistics* stats) const
+{
+    uint32_t slabCount = static_cast<uint32_t>(_slabs.size() - _unusedSlabs.size());
+    stats->SlabCount += slabCount;
+    stats->SlabBytes += slabCount * SlabSize;
+
+    // Released slabs are entirely free, so they contribute nothing below.
+    for (const Slab& slab : _slabs)
+    {
+        uint32_t allocatedCount = slab.BlockCount - slab.FreeCount;
+        stats->SlabAllocationCount += allocatedCount;
+        stats->SlabAllocatedBytes += allocatedCount * GetClassSize(slab.SizeClass);
+    }
+}
+
+uint32_t SlabAllocator::CreateSlab(uint32_t sizeClass)
+{
+    MemoryBlock memory;
+    // Aligning every slab to the largest class size keeps each block aligned to its own size.
+    if (!_chunks->Allocate(SlabSize, GetClassSize(SizeClassCount - 1), &memory))
+    {
+        return NullIndex;
+    }
+
+    uint32_t index;
+    if (_unusedSlabs.size() > 0)
+    {
+        index = _unusedSlabs.back();
+        _unusedSlabs.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(_slabs.size());
+        _slabs.emplace_back();
+    }
+
+    Slab& slab = _slabs[index];
+    slab.Memory = memory;
+    slab.SizeClass = sizeClass;
+    slab.BlockCount = static_cast<uint32_t>(SlabSize / GetClassSize(sizeClass));
+    slab.FreeCount = slab.BlockCount;
+    slab.FirstFreeWord = 0;
+    slab.PrevPartial = NullIndex;
+    slab.NextPartial = NullIndex;
+    for (uint32_t word = 0; word < BitmapWordCount; word++)
+    {
+        uint32_t firstBlock = word * 64;
+        if (firstBlock + 64 <= slab.BlockCount)
+        {
+            slab.FreeBits[word] = ~uint64_t(0);
+        }
+        else if (firstBlock < slab.BlockCount)
+        {
+            slab.FreeBits[word] = (uint64_t(1) << (slab.BlockCount - firstBlock)) - 1;
+        }
+        else
+        {
+            slab.FreeBits[word] = 0;
+        }
+    }
+
+    return index;
+}
+
+void SlabAllocator::ReleaseSlab(uint32_t index)
+{
+    _chunks->Free(_slabs[index].Memory);
+    _unusedSlabs.push_back(index);
+}
+
+void SlabAllocator::PushPartial(uint32_t index)
+{
+    Slab& slab = _slabs[index];
+    uint32_t head = _partialSlabs[slab.SizeClass];
+    slab.PrevPartial = NullIndex;
+    slab.NextPartial = head;
+    if (head != NullIndex)
+    {
+        _slabs[head].PrevPartial = index;
+    }
+
+    _partialSlabs[slab.SizeClass] = index;
+}
+
+void SlabAllocator::RemovePartial(uint32_t index)
+{
+    Slab& slab = _slabs[index];
+    if (slab.PrevPartial != NullIndex)
+    {
+        _slabs[slab.PrevPartial].NextPartial = slab.NextPartial;
+    }
+    else
+    {
+        _partialSlabs[slab.SizeClass] = slab.NextPartial;
+    }
+
+    if (slab.NextPartial != NullIndex)
+    {
+        _slabs[slab.NextPartial].PrevPartial = slab.PrevPartial;
+    }
+
+    slab.PrevPartial = NullIndex;
+    slab.NextPartial = NullIndex;
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "vulkan.h"
+#include "MemoryBlock.hpp"
+#include "MemoryStatistics.hpp"
+
+namespace Veldrid
+{
+class ChunkAllocatorSet;
+
+// Hands out fixed, power-of-two sized blocks (256 B to 64 KB) for one memory type.
+// Each slab is a 1 MB block carved out of a ChunkAllocatorSet and serves a single size class,
+// with a bitmap tracking which of its blocks are free.
+class SlabAllocator
+{
+public:
+    static const uint32_t MinBlockSizeLog2 = 8;
+    static const uint32_t MaxBlockSizeLog2 = 16;
+    static const uint32_t SizeClassCount = MaxBlockSizeLog2 - MinBlockSizeLog2 + 1;
+
+    SlabAllocator(ChunkAllocatorSet* chunks);
+
+    // Returns false if the request is too large (or too strictly aligned) to be served from a slab.
+    static bool GetSizeClass(VkDeviceSize size, VkDeviceSize alignment, uint32_t* sizeClass);
+    static VkDeviceSize GetClassSize(uint32_t sizeClass) { return VkDeviceSize(1) << (sizeClass + MinBlockSizeLog2); }
+
+    bool Allocate(uint32_t sizeClass, MemoryBlock* block);
+    void Free(MemoryBlock block);
+    // Returns every fully free slab to its chunk, including the one normally kept per size class.
+    void ReleaseEmptySlabs();
+    void AddStatistics(MemoryTypeStatistics* stats) const;
+
+private:
+    static const VkDeviceSize SlabSize = 1024 * 1024;
+    static const uint32_t MaxBlocksPerSlab = static_cast<uint32_t>(SlabSize >> MinBlockSizeLog2);
+    static const uint32_t BitmapWordCount = MaxBlocksPerSlab / 64;
+    static const uint32_t NullIndex = UINT32_MAX;
+
+    struct Slab
+    {
+        MemoryBlock Memory;
+        uint32_t SizeClass;
+        uint32_t BlockCount;
+        uint32_t FreeCount;
+        // Lowest bitmap word that may still contain a free block.
+        uint32_t FirstFreeWord;
+        uint32_t PrevPartial;
+        uint32_t NextPartial;
+        // One bit per block; set bits are free.
+        uint64_t FreeBits[BitmapWordCount];
+    };
+
+    ChunkAllocatorSet* _chunks;
+    std::vector<Slab> _slabs;
+    std::vector<uint32_t> _unusedSlabs;
+    // Slabs with at least one free block, per size class.
+    uint32_t _partialSlabs[SizeClassCount];
+
+    uint32_t CreateSlab(uint32_t sizeClass);
+    void ReleaseSlab(uint32_t index);
+    void PushPartial(uint32_t index);
+    void RemovePartial(uint32_t index);
+};
+}
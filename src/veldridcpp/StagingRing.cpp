@@ -0,0 +1,207 @@
+#include "stdafx.h"
+#include "StagingRing.hpp"
+#include "GraphicsDevice.hpp"
+#include "VulkanUtil.hpp"
+
+namespace Veldrid
+{
+StagingRing::StagingRing(GraphicsDevice* gd)
+{
+    _gd = gd;
+    _current = CreateSegment(InitialCapacity);
+}
+
+StagingRing::~StagingRing()
+{
+    for (Segment* segment : _retired)
+    {
+        DestroySegment(segment);
+    }
+    DestroySegment(_current);
+}
+
+StagingAllocation StagingRing::Allocate(VkCommandBuffer cb, VkDeviceSize size, VkDeviceSize alignment)
+{
+    _mutex.lock();
+    VkDeviceSize offset;
+    if (!TryAllocate(_current, cb, size, alignment, &offset))
+    {
+        VkDeviceSize capacity = _current->Capacity * 2;
+        while (capacity < size + alignment)
+        {
+            capacity *= 2;
+        }
+
+        // Spans still in flight keep the old segment alive.
+        if (_current->Spans.size() > 0)
+        {
+            _retired.push_back(_current);
+        }
+        else
+        {
+            DestroySegment(_current);
+        }
+        _current = CreateSegment(capacity);
+
+        bool result = TryAllocate(_current, cb, size, alignment, &offset);
+        VdAssert(result);
+    }
+
+    StagingAllocation ret;
+    ret.Buffer = _current->Buffer;
+    ret.Offset = offset;
+    ret.MappedPointer = _current->Memory.BlockMappedPointer() + offset;
+    ret.Position = _current->Head;
+    _mutex.unlock();
+
+    return ret;
+}
+
+StagingAllocation StagingRing::Reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+    return Allocate(VK_NULL_HANDLE, size, alignment);
+}
+
+void StagingRing::Commit(const StagingAllocation& allocation, VkCommandBuffer cb)
+{
+    _mutex.lock();
+    Segment* segment = _current;
+    for (uint32_t i = 0; segment->Buffer != allocation.Buffer; i++)
+    {
+        segment = _retired[i];
+    }
+
+    // Reservations are usually committed in order, so start from the newest span.
+    for (auto it = segment->Spans.rbegin(); it != segment->Spans.rend(); ++it)
+    {
+        if (it->End == allocation.Position)
+        {
+            VdAssert(it->CommandBuffer == VK_NULL_HANDLE);
+            it->CommandBuffer = cb;
+            break;
+        }
+    }
+    _mutex.unlock();
+}
+
+void StagingRing::Release(VkCommandBuffer cb)
+{
+    _mutex.lock();
+    Release(_current, cb);
+    for (uint32_t i = 0; i < _retired.size();)
+    {
+        Release(_retired[i], cb);
+        if (_retired[i]->Spans.size() == 0)
+        {
+            DestroySegment(_retired[i]);
+            _retired.erase(_retired.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    _mutex.unlock();
+}
+
+bool StagingRing::TryAllocate(Segment* segment, VkCommandBuffer cb, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+    // Alignments need not be powers of two (e.g. 12-byte texels), so align the offset, not the position.
+    VkDeviceSize headOffset = segment->Head % segment->Capacity;
+    VkDeviceSize alignedOffset = (headOffset + alignment - 1) / alignment * alignment;
+    uint64_t start;
+    if (alignedOffset + size > segment->Capacity)
+    {
+        // Wrap around rather than split the allocation.
+        alignedOffset = 0;
+        start = segment->Head + (segment->Capacity - headOffset);
+    }
+    else
+    {
+        start = segment->Head + (alignedOffset - headOffset);
+    }
+
+    if (start + size - segment->Tail > segment->Capacity)
+    {
+        return false;
+    }
+
+    segment->Head = start + size;
+    // Reservations each keep their own span, since they are committed separately.
+    if (cb != VK_NULL_HANDLE
+        && segment->Spans.size() > 0
+        && segment->Spans.back().CommandBuffer == cb
+        && !segment->Spans.back().IsCompleted)
+    {
+        segment->Spans.back().End = segment->Head;
+    }
+    else
+    {
+        Span span;
+        span.End = segment->Head;
+        span.CommandBuffer = cb;
+        span.IsCompleted = false;
+        segment->Spans.push_back(span);
+    }
+
+    *offset = alignedOffset;
+    return true;
+}
+
+void StagingRing::Release(Segment* segment, VkCommandBuffer cb)
+{
+    for (Span& span : segment->Spans)
+    {
+        if (span.CommandBuffer == cb)
+        {
+            span.IsCompleted = true;
+        }
+    }
+
+    // Submissions may complete out of order; space is only reclaimed from the tail.
+    while (segment->Spans.size() > 0 && segment->Spans.front().IsCompleted)
+    {
+        segment->Tail = segment->Spans.front().End;
+        segment->Spans.pop_front();
+    }
+}
+
+StagingRing::Segment* StagingRing::CreateSegment(VkDeviceSize capacity)
+{
+    Segment* segment = new Segment();
+    segment->Capacity = capacity;
+    segment->Head = 0;
+    segment->Tail = 0;
+
+    VkBufferCreateInfo bufferCI = {};
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.size = capacity;
+    bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    CheckResult(vkCreateBuffer(_gd->GetVkDevice(), &bufferCI, nullptr, &segment->Buffer));
+
+    VkMemoryRequirements memReqs;
+    bool prefersDedicated;
+    _gd->GetBufferMemoryRequirements(segment->Buffer, &memReqs, &prefersDedicated);
+    segment->Memory = _gd->GetMemoryManager().Allocate(
+        _gd->GetPhysicalDeviceMemProperties(),
+        memReqs.memoryTypeBits,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        0,
+        true,
+        memReqs.size,
+        memReqs.alignment,
+        prefersDedicated,
+        VK_NULL_HANDLE,
+        segment->Buffer);
+    CheckResult(vkBindBufferMemory(_gd->GetVkDevice(), segment->Buffer, segment->Memory.DeviceMemory, segment->Memory.Offset));
+
+    return segment;
+}
+
+void StagingRing::DestroySegment(Segment* segment)
+{
+    vkDestroyBuffer(_gd->GetVkDevice(), segment->Buffer, nullptr);
+    _gd->GetMemoryManager().Free(segment->Memory);
+    delete segment;
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "vulkan.h"
+#include "MemoryBlock.hpp"
+
+namespace Veldrid
+{
+class GraphicsDevice;
+
+struct StagingAllocation
+{
+    VkBuffer Buffer;
+    VkDeviceSize Offset;
+    uint8_t* MappedPointer;
+    // Ring position just past the allocation; identifies it to Commit.
+    uint64_t Position;
+};
+
+// A persistently mapped, host-coherent upload buffer that is carved out linearly. Space is tagged with the
+// command buffer that reads it and reclaimed, oldest first, once that command buffer has completed.
+// When the ring is full a larger one replaces it; the old ring is released after its last upload completes.
+class StagingRing
+{
+public:
+    StagingRing(GraphicsDevice* gd);
+    ~StagingRing();
+
+    // The space stays reserved until Release is called with the same command buffer.
+    StagingAllocation Allocate(VkCommandBuffer cb, VkDeviceSize size, VkDeviceSize alignment);
+    // Like Allocate, but the command buffer that reads the space is only given later, to Commit. Until then
+    // no space allocated after it can be reclaimed.
+    StagingAllocation Reserve(VkDeviceSize size, VkDeviceSize alignment);
+    void Commit(const StagingAllocation& allocation, VkCommandBuffer cb);
+    // Called once cb has completed.
+    void Release(VkCommandBuffer cb);
+
+private:
+    static const VkDeviceSize InitialCapacity = 1024 * 1024 * 16;
+
+    struct Span
+    {
+        // Ring position just past the span's last byte.
+        uint64_t End;
+        // VK_NULL_HANDLE while reserved.
+        VkCommandBuffer CommandBuffer;
+        bool IsCompleted;
+    };
+
+    struct Segment
+    {
+        VkBuffer Buffer;
+        MemoryBlock Memory;
+        VkDeviceSize Capacity;
+        // Monotonic positions; the byte offset of a position is position % Capacity.
+        uint64_t Head;
+        uint64_t Tail;
+        std::deque<Span> Spans;
+    };
+
+    GraphicsDevice* _gd;
+    std::mutex _mutex;
+    Segment* _current;
+    std::vector<Segment*> _retired;
+
+    Segment* CreateSegment(VkDeviceSize capacity);
+    void DestroySegment(Segment* segment);
+    static bool TryAllocate(Segment* segment, VkCommandBuffer cb, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+    static void Release(Segment* segment, VkCommandBuffer cb);
+};
+}
@@ -0,0 +1,286 @@
+#include "stdafx.h"
+#include "StreamingCopy.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define VD_TARGET(isa)
+#endif
+
+namespace Veldrid
+{
+// Below this, the setup of a streaming copy costs more than it saves.
+static const size_t MinStreamingCopySize = 4 * 1024;
+// Above this, the copy is split across threads. Each thread gets at least ParallelChunkSize bytes.
+static const size_t MinParallelCopySize = 8 * 1024 * 1024;
+static const size_t ParallelChunkSize = 2 * 1024 * 1024;
+static const uint32_t MaxCopyThreads = 4;
+
+typedef void(*CopyKernel)(uint8_t* destination, const uint8_t* source, size_t size);
+
+// Each kernel copies a head with memcpy until the destination is aligned, streams whole vectors and
+// finishes the tail with memcpy. The loads are unaligned since the source alignment is unknown.
+static void CopySse2(uint8_t* destination, const uint8_t* source, size_t size)
+{
+    size_t head = std::min(size, (16 - (reinterpret_cast<uintptr_t>(destination) & 15)) & 15);
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, destination += 64, source += 64)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(destination + 48), d);
+    }
+    for (; size >= 16; size -= 16, destination += 16, source += 16)
+    {
+        _mm_stream_si128(
+            reinterpret_cast<__m128i*>(destination),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+    }
+
+    _mm_sfence();
+    memcpy(destination, source, size);
+}
+
+VD_TARGET("avx2")
+static void CopyAvx2(uint8_t* destination, const uint8_t* source, size_t size)
+{
+    size_t head = std::min(size, (32 - (reinterpret_cast<uintptr_t>(destination) & 31)) & 31);
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 128; size -= 128, destination += 128, source += 128)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 96));
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(destination), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + 96), d);
+    }
+    for (; size >= 32; size -= 32, destination += 32, source += 32)
+    {
+        _mm256_stream_si256(
+            reinterpret_cast<__m256i*>(destination),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)));
+    }
+
+    _mm_sfence();
+    _mm256_zeroupper();
+    memcpy(destination, source, size);
+}
+
+VD_TARGET("avx512f")
+static void CopyAvx512(uint8_t* destination, const uint8_t* source, size_t size)
+{
+    size_t head = std::min(size, (64 - (reinterpret_cast<uintptr_t>(destination) & 63)) & 63);
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    for (; size >= 256; size -= 256, destination += 256, source += 256)
+    {
+        __m512i a = _mm512_loadu_si512(source);
+        __m512i b = _mm512_loadu_si512(source + 64);
+        __m512i c = _mm512_loadu_si512(source + 128);
+        __m512i d = _mm512_loadu_si512(source + 192);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(destination), a);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(destination + 64), b);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(destination + 128), c);
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(destination + 192), d);
+    }
+    for (; size >= 64; size -= 64, destination += 64, source += 64)
+    {
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(destination), _mm512_loadu_si512(source));
+    }
+
+    _mm_sfence();
+    _mm256_zeroupper();
+    memcpy(destination, source, size);
+}
+
+#ifdef _MSC_VER
+// AVX state must also be enabled by the OS (XCR0), not just reported by CPUID.
+static bool HasCpuFeature(int leaf, int registerIndex, int bit, uint64_t xcr0Mask)
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < leaf)
+    {
+        return false;
+    }
+    __cpuidex(info, leaf, 0);
+    if ((info[registerIndex] & (1 << bit)) == 0)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    const int OsxsaveBit = 1 << 27;
+    if ((info[2] & OsxsaveBit) == 0)
+    {
+        return false;
+    }
+    return (_xgetbv(0) & xcr0Mask) == xcr0Mask;
+}
+#endif
+
+static CopyKernel SelectCopyKernel()
+{
+#ifdef _MSC_VER
+    // XCR0: SSE and AVX state, plus opmask and upper ZMM state for AVX-512.
+    if (HasCpuFeature(7, 1, 16, 0xE6))
+    {
+        return CopyAvx512;
+    }
+    if (HasCpuFeature(7, 1, 5, 0x6))
+    {
+        return CopyAvx2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return CopyAvx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return CopyAvx2;
+    }
+#endif
+    return CopySse2;
+}
+
+// A few long-lived threads for splitting large copies. The calling thread copies one part itself.
+// The threads are detached and live until the process exits; joining them while the DLL unloads
+// would deadlock.
+class CopyWorkers
+{
+public:
+    CopyWorkers()
+    {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        _threadCount = std::min(MaxCopyThreads, std::max(1u, hardwareThreads / 2));
+        for (uint32_t i = 1; i < _threadCount; i++)
+        {
+            std::thread(&CopyWorkers::Run, this).detach();
+        }
+    }
+
+    uint32_t GetThreadCount() const { return _threadCount; }
+
+    void Copy(CopyKernel kernel, uint8_t* destination, const uint8_t* source, size_t size, uint32_t partCount)
+    {
+        // One large copy at a time; concurrent callers wait rather than oversubscribe memory bandwidth.
+        std::lock_guard<std::mutex> copyGuard(_copyLock);
+
+        // Part sizes are a multiple of 64 bytes, so parts never share a cache line of the destination.
+        size_t partSize = (size / partCount + 63) & ~size_t(63);
+        std::unique_lock<std::mutex> guard(_lock);
+        _kernel = kernel;
+        _destination = destination;
+        _source = source;
+        _size = size;
+        _partSize = partSize;
+        _partCount = partCount;
+        _nextPart = 1;
+        _pendingParts = partCount - 1;
+        guard.unlock();
+        _workAvailable.notify_all();
+
+        kernel(destination, source, std::min(size, partSize));
+
+        guard.lock();
+        _workDone.wait(guard, [this] { return _pendingParts == 0; });
+    }
+
+private:
+    void Run()
+    {
+        std::unique_lock<std::mutex> guard(_lock);
+        while (true)
+        {
+            _workAvailable.wait(guard, [this] { return _nextPart < _partCount; });
+
+            uint32_t part = _nextPart++;
+            size_t offset = part * _partSize;
+            size_t partSize = std::min(_partSize, _size - std::min(_size, offset));
+            CopyKernel kernel = _kernel;
+            uint8_t* destination = _destination;
+            const uint8_t* source = _source;
+            guard.unlock();
+
+            kernel(destination + offset, source + offset, partSize);
+
+            guard.lock();
+            if (--_pendingParts == 0)
+            {
+                _workDone.notify_all();
+            }
+        }
+    }
+
+    uint32_t _threadCount;
+    std::mutex _copyLock;
+    std::mutex _lock;
+    std::condition_variable _workAvailable;
+    std::condition_variable _workDone;
+
+    CopyKernel _kernel = nullptr;
+    uint8_t* _destination = nullptr;
+    const uint8_t* _source = nullptr;
+    size_t _size = 0;
+    size_t _partSize = 0;
+    uint32_t _partCount = 0;
+    uint32_t _nextPart = 0;
+    uint32_t _pendingParts = 0;
+};
+
+void StreamingCopy(void* destination, const void* source, size_t size)
+{
+    if (size < MinStreamingCopySize)
+    {
+        memcpy(destination, source, size);
+        return;
+    }
+
+    static const CopyKernel kernel = SelectCopyKernel();
+    uint8_t* dst = static_cast<uint8_t*>(destination);
+    const uint8_t* src = static_cast<const uint8_t*>(source);
+
+    if (size >= MinParallelCopySize)
+    {
+        static CopyWorkers* workers = new CopyWorkers();
+        uint32_t partCount = static_cast<uint32_t>(std::min<size_t>(workers->GetThreadCount(), size / ParallelChunkSize));
+        if (partCount > 1)
+        {
+            workers->Copy(kernel, dst, src, size, partCount);
+            return;
+        }
+    }
+
+    kernel(dst, src, size);
+}
+}
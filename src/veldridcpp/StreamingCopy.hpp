@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+
+namespace Veldrid
+{
+// Copies into mapped device memory, which is usually write-combined. Large copies use non-temporal
+// stores (AVX-512, AVX2 or SSE2, picked once from what the CPU supports) so the data bypasses the
+// cache, and very large copies are split across worker threads. Small copies are a plain memcpy.
+// The ranges must not overlap.
+void StreamingCopy(void* destination, const void* source, size_t size);
+}
@@ -4,6 +4,7 @@
 #include "Util.hpp"
 #include "VkFormats.hpp"
 #include "VeldridConfig.hpp"
+#include <vector>
 
 namespace Veldrid
 {
@@ -23,48 +24,40 @@ Texture::Texture(GraphicsDevice* gd, const TextureDescription& description)
     _usage = description.Usage;
     _type = description.Type;
     _sampleCount = description.SampleCount;
+    _intent = description.Intent;
     _vkSampleCount = VdToVkSampleCount(_sampleCount);
     _vkFormat = VdToVkPixelFormat(_format, (description.Usage & TextureUsage::DepthStencil) == TextureUsage::DepthStencil);
 
     bool isStaging = (_usage & TextureUsage::Staging) == TextureUsage::Staging;
 
+    _isImageOwned = true;
+    _stagingBuffer = VK_NULL_HANDLE;
+    // Images the GPU renders or writes to are used on the graphics queue from the start.
+    _isOwnedByGraphicsQueue = HasFlag(_usage, TextureUsage::RenderTarget)
+        || HasFlag(_usage, TextureUsage::DepthStencil)
+        || HasFlag(_usage, TextureUsage::Storage);
+
     if (!isStaging)
     {
-        VkImageCreateInfo imageCI = {};
-        imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageCI.mipLevels = _mipLevels;
-        imageCI.arrayLayers = _actualImageArrayLayers;
-        imageCI.imageType = VdToVkTextureType(_type);
-        imageCI.extent.width = _width;
-        imageCI.extent.height = _height;
-        imageCI.extent.depth = _depth;
-        imageCI.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
-        imageCI.usage = VdToVkTextureUsage(_usage);
-        imageCI.tiling = isStaging ? VK_IMAGE_TILING_LINEAR : VK_IMAGE_TILING_OPTIMAL;
-        imageCI.format = _vkFormat;
-
-        imageCI.samples = static_cast<VkSampleCountFlagBits>(_vkSampleCount);
-        if (isCubemap)
-        {
-            imageCI.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-        }
-
         uint32_t subresourceCount = _mipLevels * _actualImageArrayLayers * _depth;
-        VkResult result = vkCreateImage(_gd->GetVkDevice(), &imageCI, nullptr, &_optimalImage);
-        CheckResult(result);
+        _optimalImage = CreateOptimalImage();
 
         VkMemoryRequirements memoryRequirements;
-        vkGetImageMemoryRequirements(_gd->GetVkDevice(), _optimalImage, &memoryRequirements);
+        bool prefersDedicated;
+        _gd->GetImageMemoryRequirements(_optimalImage, &memoryRequirements, &prefersDedicated);
 
         MemoryBlock memoryToken = _gd->GetMemoryManager().Allocate(
             _gd->GetPhysicalDeviceMemProperties(),
             memoryRequirements.memoryTypeBits,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            0,
             false,
             memoryRequirements.size,
-            memoryRequirements.alignment);
+            memoryRequirements.alignment,
+            prefersDedicated,
+            _optimalImage);
         _memoryBlock = memoryToken;
-        result = vkBindImageMemory(_gd->GetVkDevice(), _optimalImage, _memoryBlock.DeviceMemory, _memoryBlock.Offset);
+        VkResult result = vkBindImageMemory(_gd->GetVkDevice(), _optimalImage, _memoryBlock.DeviceMemory, _memoryBlock.Offset);
         CheckResult(result);
 
         _imageLayouts = new VkImageLayout[subresourceCount];
@@ -101,20 +94,209 @@ Texture::Texture(GraphicsDevice* gd, const TextureDescription& description)
         VkResult result = vkCreateBuffer(_gd->GetVkDevice(), &bufferCI, nullptr, &_stagingBuffer);
         CheckResult(result);
         VkMemoryRequirements bufferMemReqs;
-        vkGetBufferMemoryRequirements(_gd->GetVkDevice(), _stagingBuffer, &bufferMemReqs);
+        bool prefersDedicated;
+        _gd->GetBufferMemoryRequirements(_stagingBuffer, &bufferMemReqs, &prefersDedicated);
+        _gd->PadToNonCoherentAtom(&bufferMemReqs);
+        VkMemoryPropertyFlags memoryPropertyFlags;
+        VkMemoryPropertyFlags preferredFlags;
+        _gd->GetMappedMemoryFlags(_intent, &memoryPropertyFlags, &preferredFlags);
         _memoryBlock = _gd->GetMemoryManager().Allocate(
             _gd->GetPhysicalDeviceMemProperties(),
             bufferMemReqs.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            memoryPropertyFlags,
+            preferredFlags,
             true,
             bufferMemReqs.size,
-            bufferMemReqs.alignment);
+            bufferMemReqs.alignment,
+            prefersDedicated,
+            VK_NULL_HANDLE,
+            _stagingBuffer);
 
         result = vkBindBufferMemory(_gd->GetVkDevice(), _stagingBuffer, _memoryBlock.DeviceMemory, _memoryBlock.Offset);
         CheckResult(result);
     }
 
     ClearIfRenderTarget();
+
+    if (!isStaging)
+    {
+        _gd->RegisterResource(this);
+    }
+}
+
+VkImage Texture::CreateOptimalImage() const
+{
+    VkImageCreateInfo imageCI = {};
+    imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCI.mipLevels = _mipLevels;
+    imageCI.arrayLayers = _actualImageArrayLayers;
+    imageCI.imageType = VdToVkTextureType(_type);
+    imageCI.extent.width = _width;
+    imageCI.extent.height = _height;
+    imageCI.extent.depth = _depth;
+    imageCI.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+    imageCI.usage = VdToVkTextureUsage(_usage);
+    imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCI.format = _vkFormat;
+
+    imageCI.samples = static_cast<VkSampleCountFlagBits>(_vkSampleCount);
+    if (HasFlag(_usage, TextureUsage::Cubemap))
+    {
+        imageCI.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+    }
+
+    VkImage image;
+    VkResult result = vkCreateImage(_gd->GetVkDevice(), &imageCI, nullptr, &image);
+    CheckResult(result);
+    return image;
+}
+
+bool Texture::IsRelocatable() const
+{
+    // Framebuffers hold views of render targets, so those are never moved.
+    return _isImageOwned
+        && _stagingBuffer == VK_NULL_HANDLE
+        && !HasFlag(_usage, TextureUsage::RenderTarget)
+        && !HasFlag(_usage, TextureUsage::DepthStencil);
+}
+
+bool Texture::Relocate(VkCommandBuffer cb, VkImage* oldImage, MemoryBlock* oldMemory)
+{
+    VkImage newImage = CreateOptimalImage();
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(_gd->GetVkDevice(), newImage, &memoryRequirements);
+    MemoryBlock newMemory;
+    if (!_gd->GetMemoryManager().AllocateRelocation(
+        _memoryBlock,
+        memoryRequirements.size,
+        memoryRequirements.alignment,
+        &newMemory))
+    {
+        vkDestroyImage(_gd->GetVkDevice(), newImage, nullptr);
+        return false;
+    }
+
+    CheckResult(vkBindImageMemory(_gd->GetVkDevice(), newImage, newMemory.DeviceMemory, newMemory.Offset));
+    _isOwnedByGraphicsQueue = true;
+
+    // Layouts are tracked per image layer, so each cubemap face gets barriers of its own.
+    uint32_t subresourceCount = _mipLevels * _actualImageArrayLayers;
+    std::vector<VkImageMemoryBarrier> barriers(subresourceCount * 2);
+    for (uint32_t layer = 0; layer < _actualImageArrayLayers; layer++)
+    {
+        for (uint32_t level = 0; level < _mipLevels; level++)
+        {
+            uint32_t subresource = CalculateSubresource(level, layer);
+            for (uint32_t i = 0; i < 2; i++)
+            {
+                VkImageMemoryBarrier& barrier = barriers[subresource * 2 + i];
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                barrier.subresourceRange.baseMipLevel = level;
+                barrier.subresourceRange.levelCount = 1;
+                barrier.subresourceRange.baseArrayLayer = layer;
+                barrier.subresourceRange.layerCount = 1;
+            }
+
+            VkImageMemoryBarrier& srcBarrier = barriers[subresource * 2];
+            srcBarrier.image = _optimalImage;
+            srcBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+            srcBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            srcBarrier.oldLayout = _imageLayouts[subresource];
+            srcBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+            VkImageMemoryBarrier& dstBarrier = barriers[subresource * 2 + 1];
+            dstBarrier.image = newImage;
+            dstBarrier.srcAccessMask = 0;
+            dstBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            dstBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            dstBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        }
+    }
+
+    vkCmdPipelineBarrier(
+        cb,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    std::vector<VkImageCopy> regions(_mipLevels);
+    for (uint32_t level = 0; level < _mipLevels; level++)
+    {
+        VkImageCopy& region = regions[level];
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = level;
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = _actualImageArrayLayers;
+        region.dstSubresource = region.srcSubresource;
+        region.srcOffset = { 0, 0, 0 };
+        region.dstOffset = { 0, 0, 0 };
+        GetMipDimensions(this, level, &region.extent.width, &region.extent.height, &region.extent.depth);
+    }
+
+    vkCmdCopyImage(
+        cb,
+        _optimalImage,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        newImage,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.data());
+
+    // Put the new image in the layouts the old one was tracked in. Subresources that were never
+    // written can't go back to PREINITIALIZED, so they stay in TRANSFER_DST_OPTIMAL.
+    barriers.resize(0);
+    for (uint32_t subresource = 0; subresource < subresourceCount; subresource++)
+    {
+        VkImageLayout layout = _imageLayouts[subresource];
+        if (layout == VK_IMAGE_LAYOUT_PREINITIALIZED || layout == VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            _imageLayouts[subresource] = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            continue;
+        }
+
+        uint32_t level, layer;
+        GetMipLevelAndArrayLayer(this, subresource, &level, &layer);
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = newImage;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = layout;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = level;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = layer;
+        barrier.subresourceRange.layerCount = 1;
+        barriers.push_back(barrier);
+    }
+
+    if (barriers.size() > 0)
+    {
+        vkCmdPipelineBarrier(
+            cb,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    *oldImage = _optimalImage;
+    *oldMemory = _memoryBlock;
+    _optimalImage = newImage;
+    _memoryBlock = newMemory;
+    return true;
 }
 
 void Texture::ClearIfRenderTarget()
@@ -149,6 +331,7 @@ VdResult Texture::GetDescription(TextureDescription* description)
     description->Usage = _usage;
     description->Type = _type;
     description->SampleCount = _sampleCount;
+    description->Intent = _intent;
     return VdResult::Success;
 }
 
@@ -174,18 +357,22 @@ Texture::Texture(
     _arrayLayers = arrayLayers;
     _usage = usage;
     _sampleCount = sampleCount;
+    _intent = MemoryIntent::Default;
     _vkSampleCount = VdToVkSampleCount(sampleCount);
     _optimalImage = existingImage;
     _imageLayouts = new VkImageLayout[1];
     _imageLayouts[0] = VK_IMAGE_LAYOUT_PREINITIALIZED;
     _type = TextureType::Texture2D;
     _isImageOwned = false;
+    _isOwnedByGraphicsQueue = true;
 
     ClearIfRenderTarget();
 }
 
 Texture::~Texture()
 {
+    _gd->UnregisterResource(this);
+
     bool isStaging = (_usage & TextureUsage::Staging) == TextureUsage::Staging;
     if (isStaging)
     {
@@ -243,12 +430,16 @@ VkSubresourceLayout Texture::GetSubresourceLayout(uint32_t subresource) const
     }
 }
 
-void Texture::SetStagingDimensions(uint32_t width, uint32_t height, uint32_t depth, PixelFormat format)
+VkImageAspectFlags Texture::GetAspectMask() const
 {
-    _width = width;
-    _height = height;
-    _depth = depth;
-    _format = format;
+    if (HasFlag(_usage, TextureUsage::DepthStencil))
+    {
+        return IsStencilFormat(_format)
+            ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT
+            : VK_IMAGE_ASPECT_DEPTH_BIT;
+    }
+
+    return VK_IMAGE_ASPECT_COLOR_BIT;
 }
 
 void Texture::TransitionImageLayout(VkCommandBuffer cb, uint32_t baseMipLevel, uint32_t levelCount, uint32_t baseArrayLayer, uint32_t layerCount, VkImageLayout newLayout)
@@ -261,17 +452,6 @@ void Texture::TransitionImageLayout(VkCommandBuffer cb, uint32_t baseMipLevel, u
     VkImageLayout oldLayout = _imageLayouts[CalculateSubresource(baseMipLevel, baseArrayLayer)];
     if (oldLayout != newLayout)
     {
-        VkImageAspectFlags aspectMask;
-        if (HasFlag(_usage, TextureUsage::DepthStencil))
-        {
-            aspectMask = IsStencilFormat(_format)
-                ? aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT
-                : aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-        }
-        else
-        {
-            aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;;
-        }
         VulkanUtil_TransitionImageLayout(
             cb,
             _optimalImage,
@@ -279,7 +459,7 @@ void Texture::TransitionImageLayout(VkCommandBuffer cb, uint32_t baseMipLevel, u
             levelCount,
             baseArrayLayer,
             layerCount,
-            aspectMask,
+            GetAspectMask(),
             _imageLayouts[CalculateSubresource(baseMipLevel, baseArrayLayer)],
             newLayout);
 
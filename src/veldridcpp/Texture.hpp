@@ -37,6 +37,7 @@ public:
     inline PixelFormat GetFormat() const { return _format; }
     inline TextureUsage GetUsage() const { return _usage; }
     inline TextureSampleCount GetSampleCount() const { return _sampleCount; }
+    inline MemoryIntent GetIntent() const { return _intent; }
     inline const MemoryBlock& GetMemory() const { return _memoryBlock; }
     inline VkImage GetOptimalImage() const { return _optimalImage; }
     inline VkBuffer GetStagingBuffer() const { return _stagingBuffer; }
@@ -45,7 +46,8 @@ public:
 
     VkSubresourceLayout GetSubresourceLayout(uint32_t subresource) const;
     uint32_t CalculateSubresource(uint32_t mipLevel, uint32_t arrayLayer) const { return arrayLayer * _mipLevels + mipLevel; }
-    void SetStagingDimensions(uint32_t width, uint32_t height, uint32_t depth, PixelFormat format);
+    // Every aspect of the format, as barriers on the image need.
+    VkImageAspectFlags GetAspectMask() const;
     void TransitionImageLayout(
         VkCommandBuffer cb,
         uint32_t baseMipLevel,
@@ -54,7 +56,21 @@ public:
         uint32_t layerCount,
         VkImageLayout newLayout);
     void SetImageLayout(uint32_t mipLevel, uint32_t arrayLayer, VkImageLayout layout);
+    VkImageLayout GetImageLayout(uint32_t mipLevel, uint32_t arrayLayer) const { return _imageLayouts[CalculateSubresource(mipLevel, arrayLayer)]; }
+    // False until the image is written on the graphics queue. Until then, GraphicsDevice may upload to it
+    // through the transfer queue and hand ownership over afterwards.
+    bool IsOwnedByGraphicsQueue() const { return _isOwnedByGraphicsQueue; }
+    void SetOwnedByGraphicsQueue() { _isOwnedByGraphicsQueue = true; }
+    // Views do not expose levels more detailed than this; raised while a TextureStream is uploading them.
+    uint32_t GetMinResidentMipLevel() const { return _minResidentMipLevel; }
+    void SetMinResidentMipLevel(uint32_t mipLevel) { _minResidentMipLevel = mipLevel; }
     void ClearIfRenderTarget();
+    // True for owned, sampled or storage images, which DefragmentMemory may move.
+    bool IsRelocatable() const;
+    // Copies all subresources into a new image allocated by MemoryManager::AllocateRelocation, recording
+    // the copy into cb. Returns false if there was no room; otherwise the old image and memory are returned
+    // and must be kept alive until cb has completed. Views of the texture must be recreated.
+    bool Relocate(VkCommandBuffer cb, VkImage* oldImage, MemoryBlock* oldMemory);
 
     VdResult GetDescription(TextureDescription* description);
 
@@ -63,21 +79,25 @@ private:
     VkImage _optimalImage;
     MemoryBlock _memoryBlock;
     VkBuffer _stagingBuffer;
-    PixelFormat _format; // Static for regular images -- may change for shared staging images
+    PixelFormat _format;
     uint32_t _actualImageArrayLayers;
     uint32_t _mipLevels;
     uint32_t _arrayLayers;
     TextureUsage _usage;
     TextureType _type;
     TextureSampleCount _sampleCount;
+    MemoryIntent _intent;
     VkSampleCountFlags _vkSampleCount;
     VkFormat _vkFormat;
     VkImageLayout* _imageLayouts;
     bool _isImageOwned; // False for Swapchain images.
+    bool _isOwnedByGraphicsQueue;
+    uint32_t _minResidentMipLevel = 0;
 
-    // Immutable except for shared staging Textures.
     uint32_t _width;
     uint32_t _height;
     uint32_t _depth;
+
+    VkImage CreateOptimalImage() const;
 };
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "TextureUsage.hpp"
 #include "TextureType.hpp"
 #include "TextureSampleCount.hpp"
+#include "MemoryIntent.hpp"
 
 namespace Veldrid
 {
@@ -18,6 +19,7 @@ struct TextureDescription
     TextureUsage Usage;
     TextureType Type;
     TextureSampleCount SampleCount;
+    MemoryIntent Intent;
 
     static TextureDescription Texture2D(
         uint32_t width,
@@ -37,6 +39,7 @@ struct TextureDescription
         ret.Format = format;
         ret.Usage = usage;
         ret.SampleCount = TextureSampleCount::Count1;
+        ret.Intent = MemoryIntent::Default;
         return ret;
     }
 
@@ -58,6 +61,7 @@ struct TextureDescription
         ret.Format = format;
         ret.Usage = usage;
         ret.SampleCount = TextureSampleCount::Count1;
+        ret.Intent = MemoryIntent::Default;
         return ret;
     }
 };
@@ -0,0 +1,535 @@
+#include "stdafx.h"
+#include "TextureFile.hpp"
+#include "FormatHelpers.hpp"
+#include "VkFormats.hpp"
+#include "Util.hpp"
+#include <string.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Veldrid
+{
+static const uint8_t Ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static const uint32_t Ktx2HeaderSize = 80;
+static const uint32_t Ktx2LevelIndexEntrySize = 24;
+
+static const uint32_t DdsMagic = 0x20534444; // "DDS "
+static const uint32_t DdsHeaderSize = 4 + 124;
+static const uint32_t DdsDx10HeaderSize = 20;
+static const uint32_t DdsHeaderFlagsDepth = 0x800000;
+static const uint32_t DdsPixelFormatFourCC = 0x4;
+static const uint32_t DdsPixelFormatRgb = 0x40;
+static const uint32_t DdsCaps2Cubemap = 0x200;
+static const uint32_t DdsCaps2CubemapAllFaces = 0xFC00;
+static const uint32_t DdsCaps2Volume = 0x200000;
+static const uint32_t DdsResourceDimensionTexture1D = 2;
+static const uint32_t DdsResourceDimensionTexture3D = 4;
+static const uint32_t DdsResourceMiscTextureCube = 0x4;
+
+static uint32_t MakeFourCC(char a, char b, char c, char d)
+{
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+static uint32_t ReadUInt32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint64_t ReadUInt64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// KTX2 stores a VkFormat; PixelFormat maps onto Vulkan one-to-one, so search the existing mapping.
+static bool VkFormatToPixelFormat(uint32_t vkFormat, PixelFormat* format)
+{
+    for (uint32_t i = 0; i <= static_cast<uint32_t>(PixelFormat::ETC2_R8_G8_B8_A8_UNorm); i++)
+    {
+        PixelFormat candidate = static_cast<PixelFormat>(i);
+        if (candidate == PixelFormat::D24_UNorm_S8_UInt || candidate == PixelFormat::D32_Float_S8_UInt)
+        {
+            continue;
+        }
+        if (static_cast<uint32_t>(VdToVkPixelFormat(candidate)) == vkFormat)
+        {
+            *format = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool DxgiFormatToPixelFormat(uint32_t dxgiFormat, PixelFormat* format)
+{
+    switch (dxgiFormat)
+    {
+    case 2: *format = PixelFormat::R32_G32_B32_A32_Float; return true;
+    case 3: *format = PixelFormat::R32_G32_B32_A32_UInt; return true;
+    case 4: *format = PixelFormat::R32_G32_B32_A32_SInt; return true;
+    case 10: *format = PixelFormat::R16_G16_B16_A16_Float; return true;
+    case 11: *format = PixelFormat::R16_G16_B16_A16_UNorm; return true;
+    case 12: *format = PixelFormat::R16_G16_B16_A16_UInt; return true;
+    case 13: *format = PixelFormat::R16_G16_B16_A16_SNorm; return true;
+    case 14: *format = PixelFormat::R16_G16_B16_A16_SInt; return true;
+    case 16: *format = PixelFormat::R32_G32_Float; return true;
+    case 17: *format = PixelFormat::R32_G32_UInt; return true;
+    case 18: *format = PixelFormat::R32_G32_SInt; return true;
+    case 24: *format = PixelFormat::R10_G10_B10_A2_UNorm; return true;
+    case 25: *format = PixelFormat::R10_G10_B10_A2_UInt; return true;
+    case 26: *format = PixelFormat::R11_G11_B10_Float; return true;
+    case 28: *format = PixelFormat::R8_G8_B8_A8_UNorm; return true;
+    case 30: *format = PixelFormat::R8_G8_B8_A8_UInt; return true;
+    case 31: *format = PixelFormat::R8_G8_B8_A8_SNorm; return true;
+    case 32: *format = PixelFormat::R8_G8_B8_A8_SInt; return true;
+    case 34: *format = PixelFormat::R16_G16_Float; return true;
+    case 35: *format = PixelFormat::R16_G16_UNorm; return true;
+    case 36: *format = PixelFormat::R16_G16_UInt; return true;
+    case 37: *format = PixelFormat::R16_G16_SNorm; return true;
+    case 38: *format = PixelFormat::R16_G16_SInt; return true;
+    case 41: *format = PixelFormat::R32_Float; return true;
+    case 42: *format = PixelFormat::R32_UInt; return true;
+    case 43: *format = PixelFormat::R32_SInt; return true;
+    case 49: *format = PixelFormat::R8_G8_UNorm; return true;
+    case 50: *format = PixelFormat::R8_G8_UInt; return true;
+    case 51: *format = PixelFormat::R8_G8_SNorm; return true;
+    case 52: *format = PixelFormat::R8_G8_SInt; return true;
+    case 54: *format = PixelFormat::R16_Float; return true;
+    case 56: *format = PixelFormat::R16_UNorm; return true;
+    case 57: *format = PixelFormat::R16_UInt; return true;
+    case 58: *format = PixelFormat::R16_SNorm; return true;
+    case 59: *format = PixelFormat::R16_SInt; return true;
+    case 61: *format = PixelFormat::R8_UNorm; return true;
+    case 62: *format = PixelFormat::R8_UInt; return true;
+    case 63: *format = PixelFormat::R8_SNorm; return true;
+    case 64: *format = PixelFormat::R8_SInt; return true;
+    // DXGI has no separate opaque BC1 format.
+    case 71: *format = PixelFormat::BC1_Rgba_UNorm; return true;
+    case 74: *format = PixelFormat::BC2_UNorm; return true;
+    case 77: *format = PixelFormat::BC3_UNorm; return true;
+    case 87: *format = PixelFormat::B8_G8_R8_A8_UNorm; return true;
+    default: return false;
+    }
+}
+
+// Files written without a DX10 header describe their format with a FourCC or channel masks.
+static bool LegacyDdsFormatToPixelFormat(const uint8_t* pixelFormat, PixelFormat* format)
+{
+    uint32_t flags = ReadUInt32(pixelFormat + 4);
+    uint32_t fourCC = ReadUInt32(pixelFormat + 8);
+    uint32_t bitCount = ReadUInt32(pixelFormat + 12);
+    uint32_t redMask = ReadUInt32(pixelFormat + 16);
+    uint32_t greenMask = ReadUInt32(pixelFormat + 20);
+    uint32_t blueMask = ReadUInt32(pixelFormat + 24);
+
+    if ((flags & DdsPixelFormatFourCC) != 0)
+    {
+        if (fourCC == MakeFourCC('D', 'X', 'T', '1')) { *format = PixelFormat::BC1_Rgba_UNorm; return true; }
+        if (fourCC == MakeFourCC('D', 'X', 'T', '3')) { *format = PixelFormat::BC2_UNorm; return true; }
+        if (fourCC == MakeFourCC('D', 'X', 'T', '5')) { *format = PixelFormat::BC3_UNorm; return true; }
+        // D3DFMT_A16B16G16R16F and D3DFMT_A32B32G32R32F.
+        if (fourCC == 113) { *format = PixelFormat::R16_G16_B16_A16_Float; return true; }
+        if (fourCC == 116) { *format = PixelFormat::R32_G32_B32_A32_Float; return true; }
+        return false;
+    }
+    if ((flags & DdsPixelFormatRgb) != 0 && bitCount == 32 && greenMask == 0x0000FF00)
+    {
+        if (redMask == 0x000000FF && blueMask == 0x00FF0000) { *format = PixelFormat::R8_G8_B8_A8_UNorm; return true; }
+        if (redMask == 0x00FF0000 && blueMask == 0x000000FF) { *format = PixelFormat::B8_G8_R8_A8_UNorm; return true; }
+    }
+
+    return false;
+}
+
+VdResult TextureFile::Open(const char* path, const VkPhysicalDeviceLimits& limits, TextureFile** file)
+{
+    TextureFile* result = new TextureFile();
+    VdResult vdResult = result->Map(path);
+    if (vdResult == VdResult::Success)
+    {
+        if (result->_size >= sizeof(Ktx2Identifier) && memcmp(result->_data, Ktx2Identifier, sizeof(Ktx2Identifier)) == 0)
+        {
+            vdResult = result->ParseKtx2(limits);
+        }
+        else if (result->_size >= DdsHeaderSize && ReadUInt32(result->_data) == DdsMagic)
+        {
+            vdResult = result->ParseDds(limits);
+        }
+        else
+        {
+            vdResult = VdResult::InvalidOperation;
+        }
+    }
+    if (vdResult == VdResult::Success)
+    {
+        vdResult = result->ValidateSubresources();
+    }
+
+    if (vdResult != VdResult::Success)
+    {
+        delete result;
+        return vdResult;
+    }
+
+    *file = result;
+    return VdResult::Success;
+}
+
+TextureFile::~TextureFile()
+{
+#ifdef _WIN32
+    if (_data != nullptr)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mappingHandle != nullptr)
+    {
+        CloseHandle(_mappingHandle);
+    }
+    if (_fileHandle != nullptr)
+    {
+        CloseHandle(_fileHandle);
+    }
+#else
+    if (_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(_data), _size);
+    }
+#endif
+}
+
+VdResult TextureFile::Map(const char* path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return VdResult::InvalidOperation;
+    }
+    _fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+    _mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mappingHandle == nullptr)
+    {
+        return VdResult::InvalidOperation;
+    }
+    _data = static_cast<const uint8_t*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr)
+    {
+        return VdResult::InvalidOperation;
+    }
+    _size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return VdResult::InvalidOperation;
+    }
+    void* mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return VdResult::InvalidOperation;
+    }
+    _data = static_cast<const uint8_t*>(mapping);
+    _size = static_cast<size_t>(fileStat.st_size);
+    // The whole file is about to be copied out; start reading it in now.
+    madvise(mapping, _size, MADV_WILLNEED);
+#endif
+
+    return VdResult::Success;
+}
+
+VdResult TextureFile::ParseKtx2(const VkPhysicalDeviceLimits& limits)
+{
+    if (_size < Ktx2HeaderSize)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t vkFormat = ReadUInt32(_data + 12);
+    _width = ReadUInt32(_data + 20);
+    uint32_t pixelHeight = ReadUInt32(_data + 24);
+    uint32_t pixelDepth = ReadUInt32(_data + 28);
+    uint32_t layerCount = ReadUInt32(_data + 32);
+    uint32_t faceCount = ReadUInt32(_data + 36);
+    uint32_t levelCount = ReadUInt32(_data + 40);
+    uint32_t supercompressionScheme = ReadUInt32(_data + 44);
+
+    // BasisLZ, Zstandard and zlib payloads need a decoder this library doesn't have. VK_FORMAT_UNDEFINED
+    // means the data is in a universal format that must be transcoded first.
+    if (supercompressionScheme != 0 || vkFormat == 0)
+    {
+        return VdResult::UnsupportedSystem;
+    }
+    if (!VkFormatToPixelFormat(vkFormat, &_format))
+    {
+        return VdResult::UnsupportedSystem;
+    }
+    if (_width == 0 || (faceCount != 1 && faceCount != 6))
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    _type = pixelDepth != 0 ? TextureType::Texture3D : pixelHeight != 0 ? TextureType::Texture2D : TextureType::Texture1D;
+    _height = std::max(1u, pixelHeight);
+    _depth = std::max(1u, pixelDepth);
+    _arrayLayers = std::max(1u, layerCount);
+    _isCubemap = faceCount == 6;
+    // A level count of zero asks the loader to generate mips; only the base level is stored.
+    _mipLevels = std::max(1u, levelCount);
+
+    VdResult result = ValidateDimensions(limits);
+    if (result != VdResult::Success)
+    {
+        return result;
+    }
+    if (uint64_t(Ktx2HeaderSize) + uint64_t(Ktx2LevelIndexEntrySize) * _mipLevels > _size)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    // Within a level, images are ordered by layer, then face, which is the Texture layer order.
+    uint32_t layers = GetLayerCount();
+    _subresourceOffsets.resize(static_cast<size_t>(layers) * _mipLevels);
+    for (uint32_t level = 0; level < _mipLevels; level++)
+    {
+        const uint8_t* entry = _data + Ktx2HeaderSize + Ktx2LevelIndexEntrySize * level;
+        uint64_t byteOffset = ReadUInt64(entry);
+        uint64_t byteLength = ReadUInt64(entry + 8);
+        uint64_t subresourceSize;
+        if (!GetSubresourceSize(level, &subresourceSize)
+            || byteOffset > _size || byteLength > _size - byteOffset
+            || byteLength / layers < subresourceSize)
+        {
+            return VdResult::InvalidOperation;
+        }
+        for (uint32_t layer = 0; layer < layers; layer++)
+        {
+            _subresourceOffsets[layer * _mipLevels + level] = byteOffset + subresourceSize * layer;
+        }
+    }
+
+    return VdResult::Success;
+}
+
+VdResult TextureFile::ParseDds(const VkPhysicalDeviceLimits& limits)
+{
+    const uint8_t* header = _data + 4;
+    if (ReadUInt32(header) != 124)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t flags = ReadUInt32(header + 4);
+    _height = std::max(1u, ReadUInt32(header + 8));
+    _width = ReadUInt32(header + 12);
+    uint32_t depth = ReadUInt32(header + 20);
+    _mipLevels = std::max(1u, ReadUInt32(header + 24));
+    const uint8_t* pixelFormat = header + 72;
+    uint32_t caps2 = ReadUInt32(header + 108);
+    uint64_t dataOffset = DdsHeaderSize;
+
+    bool hasDx10Header = (ReadUInt32(pixelFormat + 4) & DdsPixelFormatFourCC) != 0
+        && ReadUInt32(pixelFormat + 8) == MakeFourCC('D', 'X', '1', '0');
+    if (hasDx10Header)
+    {
+        if (_size < DdsHeaderSize + DdsDx10HeaderSize)
+        {
+            return VdResult::InvalidOperation;
+        }
+        const uint8_t* dx10 = _data + DdsHeaderSize;
+        if (!DxgiFormatToPixelFormat(ReadUInt32(dx10), &_format))
+        {
+            return VdResult::UnsupportedSystem;
+        }
+        uint32_t dimension = ReadUInt32(dx10 + 4);
+        _type = dimension == DdsResourceDimensionTexture3D ? TextureType::Texture3D
+            : dimension == DdsResourceDimensionTexture1D ? TextureType::Texture1D
+            : TextureType::Texture2D;
+        _isCubemap = (ReadUInt32(dx10 + 8) & DdsResourceMiscTextureCube) != 0;
+        _arrayLayers = std::max(1u, ReadUInt32(dx10 + 12));
+        dataOffset += DdsDx10HeaderSize;
+    }
+    else
+    {
+        if (!LegacyDdsFormatToPixelFormat(pixelFormat, &_format))
+        {
+            return VdResult::UnsupportedSystem;
+        }
+        _type = (caps2 & DdsCaps2Volume) != 0 ? TextureType::Texture3D : TextureType::Texture2D;
+        _isCubemap = (caps2 & DdsCaps2Cubemap) != 0;
+        // Cubemaps missing some faces can't be represented.
+        if (_isCubemap && (caps2 & DdsCaps2CubemapAllFaces) != DdsCaps2CubemapAllFaces)
+        {
+            return VdResult::UnsupportedSystem;
+        }
+        _arrayLayers = 1;
+    }
+
+    _depth = _type == TextureType::Texture3D && (flags & DdsHeaderFlagsDepth) != 0 ? std::max(1u, depth) : 1;
+    if (_width == 0)
+    {
+        return VdResult::InvalidOperation;
+    }
+    VdResult result = ValidateDimensions(limits);
+    if (result != VdResult::Success)
+    {
+        return result;
+    }
+
+    // Each layer (array element or cubemap face) stores its whole mip chain before the next.
+    uint32_t layers = GetLayerCount();
+    _subresourceOffsets.resize(static_cast<size_t>(layers) * _mipLevels);
+    uint64_t offset = dataOffset;
+    for (uint32_t layer = 0; layer < layers; layer++)
+    {
+        for (uint32_t level = 0; level < _mipLevels; level++)
+        {
+            _subresourceOffsets[layer * _mipLevels + level] = offset;
+            uint64_t subresourceSize;
+            if (!GetSubresourceSize(level, &subresourceSize) || subresourceSize > _size - std::min<uint64_t>(offset, _size))
+            {
+                return VdResult::InvalidOperation;
+            }
+            offset += subresourceSize;
+        }
+    }
+
+    return VdResult::Success;
+}
+
+// Dimensions come straight from the file, so bound them by what the device can create before any sizes
+// are computed from them.
+VdResult TextureFile::ValidateDimensions(const VkPhysicalDeviceLimits& limits) const
+{
+    uint32_t maxDimension = _type == TextureType::Texture1D ? limits.maxImageDimension1D
+        : _type == TextureType::Texture3D ? limits.maxImageDimension3D
+        : _isCubemap ? limits.maxImageDimensionCube
+        : limits.maxImageDimension2D;
+    if (_width > maxDimension || _height > maxDimension || _depth > maxDimension
+        || _arrayLayers > limits.maxImageArrayLayers || GetLayerCount() > limits.maxImageArrayLayers)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    // A full mip chain has floor(log2(largest dimension)) + 1 levels.
+    uint32_t largestDimension = std::max(_width, std::max(_height, _depth));
+    uint32_t maxMipLevels = 1;
+    while ((largestDimension >> maxMipLevels) != 0)
+    {
+        maxMipLevels++;
+    }
+    if (_mipLevels > maxMipLevels)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    return VdResult::Success;
+}
+
+VdResult TextureFile::ValidateSubresources() const
+{
+    if (_type == TextureType::Texture3D && (_arrayLayers != 1 || _isCubemap))
+    {
+        return VdResult::InvalidOperation;
+    }
+    if (_isCubemap && _width != _height)
+    {
+        return VdResult::InvalidOperation;
+    }
+
+    uint32_t layers = GetLayerCount();
+    for (uint32_t layer = 0; layer < layers; layer++)
+    {
+        for (uint32_t level = 0; level < _mipLevels; level++)
+        {
+            uint64_t offset = _subresourceOffsets[layer * _mipLevels + level];
+            uint64_t size;
+            if (!GetSubresourceSize(level, &size) || offset > _size || size > _size - offset)
+            {
+                return VdResult::InvalidOperation;
+            }
+        }
+    }
+
+    return VdResult::Success;
+}
+
+TextureDescription TextureFile::GetDescription(TextureUsage usage) const
+{
+    if (_isCubemap)
+    {
+        usage = TextureUsage(static_cast<uint8_t>(usage) | static_cast<uint8_t>(TextureUsage::Cubemap));
+    }
+
+    TextureDescription description = _type == TextureType::Texture3D
+        ? TextureDescription::Texture3D(_width, _height, _depth, _mipLevels, _format, usage)
+        : TextureDescription::Texture2D(_width, _height, _mipLevels, _arrayLayers, _format, usage);
+    description.Type = _type;
+    return description;
+}
+
+void TextureFile::GetMipDimensions(uint32_t mipLevel, uint32_t* width, uint32_t* height, uint32_t* depth) const
+{
+    *width = GetDimension(_width, mipLevel);
+    *height = GetDimension(_height, mipLevel);
+    *depth = GetDimension(_depth, mipLevel);
+}
+
+const void* TextureFile::GetSubresourceData(uint32_t mipLevel, uint32_t layer) const
+{
+    return _data + _subresourceOffsets[layer * _mipLevels + mipLevel];
+}
+
+bool TextureFile::GetSubresourceSize(uint32_t mipLevel, uint64_t* size) const
+{
+    uint32_t width, height, depth;
+    GetMipDimensions(mipLevel, &width, &height, &depth);
+
+    uint64_t rowPitch;
+    uint64_t rows;
+    if (IsCompressedFormat(_format))
+    {
+        rowPitch = (uint64_t(width) + 3) / 4 * GetBlockSizeInBytes(_format);
+        rows = (uint64_t(height) + 3) / 4;
+    }
+    else
+    {
+        rowPitch = uint64_t(width) * GetSizeInBytes(_format);
+        rows = height;
+    }
+
+    // Both factors are below 2^32, so the products can't wrap.
+    uint64_t depthPitch = rowPitch * rows;
+    if (rowPitch > UINT32_MAX || depthPitch > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *size = depthPitch * depth;
+    return true;
+}
+}
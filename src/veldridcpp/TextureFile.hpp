@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "vulkan.h"
+#include "VdResult.hpp"
+#include "PixelFormat.hpp"
+#include "TextureDescription.hpp"
+
+namespace Veldrid
+{
+// A KTX2 or DDS file mapped into memory. Open validates the header and the extent of every subresource,
+// so the uploader can copy straight out of the mapping.
+class TextureFile
+{
+public:
+    // Fails with InvalidOperation for files that can't be read, are malformed or exceed the device's image
+    // limits, and UnsupportedSystem for supercompressed KTX2 files and formats with no PixelFormat equivalent.
+    static VdResult Open(const char* path, const VkPhysicalDeviceLimits& limits, TextureFile** file);
+    ~TextureFile();
+
+    // Cubemap files get TextureUsage::Cubemap added to usage.
+    TextureDescription GetDescription(TextureUsage usage) const;
+    uint32_t GetMipLevels() const { return _mipLevels; }
+    // Cubemap faces count as layers: layer = arrayLayer * 6 + face, as in Texture.
+    uint32_t GetLayerCount() const { return _isCubemap ? _arrayLayers * 6 : _arrayLayers; }
+    void GetMipDimensions(uint32_t mipLevel, uint32_t* width, uint32_t* height, uint32_t* depth) const;
+    // Tightly packed, as GraphicsDevice::TextureUploadRegion expects.
+    const void* GetSubresourceData(uint32_t mipLevel, uint32_t layer) const;
+
+private:
+    TextureFile() { }
+    VdResult Map(const char* path);
+    VdResult ParseKtx2(const VkPhysicalDeviceLimits& limits);
+    VdResult ParseDds(const VkPhysicalDeviceLimits& limits);
+    VdResult ValidateDimensions(const VkPhysicalDeviceLimits& limits) const;
+    VdResult ValidateSubresources() const;
+    // Fails for subresources too large for the uploader, which works with 32-bit pitches.
+    bool GetSubresourceSize(uint32_t mipLevel, uint64_t* size) const;
+
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* _fileHandle = nullptr;
+    void* _mappingHandle = nullptr;
+#endif
+
+    TextureType _type = TextureType::Texture2D;
+    PixelFormat _format = PixelFormat::R8_G8_B8_A8_UNorm;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    uint32_t _depth = 0;
+    uint32_t _mipLevels = 0;
+    uint32_t _arrayLayers = 0;
+    bool _isCubemap = false;
+    // File offset of each subresource, indexed by layer * _mipLevels + mipLevel.
+    std::vector<uint64_t> _subresourceOffsets;
+};
+}
@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "TextureStream.hpp"
+#include "GraphicsDevice.hpp"
+#include "Texture.hpp"
+#include "Util.hpp"
+#include <vector>
+
+namespace Veldrid
+{
+TextureStream::TextureStream(GraphicsDevice* gd, Texture* texture, const void* source)
+{
+    _gd = gd;
+    _texture = texture;
+    _source = static_cast<const uint8_t*>(source);
+    // Cubemap faces are laid out like array layers.
+    _layerCount = HasFlag(texture->GetUsage(), TextureUsage::Cubemap)
+        ? texture->GetArrayLayers() * 6
+        : texture->GetArrayLayers();
+    _queuedMipLevel = texture->GetMipLevels();
+    _residentMipLevel = texture->GetMipLevels();
+}
+
+uint32_t TextureStream::GetLayerSize(uint32_t mipLevel) const
+{
+    uint32_t blockSize = IsCompressedFormat(_texture->GetFormat()) ? 4u : 1u;
+    uint32_t mipWidth, mipHeight, mipDepth;
+    GetMipDimensions(_texture, mipLevel, &mipWidth, &mipHeight, &mipDepth);
+    return GetRegionSize(std::max(mipWidth, blockSize), std::max(mipHeight, blockSize), mipDepth, _texture->GetFormat());
+}
+
+VkDeviceSize TextureStream::GetNextLevelSize() const
+{
+    return static_cast<VkDeviceSize>(GetLayerSize(_queuedMipLevel - 1)) * _layerCount;
+}
+
+uint32_t TextureStream::QueueNextLevel()
+{
+    uint32_t mipLevel = _queuedMipLevel - 1;
+    uint32_t mipWidth, mipHeight, mipDepth;
+    GetMipDimensions(_texture, mipLevel, &mipWidth, &mipHeight, &mipDepth);
+    std::vector<GraphicsDevice::TextureUploadRegion> regions(_layerCount);
+    for (uint32_t layer = 0; layer < _layerCount; layer++)
+    {
+        GraphicsDevice::TextureUploadRegion& region = regions[layer];
+        region.Data = _source + ComputeSubresourceOffset(_texture, mipLevel, layer);
+        region.X = 0;
+        region.Y = 0;
+        region.Z = 0;
+        region.Width = mipWidth;
+        region.Height = mipHeight;
+        region.Depth = mipDepth;
+        region.MipLevel = mipLevel;
+        region.ArrayLayer = layer;
+    }
+    _gd->UpdateTextureRegions(_texture, _layerCount, regions.data());
+
+    _queuedMipLevel = mipLevel;
+    return mipLevel;
+}
+
+void TextureStream::LevelCompleted(uint32_t mipLevel)
+{
+    // Levels complete in the order they were queued.
+    if (mipLevel < _residentMipLevel)
+    {
+        _residentMipLevel = mipLevel;
+    }
+}
+
+VD_EXPORT uint32_t VdTextureStream_GetResidentMipLevel(TextureStream* stream)
+{
+    return stream->GetResidentMipLevel();
+}
+
+VD_EXPORT bool VdTextureStream_IsComplete(TextureStream* stream)
+{
+    return stream->IsComplete();
+}
+}
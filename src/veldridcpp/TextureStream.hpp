@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "vulkan.h"
+
+namespace Veldrid
+{
+class GraphicsDevice;
+class Texture;
+
+// A whole-texture upload queued by GraphicsDevice::StreamTexture. Mip levels are uploaded one at a time,
+// smallest first, and become resident once the command buffer that copies them has completed.
+class TextureStream
+{
+public:
+    TextureStream(GraphicsDevice* gd, Texture* texture, const void* source);
+
+    Texture* GetTarget() const { return _texture; }
+    // Most detailed level that has landed, or the level count if none has yet.
+    uint32_t GetResidentMipLevel() const { return _residentMipLevel; }
+    bool IsComplete() const { return _residentMipLevel == 0; }
+    bool IsDisposed() const { return _isDisposed; }
+    void Dispose() { _isDisposed = true; }
+    // True while levels are queued but have not landed.
+    bool IsInFlight() const { return _queuedMipLevel < _residentMipLevel; }
+    VkCommandBuffer GetLastCommandBuffer() const { return _lastCommandBuffer; }
+    void SetLastCommandBuffer(VkCommandBuffer cb) { _lastCommandBuffer = cb; }
+
+    bool HasPendingLevels() const { return _queuedMipLevel > 0 && !_isDisposed; }
+    // Bytes uploaded by the next call to QueueNextLevel, across all array layers.
+    VkDeviceSize GetNextLevelSize() const;
+    // Records the copies of the next level through GraphicsDevice::UpdateTextureRegions and returns the level.
+    uint32_t QueueNextLevel();
+    void LevelCompleted(uint32_t mipLevel);
+
+private:
+    GraphicsDevice* _gd;
+    Texture* _texture;
+    const uint8_t* _source;
+    uint32_t _layerCount;
+    uint32_t _queuedMipLevel;
+    std::atomic<uint32_t> _residentMipLevel;
+    VkCommandBuffer _lastCommandBuffer = VK_NULL_HANDLE;
+    bool _isDisposed = false;
+
+    uint32_t GetLayerSize(uint32_t mipLevel) const;
+};
+}
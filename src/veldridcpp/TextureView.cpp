@@ -10,6 +10,21 @@ namespace Veldrid
 TextureView::TextureView(GraphicsDevice* gd, const TextureViewDescription& description)
 {
     _gd = gd;
+    _description = description;
+    _imageView = CreateImageView();
+    _gd->RegisterResource(this);
+}
+
+VkImageView TextureView::Recreate()
+{
+    VkImageView oldView = _imageView;
+    _imageView = CreateImageView();
+    return oldView;
+}
+
+VkImageView TextureView::CreateImageView()
+{
+    const TextureViewDescription& description = _description;
     Texture* target = description.Target;
     VkImageViewCreateInfo imageViewCI = {};
     imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -28,8 +43,12 @@ TextureView::TextureView(GraphicsDevice* gd, const TextureViewDescription& descr
     }
 
     imageViewCI.subresourceRange.aspectMask = aspectFlags;
-    imageViewCI.subresourceRange.baseMipLevel = description.BaseMipLevel;
-    imageViewCI.subresourceRange.levelCount = description.MipLevels;
+    // Leave out levels that are still being streamed in, but always keep the view's last level.
+    _minResidentMipLevel = target->GetMinResidentMipLevel();
+    uint32_t lastMipLevel = description.BaseMipLevel + description.MipLevels - 1;
+    uint32_t baseMipLevel = std::max(description.BaseMipLevel, std::min(_minResidentMipLevel, lastMipLevel));
+    imageViewCI.subresourceRange.baseMipLevel = baseMipLevel;
+    imageViewCI.subresourceRange.levelCount = lastMipLevel + 1 - baseMipLevel;
     imageViewCI.subresourceRange.baseArrayLayer = description.BaseArrayLayer;
     imageViewCI.subresourceRange.layerCount = description.ArrayLayers;
 
@@ -47,11 +66,14 @@ TextureView::TextureView(GraphicsDevice* gd, const TextureViewDescription& descr
         imageViewCI.viewType = VkImageViewType::VK_IMAGE_VIEW_TYPE_3D;
     }
 
-    vkCreateImageView(_gd->GetVkDevice(), &imageViewCI, nullptr, &_imageView);
+    VkImageView imageView;
+    vkCreateImageView(_gd->GetVkDevice(), &imageViewCI, nullptr, &imageView);
+    return imageView;
 }
 
 TextureView::~TextureView()
 {
+    _gd->UnregisterResource(this);
     vkDestroyImageView(_gd->GetVkDevice(), _imageView, nullptr);
 }
 
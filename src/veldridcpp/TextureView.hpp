@@ -11,9 +11,19 @@ public:
     TextureView(GraphicsDevice* gd, const TextureViewDescription& description);
     ~TextureView();
     VkImageView GetVkImageView() const { return _imageView; }
+    Texture* GetTarget() const { return _description.Target; }
+    // The target's minimum resident mip level when the view was created.
+    uint32_t GetMinResidentMipLevel() const { return _minResidentMipLevel; }
+    // Creates a view of the target's current image, after it has been relocated or more of its mip levels
+    // have become resident. Returns the old view, which must be kept alive until work using it has completed.
+    VkImageView Recreate();
 
 private:
     GraphicsDevice * _gd;
+    TextureViewDescription _description;
     VkImageView _imageView;
+    uint32_t _minResidentMipLevel;
+
+    VkImageView CreateImageView();
 };
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Texture.hpp"
 #include <algorithm>
 #include "FormatHelpers.hpp"
+#include "StreamingCopy.hpp"
 
 namespace Veldrid
 {
@@ -114,7 +115,7 @@ inline void CopyTextureRegion(
     if (srcRowPitch == dstRowPitch && srcDepthPitch == dstDepthPitch)
     {
         uint32_t totalCopySize = depth * srcDepthPitch;
-        memcpy(dst, src, totalCopySize);
+        StreamingCopy(dst, src, totalCopySize);
     }
     else
     {
@@ -131,7 +132,7 @@ inline void CopyTextureRegion(
                     + srcRowPitch * (yy + compressedSrcY)
                     + blockSizeInBytes * compressedSrcX;
 
-                memcpy(rowCopyDst, rowCopySrc, rowSize);
+                StreamingCopy(rowCopyDst, rowCopySrc, rowSize);
             }
     }
 }
@@ -16,18 +16,39 @@ static VkMemoryType GetMemoryType(VkPhysicalDeviceMemoryProperties memoryPropert
     return memoryProperties.memoryTypes[index];
 }
 
-static uint32_t FindMemoryType(VkPhysicalDeviceMemoryProperties memProperties, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+// Returns the type that has all of the required properties and the most of the preferred ones.
+static uint32_t FindMemoryType(
+    VkPhysicalDeviceMemoryProperties memProperties,
+    uint32_t typeFilter,
+    VkMemoryPropertyFlags properties,
+    VkMemoryPropertyFlags preferredProperties = 0)
 {
+    uint32_t result = UINT32_MAX;
+    uint32_t bestScore = 0;
     for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
     {
-        if (((typeFilter & (1 << i)) != 0)
-            && (GetMemoryType(memProperties, (uint32_t)i).propertyFlags & properties) == properties)
+        VkMemoryPropertyFlags typeFlags = GetMemoryType(memProperties, i).propertyFlags;
+        if (((typeFilter & (1 << i)) != 0) && (typeFlags & properties) == properties)
         {
-            return (uint32_t)i;
+            uint32_t score = 1;
+            for (VkMemoryPropertyFlags matched = typeFlags & preferredProperties; matched != 0; matched &= matched - 1)
+            {
+                score++;
+            }
+            if (score > bestScore)
+            {
+                result = i;
+                bestScore = score;
+            }
         }
     }
 
-    throw new std::exception("No suitable memory type.");
+    if (result == UINT32_MAX)
+    {
+        throw new std::exception("No suitable memory type.");
+    }
+
+    return result;
 }
 
 static void VulkanUtil_TransitionImageLayout(